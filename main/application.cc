@@ -290,6 +290,16 @@ void Application::ToggleChatState() {
     }
 }
 
+void Application::PrepareAudioChannel() {
+#if CONFIG_USE_WEBSOCKET_PRECONNECT
+    Schedule([this]() {
+        if (protocol_ && device_state_ == kDeviceStateIdle && !protocol_->IsAudioChannelOpened()) {
+            protocol_->Preconnect();
+        }
+    });
+#endif
+}
+
 void Application::StartListening() {
     if (device_state_ == kDeviceStateActivating) {
         SetDeviceState(kDeviceStateIdle);
@@ -369,8 +379,12 @@ void Application::Start() {
         xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
     };
     callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
+        wake_word_time_us_ = esp_timer_get_time();
         xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
     };
+    callbacks.on_wake_word_speech = [this]() {
+        PrepareAudioChannel();
+    };
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
@@ -430,13 +444,14 @@ void Application::Start() {
         last_error_message_ = message;
         xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
     });
-    protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+    protocol_->OnIncomingAudio([this](AudioStreamPacketPtr packet) {
         if (device_state_ == kDeviceStateSpeaking) {
             audio_service_.PushPacketToDecodeQueue(std::move(packet));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
         board.SetPowerSaveMode(false);
+        audio_service_.SetUplinkFrameDuration(protocol_->client_frame_duration());
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
@@ -450,53 +465,20 @@ void Application::Start() {
             SetDeviceState(kDeviceStateIdle);
         });
     });
+    protocol_->OnIncomingControl([this](const ControlMessage& message) {
+        HandleControlMessage(message);
+    });
     protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
+        // Frequent messages too long for the tokenizer's buffer arrive here
+        ControlMessage control;
+        control.Parse(root);
+        if (control.IsFrequent()) {
+            HandleControlMessage(control);
+            return;
+        }
+
         auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
-                }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
+        if (strcmp(type->valuestring, "mcp") == 0) {
             auto payload = cJSON_GetObjectItem(root, "payload");
             if (cJSON_IsObject(payload)) {
                 McpServer::GetInstance().ParseMessage(payload);
@@ -554,6 +536,49 @@ void Application::Start() {
     }
 }
 
+// tts, stt and llm messages; the views are only valid during the call, so they are copied for the main task
+void Application::HandleControlMessage(const ControlMessage& message) {
+    auto display = Board::GetInstance().GetDisplay();
+    if (message.type == "tts") {
+        if (message.state == "start") {
+            Schedule([this]() {
+                aborted_ = false;
+                if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                    SetDeviceState(kDeviceStateSpeaking);
+                }
+            });
+        } else if (message.state == "stop") {
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateSpeaking) {
+                    if (listening_mode_ == kListeningModeManualStop) {
+                        SetDeviceState(kDeviceStateIdle);
+                    } else {
+                        SetDeviceState(kDeviceStateListening);
+                    }
+                }
+            });
+        } else if (message.state == "sentence_start" && !message.text.empty()) {
+            ESP_LOGI(TAG, "<< %.*s", (int)message.text.size(), message.text.data());
+            Schedule([this, display, text = std::string(message.text)]() {
+                display->SetChatMessage("assistant", text.c_str());
+            });
+        }
+    } else if (message.type == "stt") {
+        if (!message.text.empty()) {
+            ESP_LOGI(TAG, ">> %.*s", (int)message.text.size(), message.text.data());
+            Schedule([this, display, text = std::string(message.text)]() {
+                display->SetChatMessage("user", text.c_str());
+            });
+        }
+    } else if (message.type == "llm") {
+        if (!message.emotion.empty()) {
+            Schedule([this, display, emotion = std::string(message.emotion)]() {
+                display->SetEmotion(emotion.c_str());
+            });
+        }
+    }
+}
+
 // Add a async task to MainLoop
 void Application::Schedule(std::function<void()> callback) {
     {
@@ -583,6 +608,7 @@ void Application::MainEventLoop() {
         if (bits & MAIN_EVENT_SEND_AUDIO) {
             while (auto packet = audio_service_.PopPacketFromSendQueue()) {
                 if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
+                    audio_service_.ReportSendFailure();
                     break;
                 }
             }
@@ -596,6 +622,10 @@ void Application::MainEventLoop() {
             if (device_state_ == kDeviceStateListening) {
                 auto led = Board::GetInstance().GetLed();
                 led->OnStateChanged();
+                // End of speech, frames held for batching go out now
+                if (protocol_ && !audio_service_.IsVoiceDetected()) {
+                    protocol_->FlushAudio();
+                }
             }
         }
 
@@ -618,6 +648,16 @@ void Application::MainEventLoop() {
                 // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
                 // SystemInfo::PrintTaskList();
                 SystemInfo::PrintHeapStats();
+                audio_service_.LogStatistics();
+                // Recorded by the music decode thread
+                AudioTimingHistogram resample_time;
+                music_resample_time_.MoveTo(resample_time);
+                if (resample_time.count() > 0) {
+                    char buffer[128];
+                    resample_time.Format(buffer, sizeof(buffer));
+                    ESP_LOGI(TAG, "Music resample %d -> %d Hz (%d taps): %s", music_resampler_.input_sample_rate(),
+                        music_resampler_.output_sample_rate(), music_resampler_.taps(), buffer);
+                }
             }
         }
     }
@@ -637,6 +677,7 @@ void Application::OnWakeWordDetected() {
                 audio_service_.EnableWakeWordDetection(true);
                 return;
             }
+            ESP_LOGI(TAG, "Wake word to server hello: %lldms", (esp_timer_get_time() - wake_word_time_us_) / 1000);
         }
 
         auto wake_word = audio_service_.GetLastWakeWord();
@@ -691,6 +732,10 @@ void Application::SetDeviceState(DeviceState state) {
     auto display = board.GetDisplay();
     auto led = board.GetLed();
     led->OnStateChanged();
+    // Music plays quietly under the reply; while listening it would leak into the microphone
+    // unless AEC removes it, so it pauses then
+    audio_service_.SetMixerDucking(state == kDeviceStateSpeaking);
+    audio_service_.PauseMixerBackground(state == kDeviceStateListening && aec_mode_ == kAecOff);
     switch (state) {
         case kDeviceStateUnknown:
         case kDeviceStateIdle:
@@ -712,6 +757,8 @@ void Application::SetDeviceState(DeviceState state) {
             if (!audio_service_.IsAudioProcessorRunning()) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
+                // In auto stop mode the server finds the end of speech, it needs the silence
+                audio_service_.EnableUplinkDtx(listening_mode_ != kListeningModeAutoStop);
                 audio_service_.EnableVoiceProcessing(true);
                 audio_service_.EnableWakeWordDetection(false);
             }
@@ -905,50 +952,45 @@ void Application::PlaySound(const std::string_view& sound) {
     audio_service_.PlaySound(sound);
 }
 
-// 新增：接收外部音频数据（如音乐播放）
-void Application::AddAudioData(AudioStreamPacket &&packet)
+// 新增：接收外部音频数据（如音乐播放），在音乐解码任务中调用
+bool Application::AddAudioData(const int16_t* pcm, size_t num_samples, int sample_rate)
 {
     auto codec = Board::GetInstance().GetAudioCodec();
-    if (device_state_ == kDeviceStateIdle && codec->output_enabled())
+    if (num_samples == 0)
     {
-        // packet.payload包含的是原始PCM数据（int16_t）
-        if (packet.payload.size() >= 2)
-        {
-            size_t num_samples = packet.payload.size() / sizeof(int16_t);
-            std::vector<int16_t> pcm_data(num_samples);
-            memcpy(pcm_data.data(), packet.payload.data(), packet.payload.size());
-
-            // 检查采样率是否匹配，如果不匹配则进行简单重采样
-            if (packet.sample_rate != codec->output_sample_rate())
-            {
-                // 验证采样率参数
-                if (packet.sample_rate <= 0 || codec->output_sample_rate() <= 0)
-                {
-                    ESP_LOGE(TAG, "Invalid sample rates: %d -> %d",
-                             packet.sample_rate, codec->output_sample_rate());
-                    return;
-                }
-
-                std::vector<int16_t> resampled;
-
-                if (packet.sample_rate > codec->output_sample_rate())
-                {
-                    ESP_LOGI(TAG, "Music Player: Adjust the sampling rate from %d Hz to %d Hz",
-                             codec->output_sample_rate(), packet.sample_rate);
-                }
-
-                // 简单的采样率调整 - 这里可以根据需要实现更复杂的重采样
-                // 为了简化，我们暂时使用原始采样率
-            }
-
-            // 确保音频输出已启用
-            if (!codec->output_enabled())
-            {
-                codec->EnableOutput(true);
-            }
+        return true;
+    }
 
-            // 发送PCM数据到音频编解码器
-            codec->OutputData(pcm_data);
+    // 采样率不匹配时在软件中重采样，不再改动I2S时钟
+    if (sample_rate != codec->output_sample_rate())
+    {
+#if CONFIG_MUSIC_RESAMPLER_QUALITY_LOW
+        auto quality = kResamplerQualityLow;
+#elif CONFIG_MUSIC_RESAMPLER_QUALITY_HIGH
+        auto quality = kResamplerQualityHigh;
+#else
+        auto quality = kResamplerQualityMedium;
+#endif
+        if (!music_resampler_.Configure(sample_rate, codec->output_sample_rate(), quality))
+        {
+            return false;
         }
-    }
-}
\ No newline at end of file
+        // 复用PCM缓冲区，避免每帧分配内存
+        auto& pcm_data = music_pcm_buffer_;
+        pcm_data.clear();
+        int64_t start_time = esp_timer_get_time();
+        music_resampler_.Process(pcm, num_samples, pcm_data);
+        music_resample_time_.Record(esp_timer_get_time() - start_time);
+        pcm = pcm_data.data();
+        num_samples = pcm_data.size();
+    }
+
+    // 写入混音器的音乐环形缓冲区，由音频输出任务与语音混合播放；缓冲区满时在这里阻塞，控制解码节奏
+    return audio_service_.PushPcmToMixer(kAudioMixerStreamMusic, pcm, num_samples);
+}
+
+// 新歌曲或跳转后不再用上一段音频的尾部做滤波历史，只能在音乐解码线程中或其停止时调用
+void Application::ResetMusicResampler()
+{
+    music_resampler_.Reset();
+}
@@ -9,11 +9,14 @@
 #include <string>
 #include <mutex>
 #include <deque>
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include "protocol.h"
 #include "ota.h"
 #include "audio_service.h"
+#include "polyphase_resampler.h"
 #include "device_state_event.h"
 
 
@@ -54,6 +57,8 @@ public:
     void ToggleChatState();
     void StartListening();
     void StopListening();
+    // Connects ahead of the audio channel, e.g. on a button press down, when CONFIG_USE_WEBSOCKET_PRECONNECT is set
+    void PrepareAudioChannel();
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
     bool UpgradeFirmware(Ota& ota, const std::string& url = "");
@@ -62,7 +67,10 @@ public:
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
-    void AddAudioData(AudioStreamPacket&& packet);
+    // Mono music PCM, resampled to the codec rate and written to the mixer; blocks while the music buffer is full
+    bool AddAudioData(const int16_t* pcm, size_t samples, int sample_rate);
+    // Drops the resampler history at a new song or a seek; from the music decode thread or while it is stopped
+    void ResetMusicResampler();
     AudioService& GetAudioService() { return audio_service_; }
 
 private:
@@ -79,6 +87,10 @@ private:
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+    std::vector<int16_t> music_pcm_buffer_;
+    PolyphaseResampler music_resampler_;
+    AudioTimingHistogram music_resample_time_;
+    std::atomic<int64_t> wake_word_time_us_ = 0;
 
     bool has_server_time_ = false;
     bool aborted_ = false;
@@ -87,6 +99,7 @@ private:
     TaskHandle_t main_event_loop_task_handle_ = nullptr;
 
     void OnWakeWordDetected();
+    void HandleControlMessage(const ControlMessage& message);
     void CheckNewVersion(Ota& ota);
     void CheckAssetsVersion();
     void ShowActivationCode(const std::string& code, const std::string& message);
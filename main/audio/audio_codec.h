@@ -13,6 +13,8 @@
 
 #define AUDIO_CODEC_DMA_DESC_NUM 6
 #define AUDIO_CODEC_DMA_FRAME_NUM 240
+// Input and output are disabled after being idle this long, boards may change it with SetPowerTimeout()
+#define AUDIO_CODEC_POWER_TIMEOUT_MS 15000
 
 class AudioCodec {
 public:
@@ -24,6 +26,7 @@ public:
     virtual void EnableInput(bool enable);
     virtual void EnableOutput(bool enable);
     virtual bool SetOutputSampleRate(int sample_rate);
+    void SetPowerTimeout(int timeout_ms) { power_timeout_ms_ = timeout_ms; }
 
     virtual void OutputData(std::vector<int16_t>& data);
     virtual bool InputData(std::vector<int16_t>& data);
@@ -40,6 +43,7 @@ public:
     inline float input_gain() const { return input_gain_; }
     inline bool input_enabled() const { return input_enabled_; }
     inline bool output_enabled() const { return output_enabled_; }
+    inline int power_timeout_ms() const { return power_timeout_ms_; }
 
 protected:
     i2s_chan_handle_t tx_handle_ = nullptr;
@@ -56,6 +60,7 @@ protected:
     int output_channels_ = 1;
     int output_volume_ = 70;
     float input_gain_ = 0.0;
+    int power_timeout_ms_ = AUDIO_CODEC_POWER_TIMEOUT_MS;
 
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
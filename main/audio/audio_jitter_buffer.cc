@@ -0,0 +1,155 @@
+#include "audio_jitter_buffer.h"
+
+#include <esp_log.h>
+
+#define TAG "AudioJitterBuffer"
+
+// A sequence number this far from the expected one means the server started a new stream
+#define JITTER_BUFFER_RESTART_DISTANCE (JITTER_BUFFER_CAPACITY * 4)
+
+
+AudioJitterBuffer::AudioJitterBuffer() {
+    slots_.resize(JITTER_BUFFER_CAPACITY);
+    push_times_us_.resize(JITTER_BUFFER_CAPACITY);
+    statistics_.target_delay_ms = target_delay_us_ / 1000;
+}
+
+void AudioJitterBuffer::Reset() {
+    for (auto& slot : slots_) {
+        slot.reset();
+    }
+    count_ = 0;
+    started_ = false;
+    playing_ = false;
+    concealed_in_row_ = 0;
+    // Keep the jitter estimate, it describes the network rather than the stream
+}
+
+void AudioJitterBuffer::Push(AudioStreamPacketPtr packet, int64_t now_us) {
+    uint32_t sequence = packet->sequence;
+    if (started_) {
+        int32_t distance = (int32_t)(sequence - next_sequence_);
+        if (distance <= -JITTER_BUFFER_RESTART_DISTANCE || distance >= JITTER_BUFFER_RESTART_DISTANCE) {
+            ESP_LOGI(TAG, "Sequence jumped from %lu to %lu, restarting", next_sequence_, sequence);
+            Reset();
+        }
+    }
+    if (!started_) {
+        started_ = true;
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+        last_sequence_ = sequence;
+        last_receive_time_us_ = packet->receive_time_us;
+    }
+    if (packet->frame_duration > 0) {
+        frame_duration_ms_ = packet->frame_duration;
+    }
+    statistics_.received++;
+
+    if ((int32_t)(sequence - next_sequence_) < 0) {
+        statistics_.late++;
+        return;
+    }
+    // Too far ahead of the playout point, give up on the oldest frames
+    while ((int32_t)(sequence - next_sequence_) >= (int32_t)slots_.size()) {
+        Skip();
+    }
+
+    size_t index = sequence % slots_.size();
+    auto& slot = slots_[index];
+    if (slot) {
+        statistics_.duplicated++;
+        return;
+    }
+    UpdateJitter(sequence, packet->receive_time_us);
+    slot = std::move(packet);
+    push_times_us_[index] = now_us;
+    count_++;
+    if ((int32_t)(sequence - highest_sequence_) > 0) {
+        highest_sequence_ = sequence;
+    }
+}
+
+JitterBufferResult AudioJitterBuffer::Pop(AudioStreamPacketPtr& packet, int64_t now_us) {
+    while (count_ > 0) {
+        auto& slot = slots_[next_sequence_ % slots_.size()];
+        int64_t waited_us = now_us - OldestPushTime();
+
+        if (slot) {
+            // Build up the target delay before playout starts, then release packets as they come
+            int64_t buffered_us = (int64_t)(highest_sequence_ - next_sequence_ + 1) * frame_duration_ms_ * 1000;
+            if (!playing_ && waited_us < target_delay_us_ && buffered_us < target_delay_us_) {
+                return kJitterBufferEmpty;
+            }
+            packet = std::move(slot);
+            count_--;
+            next_sequence_++;
+            playing_ = true;
+            concealed_in_row_ = 0;
+            return kJitterBufferPacket;
+        }
+
+        // The next packet is missing, wait for it until a later one has waited the target delay
+        if (waited_us < target_delay_us_) {
+            return kJitterBufferEmpty;
+        }
+        next_sequence_++;
+        statistics_.lost++;
+        if (concealed_in_row_ < JITTER_BUFFER_MAX_CONCEALED_FRAMES) {
+            concealed_in_row_++;
+            statistics_.concealed++;
+            return kJitterBufferConceal;
+        }
+    }
+
+    // Underrun, build up the delay again before the next packet is played
+    playing_ = false;
+    return kJitterBufferEmpty;
+}
+
+void AudioJitterBuffer::Skip() {
+    auto& slot = slots_[next_sequence_ % slots_.size()];
+    if (slot) {
+        slot.reset();
+        count_--;
+        statistics_.late++;
+    } else {
+        statistics_.lost++;
+    }
+    next_sequence_++;
+}
+
+void AudioJitterBuffer::UpdateJitter(uint32_t sequence, int64_t receive_time_us) {
+    int32_t sequence_delta = (int32_t)(sequence - last_sequence_);
+    if (sequence_delta <= 0 || receive_time_us == 0) {
+        return;
+    }
+
+    // Only arrivals later than the frame clock hurt playback, early ones just fill the buffer
+    int64_t transit_us = (receive_time_us - last_receive_time_us_) - (int64_t)sequence_delta * frame_duration_ms_ * 1000;
+    if (transit_us < 0) {
+        transit_us = 0;
+    }
+    jitter_us_ += (transit_us - jitter_us_) / 16;
+    last_sequence_ = sequence;
+    last_receive_time_us_ = receive_time_us;
+
+    target_delay_us_ = jitter_us_ * 2;
+    if (target_delay_us_ < JITTER_BUFFER_MIN_DELAY_MS * 1000) {
+        target_delay_us_ = JITTER_BUFFER_MIN_DELAY_MS * 1000;
+    } else if (target_delay_us_ > JITTER_BUFFER_MAX_DELAY_MS * 1000) {
+        target_delay_us_ = JITTER_BUFFER_MAX_DELAY_MS * 1000;
+    }
+    statistics_.jitter_ms = jitter_us_ / 1000;
+    statistics_.target_delay_ms = target_delay_us_ / 1000;
+}
+
+int64_t AudioJitterBuffer::OldestPushTime() const {
+    int64_t oldest = INT64_MAX;
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (slots_[i] && push_times_us_[i] < oldest) {
+            oldest = push_times_us_[i];
+        }
+    }
+    return oldest;
+}
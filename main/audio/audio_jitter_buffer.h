@@ -0,0 +1,83 @@
+#ifndef AUDIO_JITTER_BUFFER_H
+#define AUDIO_JITTER_BUFFER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "protocol.h"
+
+#define JITTER_BUFFER_MIN_DELAY_MS 60
+#define JITTER_BUFFER_MAX_DELAY_MS 480
+#define JITTER_BUFFER_MIN_FRAME_DURATION_MS 20
+// The missing packet plus the maximum delay of the shortest frames after it
+#define JITTER_BUFFER_CAPACITY (JITTER_BUFFER_MAX_DELAY_MS / JITTER_BUFFER_MIN_FRAME_DURATION_MS + 1)
+// Longer gaps are skipped instead of concealed, Opus PLC fades to silence anyway
+#define JITTER_BUFFER_MAX_CONCEALED_FRAMES 3
+// How often the decode task rechecks a buffer that is holding packets back
+#define JITTER_BUFFER_POLL_INTERVAL_MS 10
+
+
+struct JitterBufferStatistics {
+    uint32_t received = 0;
+    uint32_t late = 0;          // Arrived after their slot was played or concealed, dropped
+    uint32_t duplicated = 0;
+    uint32_t lost = 0;          // Never arrived in time
+    uint32_t concealed = 0;     // Lost frames replaced by Opus PLC
+    uint32_t target_delay_ms = 0;
+    uint32_t jitter_ms = 0;
+};
+
+enum JitterBufferResult {
+    kJitterBufferEmpty,     // Nothing to play yet
+    kJitterBufferPacket,    // The next packet in sequence order
+    kJitterBufferConceal,   // The next packet is lost, play a PLC frame in its place
+};
+
+/*
+ * Reorders sequenced server audio (MQTT+UDP) before it reaches the Opus decoder.
+ *
+ * Packets are stored by sequence number. The next one is released as soon as it is
+ * present; a missing one is declared lost once a later packet has waited in the buffer
+ * for the target delay, which follows the measured arrival jitter (RFC 3550 style estimate
+ * over the network receive times, counting only late arrivals because the server usually
+ * sends faster than realtime). The wait counts from Push() rather than from reception, as
+ * packets may sit in the decode queue for seconds behind a burst of TTS.
+ *
+ * Only used by the decode task, so it has no locking.
+ */
+class AudioJitterBuffer {
+public:
+    AudioJitterBuffer();
+
+    void Push(AudioStreamPacketPtr packet, int64_t now_us);
+    JitterBufferResult Pop(AudioStreamPacketPtr& packet, int64_t now_us);
+    void Reset();
+
+    size_t size() const { return count_; }
+    // Later packets are buffered but the next one in sequence is not
+    bool missing_next() const { return count_ > 0 && !slots_[next_sequence_ % slots_.size()]; }
+    const JitterBufferStatistics& statistics() const { return statistics_; }
+
+private:
+    std::vector<AudioStreamPacketPtr> slots_;
+    std::vector<int64_t> push_times_us_;    // When each slot was filled
+    size_t count_ = 0;
+    bool started_ = false;
+    bool playing_ = false;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    int frame_duration_ms_ = 60;
+    int concealed_in_row_ = 0;
+
+    uint32_t last_sequence_ = 0;
+    int64_t last_receive_time_us_ = 0;
+    int64_t jitter_us_ = 0;
+    int64_t target_delay_us_ = JITTER_BUFFER_MIN_DELAY_MS * 1000;
+    JitterBufferStatistics statistics_;
+
+    void UpdateJitter(uint32_t sequence, int64_t receive_time_us);
+    int64_t OldestPushTime() const;
+    void Skip();
+};
+
+#endif // AUDIO_JITTER_BUFFER_H
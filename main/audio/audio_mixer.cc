@@ -0,0 +1,216 @@
+#include "audio_mixer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "AudioMixer"
+
+
+static inline int16_t ClampInt16(int32_t value) {
+    return (value > INT16_MAX) ? INT16_MAX : (value < INT16_MIN) ? INT16_MIN : (int16_t)value;
+}
+
+void AudioMixer::Initialize(int sample_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sample_rate_ = sample_rate;
+    scratch_.reserve(sample_rate_ * AUDIO_MIXER_BLOCK_MS / 1000);
+}
+
+bool AudioMixer::Write(AudioMixerStream stream, const int16_t* data, size_t samples) {
+    auto& s = streams_[stream];
+    while (samples > 0) {
+        size_t written;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // Background buffers are only allocated once a stream is used, Clear() may free one while waiting
+            cv_.wait(lock, [this, &s]() { return closed_ || s.buffer.empty() || s.count < s.buffer.size(); });
+            if (closed_) {
+                return false;
+            }
+            if (s.buffer.empty()) {
+                s.buffer.resize(sample_rate_ * s.buffer_ms / 1000);
+            }
+            if (s.starved_since_us > 0) {
+                s.statistics.underruns++;
+                s.statistics.starved_us += esp_timer_get_time() - s.starved_since_us;
+                s.starved_since_us = 0;
+            }
+            s.writing = true;
+
+            size_t capacity = s.buffer.size();
+            written = std::min(samples, capacity - s.count);
+            size_t write = (s.read + s.count) % capacity;
+            size_t first = std::min(written, capacity - write);
+            memcpy(&s.buffer[write], data, first * sizeof(int16_t));
+            memcpy(&s.buffer[0], data + first, (written - first) * sizeof(int16_t));
+            s.count += written;
+        }
+        data += written;
+        samples -= written;
+        if (on_data_available_) {
+            on_data_available_();
+        }
+    }
+    return true;
+}
+
+void AudioMixer::Finish(AudioMixerStream stream) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_[stream].writing = false;
+    streams_[stream].starved_since_us = 0;
+}
+
+void AudioMixer::Clear(AudioMixerStream stream) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& s = streams_[stream];
+    s.read = 0;
+    s.count = 0;
+    s.writing = false;
+    s.starved_since_us = 0;
+    // Reallocated by the next write if the buffer duration changed
+    if (s.buffer.size() != (size_t)(sample_rate_ * s.buffer_ms / 1000)) {
+        std::vector<int16_t>().swap(s.buffer);
+    }
+    cv_.notify_all();
+}
+
+void AudioMixer::SetBufferDuration(AudioMixerStream stream, int duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_[stream].buffer_ms = duration_ms;
+    ESP_LOGI(TAG, "Stream %d buffer %dms", stream, duration_ms);
+}
+
+void AudioMixer::Open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = false;
+}
+
+void AudioMixer::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    cv_.notify_all();
+}
+
+void AudioMixer::SetGain(AudioMixerStream stream, int percent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_[stream].gain = percent * 32768 / 100;
+    ESP_LOGI(TAG, "Stream %d gain %d%%", stream, percent);
+}
+
+void AudioMixer::SetBackgroundPaused(bool paused) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (background_paused_ == paused) {
+            return;
+        }
+        background_paused_ = paused;
+        // Fade back in from silence on resume
+        for (int i = kAudioMixerStreamVoice + 1; i < kAudioMixerStreamCount; i++) {
+            streams_[i].current_gain = 0;
+        }
+    }
+    ESP_LOGI(TAG, "Background %s", paused ? "paused" : "resumed");
+    // Wake the output task, it went to sleep while nothing could be mixed
+    if (!paused && on_data_available_) {
+        on_data_available_();
+    }
+}
+
+bool AudioMixer::HasBackground() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = kAudioMixerStreamVoice + 1; i < kAudioMixerStreamCount; i++) {
+        if (streams_[i].count > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int AudioMixer::BufferedMs(AudioMixerStream stream) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streams_[stream].count * 1000 / sample_rate_;
+}
+
+AudioMixerStatistics AudioMixer::statistics(AudioMixerStream stream) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streams_[stream].statistics;
+}
+
+size_t AudioMixer::ReadLocked(Stream& stream, int16_t* dest, size_t samples) {
+    size_t capacity = stream.buffer.size();
+    size_t read = std::min(samples, stream.count);
+    size_t first = std::min(read, capacity - stream.read);
+    memcpy(dest, &stream.buffer[stream.read], first * sizeof(int16_t));
+    memcpy(dest + first, &stream.buffer[0], (read - first) * sizeof(int16_t));
+    stream.read = (stream.read + read) % capacity;
+    stream.count -= read;
+    return read;
+}
+
+bool AudioMixer::Mix(std::vector<int16_t>& pcm) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool voice = !pcm.empty();
+    size_t samples = pcm.size();
+    if (!voice) {
+        if (background_paused_) {
+            return false;
+        }
+        // Only background audio, play whatever the fullest stream has, up to one block
+        size_t block = sample_rate_ * AUDIO_MIXER_BLOCK_MS / 1000;
+        for (int i = kAudioMixerStreamVoice + 1; i < kAudioMixerStreamCount; i++) {
+            samples = std::max(samples, std::min(streams_[i].count, block));
+        }
+        if (samples == 0) {
+            return false;
+        }
+        pcm.assign(samples, 0);
+    }
+
+    auto& voice_stream = streams_[kAudioMixerStreamVoice];
+    if (voice && voice_stream.gain != 32768) {
+        for (auto& sample : pcm) {
+            sample = ClampInt16(((int32_t)sample * voice_stream.gain) >> 15);
+        }
+    }
+
+    if (voice) {
+        duck_hold_samples_ = sample_rate_ * AUDIO_MIXER_DUCK_HOLD_MS / 1000;
+    } else {
+        duck_hold_samples_ = duck_hold_samples_ > (int)samples ? duck_hold_samples_ - samples : 0;
+    }
+    bool ducked = voice || duck_hold_samples_ > 0 || duck_requested_;
+    int ramp_step = 32768 / (sample_rate_ * AUDIO_MIXER_RAMP_MS / 1000) + 1;
+
+    bool freed = false;
+    for (int i = kAudioMixerStreamVoice + 1; i < kAudioMixerStreamCount && !background_paused_; i++) {
+        auto& stream = streams_[i];
+        if (stream.count == 0) {
+            continue;
+        }
+        scratch_.resize(samples);
+        size_t read = ReadLocked(stream, scratch_.data(), samples);
+        freed = true;
+        if (stream.count == 0 && stream.writing) {
+            // The producer fell behind, counted as an underrun if it writes again
+            stream.starved_since_us = esp_timer_get_time();
+        }
+
+        int target = ducked ? stream.gain * AUDIO_MIXER_DUCK_PERCENT / 100 : stream.gain;
+        int gain = stream.current_gain;
+        for (size_t j = 0; j < read; j++) {
+            if (gain < target) {
+                gain = std::min(gain + ramp_step, target);
+            } else if (gain > target) {
+                gain = std::max(gain - ramp_step, target);
+            }
+            pcm[j] = ClampInt16(pcm[j] + (((int32_t)scratch_[j] * gain) >> 15));
+        }
+        stream.current_gain = gain;
+    }
+    if (freed) {
+        cv_.notify_all();
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// PCM a background stream may buffer ahead of the speaker, the producer blocks beyond it
+#define AUDIO_MIXER_STREAM_BUFFER_MS 240
+// Output block while only background streams play
+#define AUDIO_MIXER_BLOCK_MS 20
+// Background streams duck to this gain while voice plays, and stay ducked for the hold time after it
+#define AUDIO_MIXER_DUCK_PERCENT 20
+#define AUDIO_MIXER_DUCK_HOLD_MS 400
+#define AUDIO_MIXER_RAMP_MS 50
+
+
+enum AudioMixerStream {
+    kAudioMixerStreamVoice,     // Decoded Opus: TTS and notification sounds
+    kAudioMixerStreamMusic,
+    kAudioMixerStreamCount,
+};
+
+struct AudioMixerStatistics {
+    uint32_t underruns = 0;     // The stream ran empty while its producer was still writing
+    int64_t starved_us = 0;     // Total time between running empty and the next write
+};
+
+/*
+ * Mixes the background streams (music) into the voice played by the audio output task,
+ * which stays the only caller of AudioCodec::OutputData.
+ *
+ * Voice blocks come from the playback queue and set the pace; background streams are
+ * buffered here at the codec output rate and fill the gaps between voice blocks.
+ * Every stream has its own gain, and background streams duck under voice, or under an
+ * explicit request such as the device speaking, with a short ramp to avoid clicks.
+ * Paused background streams keep their buffered audio and are not mixed, so their
+ * producers block on the full buffer until playback resumes.
+ *
+ * Write() is called by the producer of a stream and blocks while its buffer is full,
+ * Mix() is called by the output task, the rest may be called from any task.
+ * A producer calls Finish() after its last write, so the stream draining is not counted as an underrun.
+ */
+class AudioMixer {
+public:
+    void Initialize(int sample_rate);
+    // Called after data was written, so the output task can wake up
+    void OnDataAvailable(std::function<void()> callback) { on_data_available_ = callback; }
+
+    // Producer side, returns false if the mixer was closed while waiting
+    bool Write(AudioMixerStream stream, const int16_t* data, size_t samples);
+    void Finish(AudioMixerStream stream);
+    void Clear(AudioMixerStream stream);
+    // Buffer length of a background stream, takes effect when the stream is cleared or first used
+    void SetBufferDuration(AudioMixerStream stream, int duration_ms);
+    void Open();
+    void Close();
+
+    // Mixes the background streams into a voice block, or fills pcm with background audio if it is empty.
+    // Returns false if there was nothing to play.
+    bool Mix(std::vector<int16_t>& pcm);
+
+    void SetGain(AudioMixerStream stream, int percent);
+    void SetDucking(bool ducking) { duck_requested_ = ducking; }
+    void SetBackgroundPaused(bool paused);
+    bool HasBackground();
+    // Audio of a stream written but not played yet
+    int BufferedMs(AudioMixerStream stream);
+    AudioMixerStatistics statistics(AudioMixerStream stream);
+
+private:
+    struct Stream {
+        std::vector<int16_t> buffer;
+        size_t read = 0;
+        size_t count = 0;
+        int gain = 32768;           // Q15, set by SetGain
+        int current_gain = 32768;   // Q15, ramps towards gain, or the ducked gain
+        int buffer_ms = AUDIO_MIXER_STREAM_BUFFER_MS;
+        bool writing = false;       // Between the first write and Finish() or Clear()
+        int64_t starved_since_us = 0;
+        AudioMixerStatistics statistics;
+    };
+
+    int sample_rate_ = 16000;
+    Stream streams_[kAudioMixerStreamCount];
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool closed_ = false;
+    std::atomic<bool> duck_requested_ = false;
+    bool background_paused_ = false;
+    int duck_hold_samples_ = 0;
+    std::vector<int16_t> scratch_;
+    std::function<void()> on_data_available_;
+
+    size_t ReadLocked(Stream& stream, int16_t* dest, size_t samples);
+};
+
+#endif // AUDIO_MIXER_H
@@ -0,0 +1,125 @@
+#ifndef AUDIO_POOL_H
+#define AUDIO_POOL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A released buffer above this multiple of the nominal size is given back, frames
+// resampled to a higher output rate stay below it
+#define AUDIO_POOL_SHRINK_FACTOR 4
+
+struct AudioPoolStats {
+    uint32_t acquired = 0;          // Objects handed out
+    uint32_t heap_allocations = 0;  // Objects created because the free list was empty
+    uint32_t heap_frees = 0;        // Objects deleted because the free list was full
+    uint32_t shrinks = 0;           // Buffers given back because they grew past AUDIO_POOL_SHRINK_FACTOR
+    uint32_t in_use = 0;
+    uint32_t peak_in_use = 0;
+};
+
+/*
+ * Fixed-capacity recycling allocator for the per-frame audio objects (AudioStreamPacket, AudioTask).
+ *
+ * Reserve() preallocates some objects and sets the capacity, the most the pool keeps. Objects go
+ * back to the free list when their Ptr is destroyed and keep their buffer, so a frame costs no
+ * heap allocation. A burst beyond the free objects allocates once, and the pool keeps the new
+ * objects up to its capacity; only objects beyond the capacity are deleted on release.
+ *
+ * T must provide Recycle() to reset its fields, Reserve(size_t) to size its buffer, and
+ * Shrink(size_t) to give back a buffer above AUDIO_POOL_SHRINK_FACTOR times that size.
+ */
+template <typename T>
+class AudioPool {
+public:
+    struct Deleter {
+        void operator()(T* object) const {
+            AudioPool::GetInstance().Release(object);
+        }
+    };
+    using Ptr = std::unique_ptr<T, Deleter>;
+
+    static AudioPool& GetInstance() {
+        static AudioPool instance;
+        return instance;
+    }
+    AudioPool(const AudioPool&) = delete;
+    AudioPool& operator=(const AudioPool&) = delete;
+
+    // Preallocate count objects, each with a buffer large enough for the biggest frame, and keep
+    // up to capacity objects that bursts allocate
+    void Reserve(size_t count, size_t buffer_size, size_t capacity = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffer_size_ = buffer_size;
+        capacity_ = std::max(count, capacity);
+        free_.reserve(capacity_);
+        while (free_.size() < count) {
+            auto object = new T();
+            object->Reserve(buffer_size_);
+            free_.push_back(object);
+        }
+    }
+
+    Ptr Acquire() {
+        T* object = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.acquired++;
+            if (++stats_.in_use > stats_.peak_in_use) {
+                stats_.peak_in_use = stats_.in_use;
+            }
+            if (!free_.empty()) {
+                object = free_.back();
+                free_.pop_back();
+            } else {
+                stats_.heap_allocations++;
+            }
+        }
+        if (object == nullptr) {
+            object = new T();
+            object->Reserve(buffer_size_);
+        }
+        return Ptr(object);
+    }
+
+    AudioPoolStats stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<T*> free_;
+    size_t capacity_ = 0;
+    size_t buffer_size_ = 0;
+    AudioPoolStats stats_;
+
+    AudioPool() = default;
+    ~AudioPool() {
+        for (auto object : free_) {
+            delete object;
+        }
+    }
+
+    void Release(T* object) {
+        object->Recycle();
+        bool shrunk = object->Shrink(buffer_size_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.in_use--;
+            if (shrunk) {
+                stats_.shrinks++;
+            }
+            if (free_.size() < capacity_) {
+                free_.push_back(object);
+                return;
+            }
+            stats_.heap_frees++;
+        }
+        delete object;
+    }
+};
+
+#endif // AUDIO_POOL_H
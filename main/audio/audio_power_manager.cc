@@ -0,0 +1,123 @@
+#include "audio_power_manager.h"
+
+#include <esp_log.h>
+
+#define TAG "AudioPowerManager"
+
+
+static const char* const kPathNames[] = { "input", "output" };
+
+AudioPowerManager::~AudioPowerManager() {
+    for (auto& path : paths_) {
+        if (path.timer != nullptr) {
+            esp_timer_stop(path.timer);
+            esp_timer_delete(path.timer);
+        }
+    }
+}
+
+void AudioPowerManager::Initialize(AudioCodec* codec) {
+    codec_ = codec;
+    for (int i = 0; i < kAudioPowerPathCount; i++) {
+        auto& path = paths_[i];
+        path.owner = this;
+        path.id = (AudioPowerPath)i;
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                Path* path = (Path*)arg;
+                path->owner->OnIdleTimeout(path->id);
+            },
+            .arg = &path,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "audio_power_timer",
+            .skip_unhandled_events = true,
+        };
+        esp_timer_create(&timer_args, &path.timer);
+    }
+    // Boards override the default with AudioCodec::SetPowerTimeout() when they create the codec
+    ESP_LOGI(TAG, "Idle timeout %dms", codec_->power_timeout_ms());
+}
+
+void AudioPowerManager::Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < kAudioPowerPathCount; i++) {
+        auto& path = paths_[i];
+        path.since_us = now;
+        path.state = kAudioPowerStateActive;
+        TransitionLocked((AudioPowerPath)i, kAudioPowerStateIdle);
+    }
+}
+
+void AudioPowerManager::Stop() {
+    for (auto& path : paths_) {
+        esp_timer_stop(path.timer);
+    }
+}
+
+void AudioPowerManager::Transition(AudioPowerPath path, AudioPowerState state) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TransitionLocked(path, state);
+}
+
+void AudioPowerManager::TransitionLocked(AudioPowerPath id, AudioPowerState state) {
+    auto& path = paths_[id];
+    AudioPowerState current = path.state;
+    // Boards may disable a path behind our back, e.g. in their power save mode
+    if (state == kAudioPowerStateActive && !CodecPathEnabled(id)) {
+        EnableCodecPath(id, true);
+        path.statistics.wakeups++;
+    }
+    if (current == state) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    path.statistics.time_us[current] += now - path.since_us;
+    path.since_us = now;
+
+    switch (state) {
+    case kAudioPowerStateActive:
+        esp_timer_stop(path.timer);
+        break;
+    case kAudioPowerStateIdle:
+        esp_timer_stop(path.timer);
+        esp_timer_start_once(path.timer, (uint64_t)codec_->power_timeout_ms() * 1000);
+        break;
+    case kAudioPowerStateOff:
+        EnableCodecPath(id, false);
+        break;
+    default:
+        break;
+    }
+    path.state = state;
+    ESP_LOGD(TAG, "Codec %s: %d -> %d", kPathNames[id], current, state);
+}
+
+void AudioPowerManager::EnableCodecPath(AudioPowerPath path, bool enable) {
+    if (CodecPathEnabled(path) == enable) {
+        return;
+    }
+    if (path == kAudioPowerPathInput) {
+        codec_->EnableInput(enable);
+    } else {
+        codec_->EnableOutput(enable);
+    }
+}
+
+// The path may have become active again while the timer callback was queued
+void AudioPowerManager::OnIdleTimeout(AudioPowerPath path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (paths_[path].state == kAudioPowerStateIdle) {
+        ESP_LOGI(TAG, "Codec %s idle for %dms, disabling it", kPathNames[path], codec_->power_timeout_ms());
+        TransitionLocked(path, kAudioPowerStateOff);
+    }
+}
+
+AudioPowerStatistics AudioPowerManager::statistics(AudioPowerPath id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& path = paths_[id];
+    AudioPowerStatistics statistics = path.statistics;
+    statistics.time_us[path.state] += esp_timer_get_time() - path.since_us;
+    return statistics;
+}
@@ -0,0 +1,91 @@
+#ifndef AUDIO_POWER_MANAGER_H
+#define AUDIO_POWER_MANAGER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include <esp_timer.h>
+
+#include "audio_codec.h"
+
+
+enum AudioPowerState {
+    kAudioPowerStateOff,        // Codec path disabled
+    kAudioPowerStateIdle,       // Enabled, waiting for the idle timeout
+    kAudioPowerStateActive,     // In use
+    kAudioPowerStateCount,
+};
+
+enum AudioPowerPath {
+    kAudioPowerPathInput,
+    kAudioPowerPathOutput,
+    kAudioPowerPathCount,
+};
+
+struct AudioPowerStatistics {
+    int64_t time_us[kAudioPowerStateCount] = {};
+    uint32_t wakeups = 0;
+};
+
+/*
+ * Power state machine of the codec input and output paths.
+ *
+ * The audio tasks report transitions instead of timestamps: a path becomes active when a
+ * task is about to read or write, and idle when the task runs out of work (the playback
+ * queue drained, the input task stopped). An idle path arms a one-shot timer and is
+ * disabled when it fires, unless it became active again in the meantime.
+ * The idle timeout comes from the codec, so boards can change it.
+ *
+ * SetActive() only reads the state and the codec flag while the path is active, so it may be
+ * called for every frame. Everything else takes the mutex.
+ */
+class AudioPowerManager {
+public:
+    ~AudioPowerManager();
+
+    void Initialize(AudioCodec* codec);
+    // The codec starts with both paths enabled, they are treated as idle until used
+    void Start();
+    void Stop();
+
+    void SetActive(AudioPowerPath path) {
+        if (paths_[path].state.load(std::memory_order_relaxed) != kAudioPowerStateActive || !CodecPathEnabled(path)) {
+            Transition(path, kAudioPowerStateActive);
+        }
+    }
+    void SetIdle(AudioPowerPath path) {
+        if (paths_[path].state.load(std::memory_order_relaxed) == kAudioPowerStateActive) {
+            Transition(path, kAudioPowerStateIdle);
+        }
+    }
+
+    AudioPowerState state(AudioPowerPath path) const { return paths_[path].state; }
+    // Time spent in each state up to now
+    AudioPowerStatistics statistics(AudioPowerPath path);
+
+private:
+    struct Path {
+        AudioPowerManager* owner = nullptr;
+        AudioPowerPath id = kAudioPowerPathInput;
+        std::atomic<AudioPowerState> state = kAudioPowerStateOff;
+        int64_t since_us = 0;
+        AudioPowerStatistics statistics;
+        esp_timer_handle_t timer = nullptr;
+    };
+
+    AudioCodec* codec_ = nullptr;
+    Path paths_[kAudioPowerPathCount];
+    std::mutex mutex_;
+
+    void Transition(AudioPowerPath path, AudioPowerState state);
+    void TransitionLocked(AudioPowerPath path, AudioPowerState state);
+    bool CodecPathEnabled(AudioPowerPath path) const {
+        return path == kAudioPowerPathInput ? codec_->input_enabled() : codec_->output_enabled();
+    }
+    void EnableCodecPath(AudioPowerPath path, bool enable);
+    void OnIdleTimeout(AudioPowerPath path);
+};
+
+#endif // AUDIO_POWER_MANAGER_H
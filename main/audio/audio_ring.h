@@ -0,0 +1,225 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+
+/*
+ * Preallocated single-producer / single-consumer ring used between the audio tasks.
+ *
+ * TryPush / TryPop never take a lock. The mutex and condition variable are only
+ * touched by a caller that has to block because the ring is full or empty, and by
+ * the other side when it sees somebody waiting.
+ *
+ * Clear() may be called from any task. It marks everything queued so far as
+ * discarded, and the consumer drops those slots on its next pop.
+ */
+template <typename T>
+class AudioRing {
+public:
+    AudioRing() = default;
+    explicit AudioRing(size_t capacity) { Reset(capacity); }
+    AudioRing(const AudioRing&) = delete;
+    AudioRing& operator=(const AudioRing&) = delete;
+
+    // Not thread safe, call it before the producer and consumer tasks start
+    void Reset(size_t capacity) {
+        slots_.clear();
+        slots_.resize(capacity);
+        head_ = 0;
+        tail_ = 0;
+        discard_ = 0;
+        closed_ = false;
+    }
+
+    size_t capacity() const { return slots_.size(); }
+
+    // Number of items the consumer will still receive
+    size_t size() const {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t discard = discard_.load(std::memory_order_acquire);
+        if (discard > head) {
+            head = discard;
+        }
+        return tail > head ? tail - head : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    // Full from the producer's point of view, discarded slots still occupy space
+    bool full() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire) >= slots_.size();
+    }
+
+    // Producer side. The item is only moved from on success.
+    bool TryPush(T&& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= slots_.size()) {
+            return false;
+        }
+        slots_[tail % slots_.size()] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        WakeWaiters();
+        return true;
+    }
+
+    // Consumer side
+    bool TryPop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t discard = discard_.load(std::memory_order_acquire);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t start = head;
+
+        while (head < discard && head < tail) {
+            slots_[head % slots_.size()] = T();
+            head++;
+        }
+
+        bool popped = false;
+        if (head < tail) {
+            auto& slot = slots_[head % slots_.size()];
+            item = std::move(slot);
+            slot = T();
+            head++;
+            popped = true;
+        }
+
+        if (head != start) {
+            head_.store(head, std::memory_order_release);
+            WakeWaiters();
+        }
+        return popped;
+    }
+
+    // Blocks while the ring is full, returns false if the ring is closed
+    bool WaitNotFull() {
+        return Wait([this]() { return !full(); });
+    }
+
+    // Blocks while there is nothing to pop, returns false if the ring is closed
+    bool WaitNotEmpty() {
+        return Wait([this]() {
+            return tail_.load(std::memory_order_acquire) != head_.load(std::memory_order_acquire);
+        });
+    }
+
+    bool Push(T&& item) {
+        while (!TryPush(std::move(item))) {
+            if (!WaitNotFull()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Pop(T& item) {
+        while (!TryPop(item)) {
+            if (!WaitNotEmpty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Clear() {
+        discard_.store(tail_.load(std::memory_order_acquire), std::memory_order_release);
+        WakeWaiters();
+    }
+
+    // Closing wakes up every blocked caller, the blocking calls fail until Open()
+    void Close() {
+        closed_.store(true);
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_all();
+    }
+
+    void Open() {
+        closed_.store(false);
+    }
+
+    bool closed() const { return closed_.load(); }
+
+private:
+    std::vector<T> slots_;
+    std::atomic<size_t> head_ = 0;
+    std::atomic<size_t> tail_ = 0;
+    std::atomic<size_t> discard_ = 0;
+    std::atomic<bool> closed_ = false;
+    std::atomic<int> waiters_ = 0;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    template <typename Predicate>
+    bool Wait(Predicate ready) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiters_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv_.wait(lock, [this, &ready]() { return closed_.load() || ready(); });
+        waiters_.fetch_sub(1);
+        return !closed_.load();
+    }
+
+    void WakeWaiters() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv_.notify_all();
+        }
+    }
+};
+
+/*
+ * Bounded queue that keeps the newest items, for low rate side data such as the
+ * server AEC timestamps. A full queue drops its oldest item, which the lock free
+ * ring cannot do from the producer side, so a short mutex guards it instead.
+ */
+template <typename T, size_t N>
+class LatestQueue {
+public:
+    // Returns false if the oldest item was dropped to make room
+    bool Push(const T& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool dropped = count_ == N;
+        if (dropped) {
+            head_ = (head_ + 1) % N;
+            count_--;
+        }
+        items_[(head_ + count_) % N] = item;
+        count_++;
+        return !dropped;
+    }
+
+    bool Pop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count_ == 0) {
+            return false;
+        }
+        item = items_[head_];
+        head_ = (head_ + 1) % N;
+        count_--;
+        return true;
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        head_ = 0;
+        count_ = 0;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+private:
+    std::mutex mutex_;
+    T items_[N] = {};
+    size_t head_ = 0;
+    size_t count_ = 0;
+};
+
+#endif // AUDIO_RING_H
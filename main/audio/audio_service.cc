@@ -1,6 +1,9 @@
 #include "audio_service.h"
+#include "sample_conversion.h"
+#include "sample_conversion_benchmark.h"
 #include <esp_log.h>
-#include <cstring>
+#include <esp_cpu.h>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -20,6 +23,19 @@
 
 AudioService::AudioService() {
     event_group_ = xEventGroupCreate();
+
+    audio_encode_queue_.Reset(MAX_ENCODE_TASKS_IN_QUEUE);
+    audio_playback_queue_.Reset(MAX_PLAYBACK_TASKS_IN_QUEUE);
+    audio_decode_queue_.Reset(MAX_DECODE_PACKETS_IN_QUEUE);
+    audio_send_queue_.Reset(MAX_SEND_PACKETS_IN_QUEUE);
+    audio_testing_queue_.Reset(AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS);
+    wake_word_history_.Reset(WAKE_WORD_HISTORY_MS / OPUS_MIN_FRAME_DURATION_MS);
+    wake_word_pcm_.reserve(AUDIO_TASK_RESERVE_SAMPLES * 2);
+    audio_sound_queue_.Reset(MAX_SOUNDS_IN_QUEUE);
+
+    AudioStreamPacketPool::GetInstance().Reserve(AUDIO_PACKET_POOL_SIZE, AUDIO_PACKET_RESERVE_BYTES,
+        AUDIO_PACKET_POOL_CAPACITY);
+    AudioTaskPool::GetInstance().Reserve(AUDIO_TASK_POOL_SIZE, AUDIO_TASK_RESERVE_SAMPLES);
 }
 
 AudioService::~AudioService() {
@@ -34,9 +50,20 @@ void AudioService::Initialize(AudioCodec* codec) {
     codec_->Start();
 
     /* Setup the audio codec */
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
+    opus_decoder_cache_.Initialize(codec->output_sample_rate());
+    opus_decoder_ = &opus_decoder_cache_.Get(codec->output_sample_rate(), OPUS_FRAME_DURATION_MS);
+    // The UI sounds share one rate and frame duration, created by the first sound played
+    sound_decoder_cache_.Initialize(codec->output_sample_rate(), 1);
+    opus_encoders_[OPUS_FRAME_DURATION_MS / 20 - 1] = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    opus_encoder_ = opus_encoders_[OPUS_FRAME_DURATION_MS / 20 - 1].get();
+    opus_encoder_->SetComplexity(uplink_controller_.complexity());
+
+    mixer_.Initialize(codec->output_sample_rate());
+    // The music stream is the PCM ring between the MP3 decode task and the output task
+    mixer_.SetBufferDuration(kAudioMixerStreamMusic, CONFIG_MUSIC_PCM_BUFFER_MS);
+    mixer_.OnDataAvailable([this]() {
+        NotifyOutputTask();
+    });
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
@@ -60,24 +87,33 @@ void AudioService::Initialize(AudioCodec* codec) {
         }
     });
 
-    esp_timer_create_args_t audio_power_timer_args = {
-        .callback = [](void* arg) {
-            AudioService* audio_service = (AudioService*)arg;
-            audio_service->CheckAndUpdateAudioPowerState();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "audio_power_timer",
-        .skip_unhandled_events = true,
-    };
-    esp_timer_create(&audio_power_timer_args, &audio_power_timer_);
+    power_manager_.Initialize(codec);
+
+#if CONFIG_USE_SAMPLE_CONVERSION_BENCHMARK
+    SampleConversionTiming timings[SAMPLE_CONVERSION_BENCHMARK_KERNELS];
+    size_t count = SampleConversionBenchmark::Run([]() {
+        return (uint32_t)esp_cpu_get_cycle_count();
+    }, timings, SAMPLE_CONVERSION_BENCHMARK_KERNELS);
+    for (size_t i = 0; i < count; i++) {
+        ESP_LOGI(TAG, "%s: %lu cycles per %d samples", timings[i].name, (unsigned long)timings[i].ticks,
+            SAMPLE_CONVERSION_BENCHMARK_SAMPLES);
+    }
+#endif
 }
 
 void AudioService::Start() {
     service_stopped_ = false;
     xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    esp_timer_start_periodic(audio_power_timer_, 1000000);
+    audio_encode_queue_.Open();
+    audio_decode_queue_.Open();
+    audio_playback_queue_.Open();
+    audio_send_queue_.Open();
+    audio_testing_queue_.Open();
+    audio_sound_queue_.Open();
+    mixer_.Open();
+
+    power_manager_.Start();
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     /* Start the audio input task */
@@ -109,62 +145,91 @@ void AudioService::Start() {
     }, "audio_output", 2048, this, 4, &audio_output_task_handle_);
 #endif
 
+#if CONFIG_USE_SPLIT_OPUS_CODEC_TASKS
+    /* Start the opus encode and decode tasks on their own cores */
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusEncodeTask();
+        vTaskDelete(NULL);
+    }, "opus_encode", 2048 * 13, this, CONFIG_OPUS_ENCODE_TASK_PRIORITY, &opus_encode_task_handle_, CONFIG_OPUS_ENCODE_TASK_CORE);
+
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusDecodeTask();
+        vTaskDelete(NULL);
+    }, "opus_decode", 2048 * 8, this, CONFIG_OPUS_DECODE_TASK_PRIORITY, &opus_decode_task_handle_, CONFIG_OPUS_DECODE_TASK_CORE);
+#else
     /* Start the opus codec task */
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->OpusCodecTask();
         vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_codec", 2048 * 13, this, 2, &opus_encode_task_handle_);
+    opus_decode_task_handle_ = opus_encode_task_handle_;
+#endif
 }
 
 void AudioService::Stop() {
-    esp_timer_stop(audio_power_timer_);
+    power_manager_.Stop();
     service_stopped_ = true;
     xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    audio_encode_queue_.Clear();
+    audio_decode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+    audio_sound_queue_.Clear();
+    {
+        // The history frames in the encode queue are gone, nobody should wait for them
+        std::lock_guard<std::mutex> lock(wake_word_history_mutex_);
+        wake_word_frames_in_flight_ = 0;
+        wake_word_history_cv_.notify_all();
+    }
+
+    audio_encode_queue_.Close();
+    audio_decode_queue_.Close();
+    audio_playback_queue_.Close();
+    audio_send_queue_.Close();
+    audio_testing_queue_.Close();
+    audio_sound_queue_.Close();
+    mixer_.Close();
+    NotifyEncodeTask();
+    NotifyDecodeTask();
+    NotifyOutputTask();
 }
 
 bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
-    if (!codec_->input_enabled()) {
-        esp_timer_stop(audio_power_timer_);
-        esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
-        codec_->EnableInput(true);
-    }
+    power_manager_.SetActive(kAudioPowerPathInput);
 
     if (codec_->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
-        if (!codec_->InputData(data)) {
+        /* Read into scratch buffers and resample into data, the buffers keep their capacity between calls */
+        input_buffer_.resize(samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
+        if (!codec_->InputData(input_buffer_)) {
             return false;
         }
+        int64_t start_time = esp_timer_get_time();
         if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            // Deinterleave to [mic | reference], resample both halves, then interleave into data
+            size_t frames = input_buffer_.size() / 2;
+            input_channel_buffer_.resize(input_buffer_.size());
+            int16_t* mic = input_channel_buffer_.data();
+            int16_t* reference = mic + frames;
+            SampleConversion::Deinterleave(input_buffer_.data(), mic, reference, frames);
+            size_t output_frames = input_resampler_.GetOutputSamples(frames);
+            input_resample_buffer_.resize(output_frames * 2);
+            input_resampler_.Process(mic, frames, input_resample_buffer_.data());
+            reference_resampler_.Process(reference, frames, input_resample_buffer_.data() + output_frames);
+            data.resize(output_frames * 2);
+            const int16_t* resampled_mic = input_resample_buffer_.data();
+            const int16_t* resampled_reference = resampled_mic + output_frames;
+            SampleConversion::Interleave(resampled_mic, resampled_reference, data.data(), output_frames);
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            data.resize(input_resampler_.GetOutputSamples(input_buffer_.size()));
+            input_resampler_.Process(input_buffer_.data(), input_buffer_.size(), data.data());
         }
+        input_process_time_.Record(esp_timer_get_time() - start_time);
     } else {
         data.resize(samples * codec_->input_channels());
         if (!codec_->InputData(data)) {
@@ -172,8 +237,6 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
         }
     }
 
-    /* Update the last input time */
-    last_input_time_ = std::chrono::steady_clock::now();
     debug_statistics_.input_count++;
 
 #if CONFIG_USE_AUDIO_DEBUGGER
@@ -188,7 +251,15 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
 }
 
 void AudioService::AudioInputTask() {
+    /* Reused for every read, the encoder hands recycled buffers back through PushTaskToEncodeQueue */
+    std::vector<int16_t> data;
+    data.reserve(AUDIO_TASK_RESERVE_SAMPLES * 2);
     while (true) {
+        /* Nothing reads the microphone until one of the bits is set again */
+        if ((xEventGroupGetBits(event_group_) & (AS_EVENT_AUDIO_TESTING_RUNNING |
+            AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING)) == 0) {
+            power_manager_.SetIdle(kAudioPowerPathInput);
+        }
         EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
             AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
             pdFALSE, pdFALSE, portMAX_DELAY);
@@ -204,21 +275,17 @@ void AudioService::AudioInputTask() {
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            if (audio_testing_queue_.full()) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
             int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
             if (ReadAudioData(data, 16000, samples)) {
-                // If input channels is 2, we need to fetch the left channel data
+                // If input channels is 2, keep the left channel in place
                 if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
+                    SampleConversion::ExtractChannel(data.data(), data.data(), data.size() / 2, 2, 0);
+                    data.resize(data.size() / 2);
                 }
                 PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
                 continue;
@@ -227,7 +294,6 @@ void AudioService::AudioInputTask() {
 
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
@@ -239,7 +305,6 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
@@ -257,199 +322,531 @@ void AudioService::AudioInputTask() {
 }
 
 void AudioService::AudioOutputTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
-        if (service_stopped_) {
-            break;
+    AudioTaskPtr task;
+    std::vector<int16_t> background;
+    background.reserve(codec_->output_sample_rate() * AUDIO_MIXER_BLOCK_MS / 1000);
+    while (!service_stopped_) {
+        /* Voice blocks set the pace, background streams are mixed under them or fill the gaps */
+        bool voice = audio_playback_queue_.TryPop(task);
+        if (voice) {
+            NotifyDecodeTask();
+        } else {
+            background.clear();
         }
-
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
-
-        if (!codec_->output_enabled()) {
-            esp_timer_stop(audio_power_timer_);
-            esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
-            codec_->EnableOutput(true);
+        auto& pcm = voice ? task->pcm : background;
+        if (!mixer_.Mix(pcm)) {
+            /* Playback drained, the output powers down unless something plays before the timeout */
+            power_manager_.SetIdle(kAudioPowerPathOutput);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
         }
-        codec_->OutputData(task->pcm);
 
-        /* Update the last output time */
-        last_output_time_ = std::chrono::steady_clock::now();
+        power_manager_.SetActive(kAudioPowerPathOutput);
+        if (voice) {
+            downlink_latency_.Record(esp_timer_get_time() - task->enqueue_time_us);
+        }
+        codec_->OutputData(pcm);
         debug_statistics_.playback_count++;
 
 #if CONFIG_USE_SERVER_AEC
         /* Record the timestamp for server AEC */
-        if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
+        if (voice && task->timestamp > 0) {
+            if (!timestamp_queue_.Push(task->timestamp)) {
+                ESP_LOGW(TAG, "Timestamp queue is full, dropping the oldest timestamp");
+            }
         }
 #endif
+        task.reset();
     }
 
     ESP_LOGW(TAG, "Audio output task stopped");
 }
 
 void AudioService::OpusCodecTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
-        if (service_stopped_) {
+    while (!service_stopped_) {
+        bool busy = DecodeNextPacket();
+        busy = EncodeNextTask() || busy;
+
+        /* Nothing to do, wait until a queue we care about changes */
+        if (!busy) {
+            ulTaskNotifyTake(pdTRUE, DecodeWaitTicks());
+        }
+    }
+
+    ESP_LOGW(TAG, "Opus codec task stopped");
+}
+
+// Wake up periodically while the jitter buffer holds packets back, it has no other event to wait for
+TickType_t AudioService::DecodeWaitTicks() const {
+    return jitter_buffer_.size() > 0 ? pdMS_TO_TICKS(JITTER_BUFFER_POLL_INTERVAL_MS) : portMAX_DELAY;
+}
+
+void AudioService::OpusEncodeTask() {
+    while (!service_stopped_) {
+        if (!EncodeNextTask()) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+
+    ESP_LOGW(TAG, "Opus encode task stopped");
+}
+
+void AudioService::OpusDecodeTask() {
+    while (!service_stopped_) {
+        if (!DecodeNextPacket()) {
+            ulTaskNotifyTake(pdTRUE, DecodeWaitTicks());
+        }
+    }
+
+    ESP_LOGW(TAG, "Opus decode task stopped");
+}
+
+bool AudioService::DecodeNextPacket() {
+    if (decoder_reset_.exchange(false)) {
+        jitter_buffer_.Reset();
+        opus_decoder_cache_.ResetState();
+        sound_decoder_cache_.ResetState();
+        current_sound_ = SoundPlayback();
+        sound_capture_.reset();
+        sound_playing_ = false;
+    }
+    if (audio_playback_queue_.full()) {
+        return false;
+    }
+
+    /* A sound starts once the stream audio that arrived before it is decoded, then plays to its end */
+    bool stream_pending = jitter_buffer_.size() > 0 || !audio_decode_queue_.empty();
+    if ((current_sound_.index != nullptr || !stream_pending) && DecodeNextSound()) {
+        return true;
+    }
+
+    /* Sequenced packets go through the jitter buffer, the others are decoded in arrival order.
+       A missing packet may still be in the decode queue behind a burst, look there before Pop() declares it lost */
+    AudioStreamPacketPtr packet;
+    auto result = kJitterBufferEmpty;
+    while (jitter_buffer_.missing_next() && audio_decode_queue_.TryPop(packet)) {
+        if (packet->sequence == 0) {
+            result = kJitterBufferPacket;
             break;
         }
+        jitter_buffer_.Push(std::move(packet), esp_timer_get_time());
+    }
+    if (result == kJitterBufferEmpty) {
+        result = jitter_buffer_.Pop(packet, esp_timer_get_time());
+    }
+    while (result == kJitterBufferEmpty && audio_decode_queue_.TryPop(packet)) {
+        if (packet->sequence == 0) {
+            result = kJitterBufferPacket;
+            break;
+        }
+        int64_t now = esp_timer_get_time();
+        jitter_buffer_.Push(std::move(packet), now);
+        result = jitter_buffer_.Pop(packet, now);
+    }
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
-
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
-                }
+    /* Replay the audio testing queue once testing stops */
+    if (result == kJitterBufferEmpty) {
+        if ((xEventGroupGetBits(event_group_) & AS_EVENT_AUDIO_TESTING_RUNNING) || !audio_testing_queue_.TryPop(packet)) {
+            return false;
+        }
+        result = kJitterBufferPacket;
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    auto task = AudioTaskPool::GetInstance().Acquire();
+    task->type = kAudioTaskTypeDecodeToPlaybackQueue;
+
+    bool decoded;
+    if (result == kJitterBufferConceal) {
+        // An empty payload makes the decoder generate a packet loss concealment frame
+        decoded = opus_decoder_->decoder->Decode(std::vector<uint8_t>(), task->pcm);
+    } else {
+        task->timestamp = packet->timestamp;
+        opus_decoder_ = &opus_decoder_cache_.Get(packet->sample_rate, packet->frame_duration);
+        decoded = opus_decoder_->decoder->Decode(std::move(packet->payload), task->pcm);
+    }
+    if (decoded) {
+        ResampleDecodedPcm(*opus_decoder_, task->pcm);
+        task->enqueue_time_us = start_time;
+        audio_playback_queue_.TryPush(std::move(task));
+        NotifyOutputTask();
+    } else {
+        ESP_LOGE(TAG, "Failed to decode audio");
+    }
+    decode_time_.Record(esp_timer_get_time() - start_time);
+    debug_statistics_.decode_count++;
+    return true;
+}
+
+/* Plays the next frame of the current sound, returns false if no sound is playing */
+bool AudioService::DecodeNextSound() {
+    if (current_sound_.index == nullptr) {
+        if (!audio_sound_queue_.TryPop(current_sound_)) {
+            return false;
+        }
+        // Every sound decodes from a clean state, not from the tail of the previous one
+        sound_decoder_cache_.ResetState();
+        sound_playing_ = true;
+        sound_position_ = 0;
+    }
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
+    int64_t start_time = esp_timer_get_time();
+    auto task = AudioTaskPool::GetInstance().Acquire();
+    task->type = kAudioTaskTypeDecodeToPlaybackQueue;
+
+    bool finished;
+    auto& sound = current_sound_;
+    if (sound.pcm) {
+        /* Cached PCM is at the output rate already, play it in frames of the usual size */
+        size_t frame_samples = codec_->output_sample_rate() * OPUS_FRAME_DURATION_MS / 1000;
+        size_t samples = std::min(frame_samples, sound.pcm->samples - sound_position_);
+        const int16_t* data = sound.pcm->data + sound_position_;
+        task->pcm.assign(data, data + samples);
+        sound_position_ += samples;
+        finished = sound_position_ >= sound.pcm->samples;
+    } else {
+        auto& packets = sound.index->packets;
+        if (sound_position_ == 0) {
+            // Capture the decoded sound for the next time, sized for full length frames
+            sound_capture_ = sound_cache_.CreatePcm(packets.size() * codec_->output_sample_rate() * OPUS_FRAME_DURATION_MS / 1000);
+        }
+        if (sound_position_ < packets.size()) {
+            auto& packet = packets[sound_position_++];
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(sound.ogg.data()) + packet.offset;
+            sound_payload_.assign(data, data + packet.size);
+            auto& decoder = sound_decoder_cache_.Get(sound.index->sample_rate, OPUS_FRAME_DURATION_MS);
+            if (decoder.decoder->Decode(std::move(sound_payload_), task->pcm)) {
+                ResampleDecodedPcm(decoder, task->pcm);
+                if (sound_capture_ && sound_capture_->samples + task->pcm.size() <= sound_capture_->capacity) {
+                    std::copy(task->pcm.begin(), task->pcm.end(), sound_capture_->data + sound_capture_->samples);
+                    sound_capture_->samples += task->pcm.size();
+                } else {
+                    sound_capture_.reset();
+                }
             } else {
-                ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
-            }
-            debug_statistics_.decode_count++;
-        }
-        
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
-                continue;
+                ESP_LOGE(TAG, "Failed to decode sound");
+                sound_capture_.reset();
             }
+        }
+        finished = sound_position_ >= packets.size();
+        if (finished && sound_capture_) {
+            sound_cache_.StorePcm(sound.ogg, std::move(sound_capture_));
+        }
+    }
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
+    if (finished) {
+        current_sound_ = SoundPlayback();
+        sound_capture_.reset();
+        sound_playing_ = false;
+    }
+    if (!task->pcm.empty()) {
+        task->enqueue_time_us = start_time;
+        audio_playback_queue_.TryPush(std::move(task));
+        NotifyOutputTask();
+    }
+    decode_time_.Record(esp_timer_get_time() - start_time);
+    debug_statistics_.decode_count++;
+    return true;
+}
+
+// Converts PCM decoded by the decoder to the codec output rate in place
+void AudioService::ResampleDecodedPcm(OpusDecoderCache::Entry& decoder, std::vector<int16_t>& pcm) {
+    if (!decoder.resample) {
+        return;
+    }
+    auto& resampler = decoder.resampler;
+    int target_size = resampler.GetOutputSamples(pcm.size());
+    output_resample_buffer_.resize(target_size);
+    resampler.Process(pcm.data(), pcm.size(), output_resample_buffer_.data());
+    pcm.swap(output_resample_buffer_);
+}
+
+bool AudioService::EncodeNextTask() {
+    if (audio_send_queue_.full()) {
+        return false;
+    }
+
+    AudioTaskPtr task;
+    if (!audio_encode_queue_.TryPop(task)) {
+        return false;
+    }
+
+    if (uplink_controller_reset_.exchange(false)) {
+        uplink_controller_.Reset(negotiated_frame_duration_, CONFIG_OPUS_ENCODE_MAX_COMPLEXITY);
+        opus_encoder_->SetComplexity(uplink_controller_.complexity());
+    }
+    if (uplink_dtx_reset_.exchange(false)) {
+        ApplyUplinkDtx();
+    }
+
+    /* The encoder follows the frame size of the PCM, which changes when the processor is switched */
+    SetEncodeFrameDuration(task->pcm.size() * 1000 / 16000);
+
+    int64_t start_time = esp_timer_get_time();
+    auto packet = AudioStreamPacketPool::GetInstance().Acquire();
+    packet->frame_duration = encode_frame_duration_;
+    packet->sample_rate = 16000;
+    packet->timestamp = task->timestamp;
+    if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
+        ESP_LOGE(TAG, "Failed to encode audio");
+        if (task->type == kAudioTaskTypeEncodeToWakeWordHistory) {
+            PushWakeWordHistory(nullptr);
+        }
+        return true;
+    }
+    int64_t end_time = esp_timer_get_time();
+    encode_time_.Record(end_time - start_time);
+    uplink_latency_.Record(end_time - task->enqueue_time_us);
+
+    if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+        size_t preroll_frames = 0;
+        if (!uplink_dtx_enabled_ || uplink_dtx_.Process(packet, task->voice)) {
+            /* Voice resumed, the held back frames go out first */
+            AudioStreamPacketPtr preroll;
+            while (uplink_dtx_.PopPreroll(preroll)) {
+                if (audio_send_queue_.TryPush(std::move(preroll))) {
+                    preroll_frames++;
                 }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
             }
-            debug_statistics_.encode_count++;
-            lock.lock();
+            audio_send_queue_.TryPush(std::move(packet));
+            if (callbacks_.on_send_queue_available) {
+                callbacks_.on_send_queue_available();
+            }
+        }
+        /* The pre-roll is queued at once by design, only the rest of the queue is send backlog */
+        size_t send_queue_depth = audio_send_queue_.size();
+        send_queue_depth -= std::min(send_queue_depth, preroll_frames);
+        if (uplink_controller_.Update(send_queue_depth, send_failures_.exchange(0), end_time - start_time)) {
+            opus_encoder_->SetComplexity(uplink_controller_.complexity());
+            ApplyUplinkFrameDuration(uplink_controller_.frame_duration_ms());
         }
+    } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
+        if (!audio_testing_queue_.TryPush(std::move(packet))) {
+            ESP_LOGW(TAG, "Audio testing queue is full, dropping packet");
+        }
+    } else if (task->type == kAudioTaskTypeEncodeToWakeWordHistory) {
+        PushWakeWordHistory(std::move(packet));
+    }
+    debug_statistics_.encode_count++;
+    return true;
+}
+
+void AudioService::NotifyEncodeTask() {
+    if (opus_encode_task_handle_ != nullptr) {
+        xTaskNotifyGive(opus_encode_task_handle_);
     }
+}
 
-    ESP_LOGW(TAG, "Opus codec task stopped");
+void AudioService::NotifyDecodeTask() {
+    if (opus_decode_task_handle_ != nullptr) {
+        xTaskNotifyGive(opus_decode_task_handle_);
+    }
 }
 
-void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
+void AudioService::NotifyOutputTask() {
+    if (audio_output_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_output_task_handle_);
+    }
+}
+
+void AudioService::SetEncodeFrameDuration(int frame_duration) {
+    if (frame_duration == encode_frame_duration_ ||
+        (frame_duration != 20 && frame_duration != 40 && frame_duration != 60)) {
         return;
     }
 
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    ESP_LOGI(TAG, "Encoder frame duration %dms -> %dms", encode_frame_duration_, frame_duration);
+    encode_frame_duration_ = frame_duration;
+    auto& encoder = opus_encoders_[frame_duration / 20 - 1];
+    if (encoder == nullptr) {
+        encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, frame_duration);
+    } else {
+        // Its state is from the last time this duration was used
+        encoder->ResetState();
+    }
+    opus_encoder_ = encoder.get();
+    opus_encoder_->SetComplexity(uplink_controller_.complexity());
+    opus_encoder_->SetDtx(uplink_dtx_enabled_);
+}
+
+void AudioService::EnableUplinkDtx(bool enable) {
+#if CONFIG_USE_UPLINK_DTX
+    uplink_dtx_requested_ = enable;
+    uplink_dtx_reset_ = true;
+#endif
+}
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+// Called by the encode task at the start of a session, logs what the last one saved
+void AudioService::ApplyUplinkDtx() {
+    auto& dtx = uplink_dtx_.statistics();
+    if (uplink_dtx_enabled_ && dtx.frames > 0) {
+        ESP_LOGI(TAG, "Uplink DTX: suppressed %lu of %lu frames (%lu bytes), %lu keepalives, %lu talkspurts",
+            dtx.suppressed, dtx.frames, dtx.suppressed_bytes, dtx.keepalives, dtx.talkspurts);
+    }
+    uplink_dtx_enabled_ = uplink_dtx_requested_;
+    uplink_dtx_.Reset();
+    opus_encoder_->SetDtx(uplink_dtx_enabled_);
+}
+
+void AudioService::SetUplinkFrameDuration(int frame_duration_ms) {
+    ESP_LOGI(TAG, "Uplink frame duration: %dms", frame_duration_ms);
+    negotiated_frame_duration_ = frame_duration_ms;
+    uplink_controller_reset_ = true;
+    ApplyUplinkFrameDuration(frame_duration_ms);
+}
+
+// The processor decides the PCM frame size, the encoder follows it in EncodeNextTask()
+void AudioService::ApplyUplinkFrameDuration(int frame_duration) {
+    if (uplink_frame_duration_.exchange(frame_duration) != frame_duration) {
+        audio_processor_->SetOutputFrameDuration(frame_duration);
     }
 }
 
 void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
+    auto task = AudioTaskPool::GetInstance().Acquire();
     task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+    /* Swap buffers so the producer gets a recycled buffer back instead of allocating a new one */
+    task->pcm.swap(pcm);
+    pcm.clear();
+    task->enqueue_time_us = esp_timer_get_time();
 
     /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        // The processor reports the VAD state before it outputs the frame
+        task->voice = voice_detected_;
+        uint32_t timestamp = 0;
+        if (timestamp_queue_.Pop(timestamp)) {
+            task->timestamp = timestamp;
         }
-        timestamp_queue_.pop_front();
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    PushEncodeTask(std::move(task));
 }
 
-bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+/* Push a task to the encode queue, blocking while the opus codec task catches up */
+bool AudioService::PushEncodeTask(AudioTaskPtr task) {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(encode_producer_mutex_);
+            if (audio_encode_queue_.TryPush(std::move(task))) {
+                break;
+            }
+        }
+        if (!audio_encode_queue_.WaitNotFull()) {
             return false;
         }
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
+    NotifyEncodeTask();
     return true;
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
+/*
+ * Cut the wake word engine's audio into uplink frames and queue them for the encoder.
+ * Runs on the wake word task, which owns wake_word_pcm_, and never waits for the encoder:
+ * if the encode queue is full the oldest pending audio is dropped instead.
+ */
+void AudioService::StoreWakeWordAudio(const int16_t* data, size_t samples) {
+    if (wake_word_pcm_reset_.exchange(false)) {
+        wake_word_pcm_.clear();
+    }
+    if (!wake_word_history_enabled_) {
+        return;
+    }
+
+    wake_word_pcm_.insert(wake_word_pcm_.end(), data, data + samples);
+    size_t frame_samples = uplink_frame_duration_ * 16000 / 1000;
+    while (wake_word_pcm_.size() >= frame_samples) {
+        auto task = AudioTaskPool::GetInstance().Acquire();
+        task->type = kAudioTaskTypeEncodeToWakeWordHistory;
+        task->pcm.assign(wake_word_pcm_.begin(), wake_word_pcm_.begin() + frame_samples);
+        task->enqueue_time_us = esp_timer_get_time();
+
+        {
+            std::lock_guard<std::mutex> lock(wake_word_history_mutex_);
+            wake_word_frames_in_flight_++;
+        }
+        bool pushed;
+        {
+            std::lock_guard<std::mutex> lock(encode_producer_mutex_);
+            pushed = audio_encode_queue_.TryPush(std::move(task));
+        }
+        if (!pushed) {
+            PushWakeWordHistory(nullptr);
+            // Keep only the newest frame for the next try, the buffer stays within its reserve
+            wake_word_pcm_.erase(wake_word_pcm_.begin(), wake_word_pcm_.end() - frame_samples);
+            break;
+        }
+        wake_word_pcm_.erase(wake_word_pcm_.begin(), wake_word_pcm_.begin() + frame_samples);
+        NotifyEncodeTask();
+    }
+}
+
+/* Called by the encode task for every history frame, nullptr if the frame was lost */
+void AudioService::PushWakeWordHistory(AudioStreamPacketPtr packet) {
+    std::lock_guard<std::mutex> lock(wake_word_history_mutex_);
+    // Stop() may have reset the count while this frame was being encoded
+    if (wake_word_frames_in_flight_ > 0) {
+        wake_word_frames_in_flight_--;
+    }
+    if (packet) {
+        // Drop the oldest frames beyond the history duration
+        AudioStreamPacketPtr oldest;
+        while (wake_word_history_.full() ||
+            (int)(wake_word_history_.size() + 1) * packet->frame_duration > WAKE_WORD_HISTORY_MS) {
+            if (!wake_word_history_.TryPop(oldest)) {
+                break;
+            }
+        }
+        wake_word_history_.TryPush(std::move(packet));
+    }
+    wake_word_history_cv_.notify_all();
+}
+
+bool AudioService::PushPacketToDecodeQueue(AudioStreamPacketPtr packet, bool wait) {
+    // Arrival time drives the jitter estimate, the loss timer starts once the packet leaves the queue
+    packet->receive_time_us = esp_timer_get_time();
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+            if (audio_decode_queue_.TryPush(std::move(packet))) {
+                break;
+            }
+        }
+        if (!wait || !audio_decode_queue_.WaitNotFull()) {
+            return false;
+        }
+    }
+    NotifyDecodeTask();
+    return true;
+}
+
+AudioStreamPacketPtr AudioService::PopPacketFromSendQueue() {
+    AudioStreamPacketPtr packet;
+    if (!audio_send_queue_.TryPop(packet)) {
         return nullptr;
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
+    NotifyEncodeTask();
     return packet;
 }
 
+// The history is encoded already, just stop adding to it so the packets end at the wake word
 void AudioService::EncodeWakeWord() {
-    if (wake_word_) {
-        wake_word_->EncodeWakeWordData();
-    }
+    wake_word_history_enabled_ = false;
 }
 
 const std::string& AudioService::GetLastWakeWord() const {
     return wake_word_->GetLastDetectedWakeWord();
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopWakeWordPacket() {
-    auto packet = std::make_unique<AudioStreamPacket>();
-    if (wake_word_->GetWakeWordOpus(packet->payload)) {
-        return packet;
-    }
-    return nullptr;
+AudioStreamPacketPtr AudioService::PopWakeWordPacket() {
+    std::unique_lock<std::mutex> lock(wake_word_history_mutex_);
+    // Only the last frames before the detection can still be in the encoder
+    wake_word_history_cv_.wait_for(lock, std::chrono::milliseconds(WAKE_WORD_FLUSH_TIMEOUT_MS), [this]() {
+        return wake_word_frames_in_flight_ <= 0 || !wake_word_history_.empty();
+    });
+    AudioStreamPacketPtr packet;
+    wake_word_history_.TryPop(packet);
+    return packet;
 }
 
 void AudioService::EnableWakeWordDetection(bool enable) {
@@ -466,6 +863,13 @@ void AudioService::EnableWakeWordDetection(bool enable) {
             }
             wake_word_initialized_ = true;
         }
+        {
+            std::lock_guard<std::mutex> lock(wake_word_history_mutex_);
+            wake_word_history_.Clear();
+        }
+        // The wake word task clears its buffer before it stores more audio
+        wake_word_pcm_reset_ = true;
+        wake_word_history_enabled_ = true;
         wake_word_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_WAKE_WORD_RUNNING);
     } else {
@@ -478,7 +882,7 @@ void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+            audio_processor_->Initialize(codec_, uplink_frame_duration_, models_list_);
             audio_processor_initialized_ = true;
         }
 
@@ -499,17 +903,16 @@ void AudioService::EnableAudioTesting(bool enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /* The opus codec task plays back audio_testing_queue_ once the testing bit is cleared */
+        audio_decode_queue_.Clear();
+        NotifyDecodeTask();
     }
 }
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
     if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+        audio_processor_->Initialize(codec_, uplink_frame_duration_, models_list_);
         audio_processor_initialized_ = true;
     }
 
@@ -521,132 +924,94 @@ void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
 }
 
 void AudioService::PlaySound(const std::string_view& ogg) {
-    if (!codec_->output_enabled()) {
-        esp_timer_stop(audio_power_timer_);
-        esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
-        codec_->EnableOutput(true);
+    /* The index is built on the first play, after that queueing a sound costs a lookup */
+    SoundPlayback sound;
+    sound.ogg = ogg;
+    sound.index = sound_cache_.GetIndex(ogg);
+    sound.pcm = sound_cache_.GetPcm(ogg);
+    if (!sound.pcm && sound.index->packets.empty()) {
+        ESP_LOGW(TAG, "No audio packets in sound %p", ogg.data());
+        return;
     }
 
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
-
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
-        }
-        return static_cast<size_t>(-1);
-    };
-
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
-
     while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
-                }
-                continue;
+        {
+            std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+            if (audio_sound_queue_.TryPush(std::move(sound))) {
+                break;
             }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
-                }
-                continue;
-            }
-
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
         }
-
-        offset = body_off + body_size;
+        if (!audio_sound_queue_.WaitNotFull()) {
+            return;
+        }
     }
+    NotifyDecodeTask();
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty() &&
+        audio_sound_queue_.empty() && !sound_playing_ && !mixer_.HasBackground();
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    timestamp_queue_.Clear();
+    audio_decode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+    audio_sound_queue_.Clear();
+    decoder_reset_ = true;
+    NotifyDecodeTask();
 }
 
-void AudioService::CheckAndUpdateAudioPowerState() {
-    auto now = std::chrono::steady_clock::now();
-    auto input_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_input_time_).count();
-    auto output_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_output_time_).count();
-    if (input_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->input_enabled()) {
-        codec_->EnableInput(false);
-    }
-    if (output_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->output_enabled()) {
-        codec_->EnableOutput(false);
+void AudioService::LogStatistics() {
+    auto packets = AudioStreamPacketPool::GetInstance().stats();
+    auto tasks = AudioTaskPool::GetInstance().stats();
+    ESP_LOGI(TAG, "frames: input %lu encode %lu decode %lu playback %lu",
+        debug_statistics_.input_count, debug_statistics_.encode_count,
+        debug_statistics_.decode_count, debug_statistics_.playback_count);
+    ESP_LOGI(TAG, "packet pool: acquired %lu heap %lu/%lu shrinks %lu in use %lu peak %lu, task pool: acquired %lu heap %lu/%lu shrinks %lu in use %lu peak %lu",
+        packets.acquired, packets.heap_allocations, packets.heap_frees, packets.shrinks, packets.in_use, packets.peak_in_use,
+        tasks.acquired, tasks.heap_allocations, tasks.heap_frees, tasks.shrinks, tasks.in_use, tasks.peak_in_use);
+    auto& uplink = uplink_controller_.statistics();
+    ESP_LOGI(TAG, "uplink: frame %dms complexity %d, send failures %lu congested windows %lu, changes frame %lu complexity %lu",
+        encode_frame_duration_, uplink_controller_.complexity(), uplink.send_failures, uplink.congested_windows,
+        uplink.frame_duration_changes, uplink.complexity_changes);
+    if (uplink_dtx_enabled_) {
+        auto& dtx = uplink_dtx_.statistics();
+        ESP_LOGI(TAG, "uplink dtx: suppressed %lu of %lu frames (%lu bytes), keepalives %lu talkspurts %lu",
+            dtx.suppressed, dtx.frames, dtx.suppressed_bytes, dtx.keepalives, dtx.talkspurts);
     }
-    if (!codec_->input_enabled() && !codec_->output_enabled()) {
-        esp_timer_stop(audio_power_timer_);
+    auto& decoders = opus_decoder_cache_.statistics();
+    ESP_LOGI(TAG, "decoder cache: hits %lu misses %lu evictions %lu",
+        decoders.hits, decoders.misses, decoders.evictions);
+    auto sounds = sound_cache_.statistics();
+    ESP_LOGI(TAG, "sound cache: indexed %lu, pcm hits %lu misses %lu evictions %lu, %u bytes",
+        sounds.indexed, sounds.pcm_hits, sounds.pcm_misses, sounds.pcm_evictions, sounds.pcm_bytes);
+    auto& jitter = jitter_buffer_.statistics();
+    ESP_LOGI(TAG, "jitter buffer: received %lu late %lu duplicated %lu lost %lu concealed %lu, jitter %lums target %lums",
+        jitter.received, jitter.late, jitter.duplicated, jitter.lost, jitter.concealed,
+        jitter.jitter_ms, jitter.target_delay_ms);
+    auto music = mixer_.statistics(kAudioMixerStreamMusic);
+    ESP_LOGI(TAG, "mixer music: underruns %lu starved %lldms", music.underruns, music.starved_us / 1000);
+
+    for (int i = 0; i < kAudioPowerPathCount; i++) {
+        auto power = power_manager_.statistics((AudioPowerPath)i);
+        ESP_LOGI(TAG, "codec %s power: off %llds idle %llds active %llds, wakeups %lu", i == kAudioPowerPathInput ? "input" : "output",
+            power.time_us[kAudioPowerStateOff] / 1000000, power.time_us[kAudioPowerStateIdle] / 1000000,
+            power.time_us[kAudioPowerStateActive] / 1000000, power.wakeups);
     }
+
+    char buffer[128];
+    encode_time_.Format(buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "encode time: %s", buffer);
+    decode_time_.Format(buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "decode time: %s", buffer);
+    input_process_time_.Format(buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "input deinterleave + resample time: %s", buffer);
+    uplink_latency_.Format(buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "uplink latency (pcm -> send queue): %s", buffer);
+    downlink_latency_.Format(buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "downlink latency (decode -> speaker): %s", buffer);
 }
 
 void AudioService::SetModelsList(srmodel_list_t* models_list) {
@@ -674,6 +1039,17 @@ void AudioService::SetModelsList(srmodel_list_t* models_list) {
                 callbacks_.on_wake_word_detected(wake_word);
             }
         });
+#if CONFIG_SEND_WAKE_WORD_DATA
+        // The history is only sent with CONFIG_SEND_WAKE_WORD_DATA, otherwise nothing is encoded while idle
+        wake_word_->OnAudioData([this](const int16_t* data, size_t samples) {
+            StoreWakeWordAudio(data, samples);
+        });
+#endif
+        wake_word_->OnSpeechStarted([this]() {
+            if (callbacks_.on_wake_word_speech) {
+                callbacks_.on_wake_word_speech();
+            }
+        });
     }
 }
 
@@ -2,10 +2,10 @@
 #define AUDIO_SERVICE_H
 
 #include <memory>
-#include <deque>
-#include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -19,6 +19,15 @@
 
 #include "audio_codec.h"
 #include "audio_processor.h"
+#include "audio_ring.h"
+#include "audio_jitter_buffer.h"
+#include "opus_decoder_cache.h"
+#include "audio_mixer.h"
+#include "sound_cache.h"
+#include "uplink_controller.h"
+#include "uplink_dtx.h"
+#include "audio_power_manager.h"
+#include "audio_timing.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
@@ -27,24 +36,61 @@
 /*
  * There are two types of audio data flow:
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
- * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ * 2. (Server) -> {Decode Queue} -> [Jitter Buffer] -> [Opus Decoder] -> {Playback Queue} -> [Mixer] -> (Speaker)
+ *                                                                        (Music) -> [Mixer]
  *
  * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
+ * With CONFIG_USE_SPLIT_OPUS_CODEC_TASKS the encoder and decoder run in two tasks pinned to
+ * different cores, so in full-duplex mode neither waits behind the other.
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
- * 
+ *
+ * Every queue is a preallocated single-producer / single-consumer ring (AudioRing), sized by the
+ * limits below. The Opus codec task sleeps on its task notification and is woken whenever one of
+ * its input rings gets data or one of its output rings gets space.
+ *
+ * While the wake word engine listens, the audio it hears is also encoded into a rolling history
+ * of the last WAKE_WORD_HISTORY_MS, so the packets are ready as soon as the wake word is detected.
+ *
+ * With CONFIG_USE_UPLINK_DTX and DTX enabled for the session, frames the VAD marks as silence
+ * are held back instead of sent, see UplinkDtx.
+ *
+ * Packets with a sequence number (MQTT+UDP) are reordered by the jitter buffer, and frames
+ * that never arrive are replaced by Opus packet loss concealment.
+ *
+ * Decoders stay warm per (sample rate, frame duration), so notification sounds interleaved
+ * with server TTS do not recreate the decoder on every switch.
+ *
+ * Notification sounds skip the decode queue: PlaySound() queues the packet index of the Ogg file,
+ * and the decode task reads the packets straight from flash, or replays the cached PCM of a
+ * recently played sound. Sounds go ahead of the stream in the decode task.
+ *
+ * The audio output task is the only writer to the codec. It mixes background PCM streams such
+ * as music under the decoded voice, ducking them while voice plays.
  */
 
+// Longest frame, used for the downlink default, audio testing and buffer sizes
 #define OPUS_FRAME_DURATION_MS 60
+#define OPUS_MIN_FRAME_DURATION_MS 20
 #define MAX_ENCODE_TASKS_IN_QUEUE 2
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_MIN_FRAME_DURATION_MS)
+#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_MIN_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
+// Audio before the wake word, kept encoded while the wake word engine listens
+#define WAKE_WORD_HISTORY_MS 2000
+#define WAKE_WORD_FLUSH_TIMEOUT_MS 300
+// Objects preallocated at startup
+#define AUDIO_PACKET_POOL_SIZE 16
+// Packets the pool keeps after a burst allocated them: as many as the decode and send queues and
+// the wake word history hold, so a long TTS burst allocates each packet once and then reuses it
+#define AUDIO_PACKET_POOL_CAPACITY (MAX_DECODE_PACKETS_IN_QUEUE + MAX_SEND_PACKETS_IN_QUEUE + \
+    WAKE_WORD_HISTORY_MS / OPUS_MIN_FRAME_DURATION_MS)
+#define AUDIO_PACKET_RESERVE_BYTES 256
+#define AUDIO_TASK_POOL_SIZE (MAX_ENCODE_TASKS_IN_QUEUE + MAX_PLAYBACK_TASKS_IN_QUEUE + 2)
+#define AUDIO_TASK_RESERVE_SAMPLES (16000 * OPUS_FRAME_DURATION_MS / 1000)
 #define MAX_TIMESTAMPS_IN_QUEUE 3
-
-#define AUDIO_POWER_TIMEOUT_MS 15000
-#define AUDIO_POWER_CHECK_INTERVAL_MS 1000
+#define MAX_SOUNDS_IN_QUEUE 8
 
 
 #define AS_EVENT_AUDIO_TESTING_RUNNING      (1 << 0)
@@ -55,6 +101,7 @@
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
     std::function<void(const std::string&)> on_wake_word_detected;
+    std::function<void(void)> on_wake_word_speech;
     std::function<void(bool)> on_vad_change;
     std::function<void(void)> on_audio_testing_queue_full;
 };
@@ -63,6 +110,7 @@ struct AudioServiceCallbacks {
 enum AudioTaskType {
     kAudioTaskTypeEncodeToSendQueue,
     kAudioTaskTypeEncodeToTestingQueue,
+    kAudioTaskTypeEncodeToWakeWordHistory,
     kAudioTaskTypeDecodeToPlaybackQueue,
 };
 
@@ -70,6 +118,33 @@ struct AudioTask {
     AudioTaskType type;
     std::vector<int16_t> pcm;
     uint32_t timestamp;
+    int64_t enqueue_time_us = 0;
+    bool voice = false;     // VAD state when the frame was captured
+
+    void Reserve(size_t samples) { pcm.reserve(samples); }
+    bool Shrink(size_t samples) {
+        if (pcm.capacity() <= samples * AUDIO_POOL_SHRINK_FACTOR) {
+            return false;
+        }
+        std::vector<int16_t>().swap(pcm);
+        Reserve(samples);
+        return true;
+    }
+    void Recycle() {
+        timestamp = 0;
+        voice = false;
+        enqueue_time_us = 0;
+        pcm.clear();
+    }
+};
+
+using AudioTaskPool = AudioPool<AudioTask>;
+using AudioTaskPtr = AudioTaskPool::Ptr;
+
+struct SoundPlayback {
+    std::string_view ogg;
+    const SoundIndex* index = nullptr;
+    SoundPcmPtr pcm;    // Cached PCM, or nullptr to decode the packets
 };
 
 struct DebugStatistics {
@@ -88,7 +163,7 @@ public:
     void Start();
     void Stop();
     void EncodeWakeWord();
-    std::unique_ptr<AudioStreamPacket> PopWakeWordPacket();
+    AudioStreamPacketPtr PopWakeWordPacket();
     const std::string& GetLastWakeWord() const;
     bool IsVoiceDetected() const { return voice_detected_; }
     bool IsIdle();
@@ -104,11 +179,29 @@ public:
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
-    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
-    std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
+    bool PushPacketToDecodeQueue(AudioStreamPacketPtr packet, bool wait = false);
+    AudioStreamPacketPtr PopPacketFromSendQueue();
     void PlaySound(const std::string_view& sound);
+    // PCM at the codec output rate, blocks while the stream buffer is full
+    bool PushPcmToMixer(AudioMixerStream stream, const int16_t* data, size_t samples) { return mixer_.Write(stream, data, samples); }
+    // Called after the last PCM of a stream, so the stream draining is not counted as an underrun
+    void FinishMixerStream(AudioMixerStream stream) { mixer_.Finish(stream); }
+    void ClearMixerStream(AudioMixerStream stream) { mixer_.Clear(stream); }
+    void SetMixerGain(AudioMixerStream stream, int percent) { mixer_.SetGain(stream, percent); }
+    AudioMixerStatistics GetMixerStatistics(AudioMixerStream stream) { return mixer_.statistics(stream); }
+    int GetMixerBufferedMs(AudioMixerStream stream) { return mixer_.BufferedMs(stream); }
+    // Keeps background streams ducked without voice, e.g. while the device speaks
+    void SetMixerDucking(bool ducking) { mixer_.SetDucking(ducking); }
+    // Holds background streams, e.g. while the microphone listens without AEC
+    void PauseMixerBackground(bool paused) { mixer_.SetBackgroundPaused(paused); }
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+    // Negotiated uplink frame duration, the controller may use longer frames but never shorter
+    void SetUplinkFrameDuration(int frame_duration_ms);
+    // Silence suppression for the next listening session, needs CONFIG_USE_UPLINK_DTX
+    void EnableUplinkDtx(bool enable);
+    void ReportSendFailure() { send_failures_.fetch_add(1); }
+    void LogStatistics();
     void SetModelsList(srmodel_list_t* models_list);
 
 private:
@@ -117,12 +210,27 @@ private:
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    // One encoder per frame duration (20, 40, 60ms), created on first use and kept, so switching allocates nothing
+    std::unique_ptr<OpusEncoderWrapper> opus_encoders_[3];
+    OpusEncoderWrapper* opus_encoder_ = nullptr;
+    // Owned by the decode task, opus_decoder_ points at the entry of the last decoded packet.
+    // Sounds have their own decoder, so playing one never disturbs the state of the stream's.
+    OpusDecoderCache opus_decoder_cache_;
+    OpusDecoderCache::Entry* opus_decoder_ = nullptr;
+    OpusDecoderCache sound_decoder_cache_;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    std::vector<int16_t> output_resample_buffer_;
+    // Scratch buffers of ReadAudioData, only touched by the input task
+    std::vector<int16_t> input_buffer_;
+    std::vector<int16_t> input_channel_buffer_;
+    std::vector<int16_t> input_resample_buffer_;
     DebugStatistics debug_statistics_;
+    AudioTimingHistogram encode_time_;
+    AudioTimingHistogram decode_time_;
+    AudioTimingHistogram input_process_time_;
+    AudioTimingHistogram uplink_latency_;
+    AudioTimingHistogram downlink_latency_;
     srmodel_list_t* models_list_ = nullptr;
 
     EventGroupHandle_t event_group_;
@@ -130,16 +238,52 @@ private:
     // Audio encode / decode
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
-    TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    // Both handles point to the same task unless CONFIG_USE_SPLIT_OPUS_CODEC_TASKS is set
+    TaskHandle_t opus_encode_task_handle_ = nullptr;
+    TaskHandle_t opus_decode_task_handle_ = nullptr;
+    AudioRing<AudioStreamPacketPtr> audio_decode_queue_;
+    AudioRing<AudioStreamPacketPtr> audio_send_queue_;
+    AudioRing<AudioStreamPacketPtr> audio_testing_queue_;
+    // Owned by the decode task, ResetDecoder() only raises the flag for it and the decoders
+    AudioJitterBuffer jitter_buffer_;
+    std::atomic<bool> decoder_reset_ = false;
+    // Owned by the encode task, SetUplinkFrameDuration() only raises the flag
+    UplinkController uplink_controller_;
+    std::atomic<bool> uplink_controller_reset_ = false;
+    std::atomic<int> negotiated_frame_duration_ = OPUS_FRAME_DURATION_MS;
+    std::atomic<int> uplink_frame_duration_ = OPUS_FRAME_DURATION_MS;
+    std::atomic<uint32_t> send_failures_ = 0;
+    // Owned by the encode task, EnableUplinkDtx() only raises the flag
+    UplinkDtx uplink_dtx_;
+    bool uplink_dtx_enabled_ = false;
+    std::atomic<bool> uplink_dtx_requested_ = false;
+    std::atomic<bool> uplink_dtx_reset_ = false;
+    int encode_frame_duration_ = OPUS_FRAME_DURATION_MS;
+    AudioRing<AudioTaskPtr> audio_encode_queue_;
+    AudioRing<AudioTaskPtr> audio_playback_queue_;
+    AudioMixer mixer_;
+    // Notification sounds, current_sound_ and the capture are owned by the decode task
+    SoundCache sound_cache_;
+    AudioRing<SoundPlayback> audio_sound_queue_;
+    SoundPlayback current_sound_;
+    size_t sound_position_ = 0;     // Next packet, or next sample of the cached PCM
+    SoundPcmPtr sound_capture_;
+    std::vector<uint8_t> sound_payload_;
+    std::atomic<bool> sound_playing_ = false;
+    // The network task and the testing playback feed the decode ring, PlaySound feeds the sound ring
+    std::mutex decode_producer_mutex_;
+    // The processor, the wake word engine and audio testing all feed the encode ring
+    std::mutex encode_producer_mutex_;
+    // Wake word history, the ring is shared by the encode task and PopWakeWordPacket() under the mutex
+    std::vector<int16_t> wake_word_pcm_;
+    AudioRing<AudioStreamPacketPtr> wake_word_history_;
+    std::mutex wake_word_history_mutex_;
+    std::condition_variable wake_word_history_cv_;
+    int wake_word_frames_in_flight_ = 0;
+    std::atomic<bool> wake_word_history_enabled_ = false;
+    std::atomic<bool> wake_word_pcm_reset_ = false;
     // For server AEC
-    std::deque<uint32_t> timestamp_queue_;
+    LatestQueue<uint32_t, MAX_TIMESTAMPS_IN_QUEUE> timestamp_queue_;
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
@@ -147,16 +291,28 @@ private:
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
 
-    esp_timer_handle_t audio_power_timer_ = nullptr;
-    std::chrono::steady_clock::time_point last_input_time_;
-    std::chrono::steady_clock::time_point last_output_time_;
+    AudioPowerManager power_manager_;
 
     void AudioInputTask();
     void AudioOutputTask();
     void OpusCodecTask();
+    void OpusEncodeTask();
+    void OpusDecodeTask();
+    bool EncodeNextTask();
+    bool DecodeNextPacket();
+    bool DecodeNextSound();
+    void ResampleDecodedPcm(OpusDecoderCache::Entry& decoder, std::vector<int16_t>& pcm);
+    TickType_t DecodeWaitTicks() const;
     void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
-    void SetDecodeSampleRate(int sample_rate, int frame_duration);
-    void CheckAndUpdateAudioPowerState();
+    bool PushEncodeTask(AudioTaskPtr task);
+    void StoreWakeWordAudio(const int16_t* data, size_t samples);
+    void PushWakeWordHistory(AudioStreamPacketPtr packet);
+    void SetEncodeFrameDuration(int frame_duration);
+    void ApplyUplinkFrameDuration(int frame_duration);
+    void ApplyUplinkDtx();
+    void NotifyEncodeTask();
+    void NotifyDecodeTask();
+    void NotifyOutputTask();
 };
 
 #endif
\ No newline at end of file
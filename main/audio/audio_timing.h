@@ -0,0 +1,84 @@
+#ifndef AUDIO_TIMING_H
+#define AUDIO_TIMING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+
+/*
+ * Lock-free latency histogram with power-of-two millisecond buckets:
+ * <1, <2, <4, <8, <16, <32, <64, <128, >=128 ms
+ */
+class AudioTimingHistogram {
+public:
+    static constexpr int kBucketCount = 9;
+
+    void Record(int64_t duration_us) {
+        int bucket = 0;
+        int64_t limit_us = 1000;
+        while (bucket < kBucketCount - 1 && duration_us >= limit_us) {
+            limit_us <<= 1;
+            bucket++;
+        }
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        total_us_.fetch_add(duration_us, std::memory_order_relaxed);
+
+        int64_t max_us = max_us_.load(std::memory_order_relaxed);
+        while (duration_us > max_us && !max_us_.compare_exchange_weak(max_us, duration_us, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint32_t count() const { return count_.load(std::memory_order_relaxed); }
+    int64_t average_us() const {
+        uint32_t count = count_.load(std::memory_order_relaxed);
+        return count > 0 ? total_us_.load(std::memory_order_relaxed) / count : 0;
+    }
+    int64_t max_us() const { return max_us_.load(std::memory_order_relaxed); }
+
+    // Formats as "n=120 avg=3.2ms max=9.1ms [0 4 100 16 0 0 0 0 0]"
+    int Format(char* buffer, size_t size) const {
+        int64_t average = average_us();
+        int64_t max = max_us();
+        int length = snprintf(buffer, size, "n=%lu avg=%d.%dms max=%d.%dms [",
+            (unsigned long)count(), (int)(average / 1000), (int)(average % 1000 / 100),
+            (int)(max / 1000), (int)(max % 1000 / 100));
+        for (int i = 0; i < kBucketCount && length > 0 && (size_t)length < size; i++) {
+            length += snprintf(buffer + length, size - length, i == 0 ? "%lu" : " %lu",
+                (unsigned long)buckets_[i].load(std::memory_order_relaxed));
+        }
+        if (length > 0 && (size_t)length < size) {
+            length += snprintf(buffer + length, size - length, "]");
+        }
+        return length;
+    }
+
+    // Moves the samples into snapshot, an empty histogram, and starts over. Unlike Format()
+    // followed by Reset(), no sample recorded meanwhile by another task is lost or counted twice.
+    void MoveTo(AudioTimingHistogram& snapshot) {
+        for (int i = 0; i < kBucketCount; i++) {
+            snapshot.buckets_[i].store(buckets_[i].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        snapshot.count_.store(count_.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        snapshot.total_us_.store(total_us_.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        snapshot.max_us_.store(max_us_.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    void Reset() {
+        for (auto& bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        total_us_.store(0, std::memory_order_relaxed);
+        max_us_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint32_t> buckets_[kBucketCount] = {};
+    std::atomic<uint32_t> count_ = 0;
+    std::atomic<int64_t> total_us_ = 0;
+    std::atomic<int64_t> max_us_ = 0;
+};
+
+#endif // AUDIO_TIMING_H
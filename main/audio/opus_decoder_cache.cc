@@ -0,0 +1,74 @@
+#include "opus_decoder_cache.h"
+
+#include <esp_log.h>
+
+#define TAG "OpusDecoderCache"
+
+
+void OpusDecoderCache::Initialize(int output_sample_rate, size_t capacity) {
+    output_sample_rate_ = output_sample_rate;
+    capacity_ = capacity;
+    entries_.clear();
+    entries_.reserve(capacity_);
+    current_ = nullptr;
+}
+
+bool OpusDecoderCache::Matches(const Entry& entry, int sample_rate, int frame_duration) {
+    return entry.decoder->sample_rate() == sample_rate && entry.decoder->duration_ms() == frame_duration;
+}
+
+OpusDecoderCache::Entry& OpusDecoderCache::Get(int sample_rate, int frame_duration) {
+    clock_++;
+    if (current_ != nullptr && Matches(*current_, sample_rate, frame_duration)) {
+        current_->last_used = clock_;
+        statistics_.hits++;
+        return *current_;
+    }
+
+    Entry* oldest = nullptr;
+    for (auto& entry : entries_) {
+        if (Matches(*entry, sample_rate, frame_duration)) {
+            entry->last_used = clock_;
+            statistics_.hits++;
+            current_ = entry.get();
+            return *current_;
+        }
+        if (oldest == nullptr || entry->last_used < oldest->last_used) {
+            oldest = entry.get();
+        }
+    }
+
+    statistics_.misses++;
+    if (entries_.size() < capacity_) {
+        entries_.push_back(std::make_unique<Entry>());
+        current_ = entries_.back().get();
+    } else {
+        ESP_LOGI(TAG, "Evicting decoder %dHz %dms", oldest->decoder->sample_rate(), oldest->decoder->duration_ms());
+        statistics_.evictions++;
+        current_ = oldest;
+    }
+    Configure(*current_, sample_rate, frame_duration);
+    current_->last_used = clock_;
+    return *current_;
+}
+
+void OpusDecoderCache::Configure(Entry& entry, int sample_rate, int frame_duration) {
+    ESP_LOGI(TAG, "Creating decoder %dHz %dms", sample_rate, frame_duration);
+    entry.decoder.reset();
+    entry.decoder = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    entry.resample = sample_rate != output_sample_rate_;
+    if (entry.resample) {
+        ESP_LOGI(TAG, "Resampling audio from %d to %d", sample_rate, output_sample_rate_);
+        entry.resampler.Configure(sample_rate, output_sample_rate_);
+    }
+}
+
+void OpusDecoderCache::ResetState() {
+    for (auto& entry : entries_) {
+        entry->decoder->ResetState();
+        if (entry->resample) {
+            // Configuring again clears the resampler history, it does not allocate
+            entry->resampler.Configure(entry->decoder->sample_rate(), output_sample_rate_);
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef OPUS_DECODER_CACHE_H
+#define OPUS_DECODER_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <opus_decoder.h>
+#include <opus_resampler.h>
+
+// Each warm decoder costs about 20KB, two cover a change of the server's rate or frame duration
+#define OPUS_DECODER_CACHE_SIZE 2
+
+
+struct OpusDecoderCacheStatistics {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t evictions = 0;
+};
+
+/*
+ * Keeps decoders, each with the resampler to the codec output rate, for the last few
+ * (sample rate, frame duration) pairs, so switching between sources neither allocates nor
+ * loses decoder state. The least recently used entry is replaced when a new pair shows up.
+ *
+ * Only used by the decode task.
+ */
+class OpusDecoderCache {
+public:
+    struct Entry {
+        std::unique_ptr<OpusDecoderWrapper> decoder;
+        OpusResampler resampler;
+        bool resample = false;
+        uint32_t last_used = 0;
+    };
+
+    void Initialize(int output_sample_rate, size_t capacity = OPUS_DECODER_CACHE_SIZE);
+    Entry& Get(int sample_rate, int frame_duration);
+    // Starts every stream from scratch, e.g. after the playback was interrupted
+    void ResetState();
+
+    const OpusDecoderCacheStatistics& statistics() const { return statistics_; }
+
+private:
+    int output_sample_rate_ = 16000;
+    size_t capacity_ = OPUS_DECODER_CACHE_SIZE;
+    std::vector<std::unique_ptr<Entry>> entries_;
+    Entry* current_ = nullptr;
+    uint32_t clock_ = 0;
+    OpusDecoderCacheStatistics statistics_;
+
+    static bool Matches(const Entry& entry, int sample_rate, int frame_duration);
+    void Configure(Entry& entry, int sample_rate, int frame_duration);
+};
+
+#endif // OPUS_DECODER_CACHE_H
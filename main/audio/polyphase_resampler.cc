@@ -0,0 +1,147 @@
+#include "polyphase_resampler.h"
+
+#include <esp_log.h>
+#include <cmath>
+#include <numeric>
+
+#define TAG "PolyphaseResampler"
+
+
+struct ResamplerQualityConfig {
+    int taps;
+    double cutoff;          // Passband edge relative to the lower Nyquist frequency
+    double kaiser_beta;
+};
+
+static const ResamplerQualityConfig kQualityConfigs[] = {
+    { 8, 0.80, 5.0 },
+    { 16, 0.88, 7.0 },
+    { 32, 0.94, 9.0 },
+};
+
+// Zeroth order modified Bessel function, for the Kaiser window
+static double BesselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+bool PolyphaseResampler::Configure(int input_sample_rate, int output_sample_rate, ResamplerQuality quality) {
+    if (input_sample_rate <= 0 || output_sample_rate <= 0) {
+        ESP_LOGE(TAG, "Invalid sample rates: %d -> %d", input_sample_rate, output_sample_rate);
+        return false;
+    }
+    if (input_sample_rate == input_sample_rate_ && output_sample_rate == output_sample_rate_ && quality == quality_ && taps_ > 0) {
+        return true;
+    }
+
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    quality_ = quality;
+    // The filter spans a fixed number of samples at the lower rate, so downsampling needs more input taps
+    taps_ = kQualityConfigs[quality].taps;
+    if (input_sample_rate > output_sample_rate) {
+        taps_ = ((int64_t)taps_ * input_sample_rate / output_sample_rate + 1) & ~1;
+    }
+    int divisor = std::gcd(input_sample_rate, output_sample_rate);
+    interpolation_ = output_sample_rate / divisor;
+    step_ = input_sample_rate / divisor;
+    phases_ = interpolation_ < RESAMPLER_MAX_PHASES ? interpolation_ : RESAMPLER_MAX_PHASES;
+    BuildFilterBank();
+    Reset();
+
+    ESP_LOGI(TAG, "Resampling %d -> %d Hz, %d taps, %d phases", input_sample_rate, output_sample_rate, taps_, phases_);
+    return true;
+}
+
+void PolyphaseResampler::BuildFilterBank() {
+    auto& config = kQualityConfigs[quality_];
+    double cutoff = config.cutoff;
+    if (output_sample_rate_ < input_sample_rate_) {
+        cutoff = cutoff * output_sample_rate_ / input_sample_rate_;
+    }
+    double half = taps_ / 2.0;
+    double window_scale = 1.0 / BesselI0(config.kaiser_beta);
+
+    coefficients_.resize(phases_ * taps_);
+    std::vector<double> filter(taps_);
+    for (int phase = 0; phase < phases_; phase++) {
+        // Tap j weighs the input sample (j - taps / 2 + 1) away from the output position
+        double offset = (double)phase / phases_;
+        double sum = 0;
+        for (int j = 0; j < taps_; j++) {
+            double t = j - (half - 1) - offset;
+            double x = M_PI * cutoff * t;
+            double sinc = (x == 0) ? 1.0 : sin(x) / x;
+            double r = t / half;
+            double window = (r <= -1.0 || r >= 1.0) ? 0.0 : BesselI0(config.kaiser_beta * sqrt(1.0 - r * r)) * window_scale;
+            filter[j] = sinc * window;
+            sum += filter[j];
+        }
+
+        // Unity DC gain per phase, the rounding error goes to the largest tap
+        int16_t* coefficients = &coefficients_[phase * taps_];
+        int total = 0;
+        int largest = 0;
+        for (int j = 0; j < taps_; j++) {
+            coefficients[j] = (int16_t)lround(filter[j] / sum * 32768.0);
+            total += coefficients[j];
+            if (abs(coefficients[j]) > abs(coefficients[largest])) {
+                largest = j;
+            }
+        }
+        coefficients[largest] += 32768 - total;
+    }
+}
+
+void PolyphaseResampler::Reset() {
+    if (taps_ == 0) {
+        return;
+    }
+    history_.assign(taps_ / 2 - 1, 0);
+    position_ = taps_ / 2 - 1;
+    fraction_ = 0;
+}
+
+size_t PolyphaseResampler::Process(const int16_t* input, size_t samples, std::vector<int16_t>& output) {
+    if (taps_ == 0) {
+        return 0;
+    }
+    history_.insert(history_.end(), input, input + samples);
+
+    size_t start = output.size();
+    output.reserve(start + (uint64_t)samples * interpolation_ / step_ + 2);
+    const size_t lookahead = taps_ / 2;
+    while (position_ + lookahead < history_.size()) {
+        const int16_t* x = &history_[position_ - (lookahead - 1)];
+        // Truncates to the phase at or below the exact position when phases_ < interpolation_
+        const int16_t* h = &coefficients_[(uint64_t)fraction_ * phases_ / interpolation_ * taps_];
+        // 64-bit accumulator: with a low cutoff the sum of absolute taps can exceed 2.0
+        int64_t accumulator = 0;
+        for (int j = 0; j < taps_; j++) {
+            accumulator += (int32_t)x[j] * h[j];
+        }
+        int32_t value = (int32_t)((accumulator + (1 << 14)) >> 15);
+        output.push_back(value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : (int16_t)value);
+
+        fraction_ += step_;
+        position_ += fraction_ / interpolation_;
+        fraction_ %= interpolation_;
+    }
+
+    // Drop the input that no future output sample can reach
+    size_t consumed = position_ - (lookahead - 1);
+    if (consumed > history_.size()) {
+        consumed = history_.size();
+    }
+    history_.erase(history_.begin(), history_.begin() + consumed);
+    position_ -= consumed;
+    return output.size() - start;
+}
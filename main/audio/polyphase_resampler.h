@@ -0,0 +1,59 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Ratios with more phases than this (e.g. 11025 -> 16000 needs 640) use the phase at or below the exact one
+#define RESAMPLER_MAX_PHASES 256
+
+
+// Taps per phase when upsampling, downsampling scales them by the rate ratio
+enum ResamplerQuality {
+    kResamplerQualityLow,       // 8 taps
+    kResamplerQualityMedium,    // 16 taps
+    kResamplerQualityHigh,      // 32 taps
+};
+
+/*
+ * Streaming windowed-sinc resampler for mono 16-bit PCM with arbitrary rational ratios.
+ *
+ * The filter bank holds one Q15 filter per output phase, so each output sample costs
+ * taps multiply-adds and no trigonometry. The cutoff follows the lower of both rates,
+ * which makes it an anti-aliasing filter when downsampling.
+ * Input may arrive in blocks of any size; the last taps of each block are kept as
+ * history so the output is continuous across calls.
+ */
+class PolyphaseResampler {
+public:
+    // Rebuilds the filter bank only when something changed, returns false for invalid rates
+    bool Configure(int input_sample_rate, int output_sample_rate, ResamplerQuality quality);
+    void Reset();
+
+    // Appends the resampled block to output, returns the number of samples added
+    size_t Process(const int16_t* input, size_t samples, std::vector<int16_t>& output);
+
+    int input_sample_rate() const { return input_sample_rate_; }
+    int output_sample_rate() const { return output_sample_rate_; }
+    int taps() const { return taps_; }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    ResamplerQuality quality_ = kResamplerQualityMedium;
+    int taps_ = 0;
+    // The output clock advances step_ per sample on a grid of interpolation_ steps per input sample
+    uint32_t interpolation_ = 1;
+    uint32_t step_ = 1;
+    int phases_ = 1;
+    std::vector<int16_t> coefficients_;     // phases_ x taps_
+
+    std::vector<int16_t> history_;          // Unconsumed input, starting taps_ / 2 - 1 samples before position_
+    size_t position_ = 0;
+    uint32_t fraction_ = 0;
+
+    void BuildFilterBank();
+};
+
+#endif // POLYPHASE_RESAMPLER_H
@@ -81,6 +81,11 @@ AfeAudioProcessor::~AfeAudioProcessor() {
     vEventGroupDelete(event_group_);
 }
 
+void AfeAudioProcessor::SetOutputFrameDuration(int frame_duration_ms) {
+    // The processor task picks it up at the next fetched chunk, a partial frame already buffered is kept
+    frame_samples_.store(frame_duration_ms * 16000 / 1000, std::memory_order_relaxed);
+}
+
 size_t AfeAudioProcessor::GetFeedSize() {
     if (afe_data_ == nullptr) {
         return 0;
@@ -151,21 +156,23 @@ void AfeAudioProcessor::AudioProcessorTask() {
 
         if (output_callback_) {
             size_t samples = res->data_size / sizeof(int16_t);
-            
+            // One frame size for the whole chunk, even if it changes meanwhile
+            size_t frame_samples = frame_samples_.load(std::memory_order_relaxed);
+
             // Add data to buffer
             output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
             
             // Output complete frames when buffer has enough data
-            while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
+            while (output_buffer_.size() >= frame_samples) {
+                if (output_buffer_.size() == frame_samples) {
                     // If buffer size equals frame size, move the entire buffer
                     output_callback_(std::move(output_buffer_));
                     output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
+                    output_buffer_.reserve(frame_samples);
                 } else {
                     // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
+                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples));
+                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples);
                 }
             }
         }
@@ -0,0 +1,81 @@
+#include "sample_conversion.h"
+
+#include <algorithm>
+
+
+// min/max rather than branches: loud audio clamps often and the branches mispredict, while
+// the Xtensa cores have MIN and MAX instructions and compilers vectorize this form
+static inline int16_t ClampInt16(int32_t value) {
+    return (int16_t)std::min<int32_t>(std::max<int32_t>(value, -INT16_MAX), INT16_MAX);
+}
+
+int32_t SampleConversion::VolumeFactor(int volume) {
+    if (volume <= 0) {
+        return 0;
+    }
+    return (int64_t)volume * volume * SAMPLE_UNITY_FACTOR / 10000;
+}
+
+void SampleConversion::Int16ToInt32(const int16_t* src, int32_t* dest, size_t samples, int32_t factor) {
+    if (factor >= 0 && factor <= SAMPLE_UNITY_FACTOR) {
+        // INT16_MIN * 65536 is exactly INT32_MIN, so a 32-bit multiply cannot overflow here
+        for (size_t i = 0; i < samples; i++) {
+            dest[i] = (int32_t)src[i] * factor;
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < samples; i++) {
+        int64_t value = (int64_t)src[i] * factor;
+        dest[i] = (value > INT32_MAX) ? INT32_MAX : (value < INT32_MIN) ? INT32_MIN : (int32_t)value;
+    }
+}
+
+void SampleConversion::Int32ToInt16(const int32_t* src, int16_t* dest, size_t samples, int shift) {
+    for (size_t i = 0; i < samples; i++) {
+        dest[i] = ClampInt16(src[i] >> shift);
+    }
+}
+
+void SampleConversion::ApplyGain(int16_t* data, size_t samples, int gain) {
+    if (gain == 1) {
+        return;
+    }
+    for (size_t i = 0; i < samples; i++) {
+        data[i] = ClampInt16((int32_t)data[i] * gain);
+    }
+}
+
+void SampleConversion::Deinterleave(const int16_t* src, int16_t* left, int16_t* right, size_t frames) {
+    for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+        left[i] = src[j];
+        right[i] = src[j + 1];
+    }
+}
+
+void SampleConversion::Interleave(const int16_t* left, const int16_t* right, int16_t* dest, size_t frames) {
+    for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+        dest[j] = left[i];
+        dest[j + 1] = right[i];
+    }
+}
+
+void SampleConversion::ExtractChannel(const int16_t* src, int16_t* dest, size_t frames, int channels, int channel) {
+    src += channel;
+    for (size_t i = 0; i < frames; ++i, src += channels) {
+        dest[i] = *src;
+    }
+}
+
+void SampleConversion::StereoToMono(const int16_t* src, int16_t* dest, size_t frames) {
+    for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+        dest[i] = ((int32_t)src[j] + src[j + 1]) >> 1;
+    }
+}
+
+void SampleConversion::MonoToStereo(const int16_t* src, int16_t* dest, size_t frames) {
+    for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+        dest[j] = src[i];
+        dest[j + 1] = src[i];
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef SAMPLE_CONVERSION_H
+#define SAMPLE_CONVERSION_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Unity gain for VolumeFactor() and the Scale functions, Q16
+#define SAMPLE_UNITY_FACTOR 65536
+
+/*
+ * Sample format conversion shared by the codecs and the audio service.
+ *
+ * All functions work on caller provided buffers and never allocate. Clamping is symmetric
+ * (-INT16_MAX..INT16_MAX) like the original codec loops, so the results are bit exact with them,
+ * except that ApplyGain() at unity gain returns early and leaves INT16_MIN as it is.
+ * Destination and source may be the same buffer wherever the output is not longer than the input.
+ * tests/host/sample_conversion_test.cc checks every function against the original loops.
+ *
+ * The esp-dsp kernels are not used: dsps_mulc_s16 only takes Q15 factors below one and rounds
+ * and saturates differently, the interleaved and strided cases fall back to its generic C
+ * code, and it has no 16/32-bit conversion, so none of them is both bit exact and faster here.
+ * SampleConversionBenchmark times the kernels, on the target in CPU cycles.
+ */
+class SampleConversion {
+public:
+    // Maps a 0-100 volume to a Q16 factor on a square curve, same as pow(volume / 100, 2) * 65536
+    static int32_t VolumeFactor(int volume);
+
+    // 16-bit samples to left aligned 32-bit I2S samples, multiplied by a Q16 factor
+    static void Int16ToInt32(const int16_t* src, int32_t* dest, size_t samples, int32_t factor);
+    // 32-bit I2S samples to 16-bit, arithmetic shift right then clamp
+    static void Int32ToInt16(const int32_t* src, int16_t* dest, size_t samples, int shift);
+    // Integer gain with clamping, in place; a gain of 1 leaves the samples untouched
+    static void ApplyGain(int16_t* data, size_t samples, int gain);
+
+    // Interleaved stereo to two planar channels and back
+    static void Deinterleave(const int16_t* src, int16_t* left, int16_t* right, size_t frames);
+    static void Interleave(const int16_t* left, const int16_t* right, int16_t* dest, size_t frames);
+    // Picks one channel out of interleaved audio, dest may be src
+    static void ExtractChannel(const int16_t* src, int16_t* dest, size_t frames, int channels, int channel);
+    // Averages both channels, dest may be src
+    static void StereoToMono(const int16_t* src, int16_t* dest, size_t frames);
+    // Duplicates every sample, dest must hold frames * 2 samples and must not overlap src
+    static void MonoToStereo(const int16_t* src, int16_t* dest, size_t frames);
+};
+
+#endif // SAMPLE_CONVERSION_H
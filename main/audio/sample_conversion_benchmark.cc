@@ -0,0 +1,62 @@
+#include "sample_conversion_benchmark.h"
+#include "sample_conversion.h"
+
+#include <vector>
+
+
+size_t SampleConversionBenchmark::Run(Counter counter, SampleConversionTiming* timings, size_t max_timings) {
+    const size_t samples = SAMPLE_CONVERSION_BENCHMARK_SAMPLES;
+    const size_t frames = samples / 2;
+    std::vector<int16_t> pcm(samples), left(frames), right(frames), output(samples);
+    std::vector<int32_t> pcm32(samples);
+
+    // Full scale noise, so the clamping branches are taken as often as in loud audio
+    uint32_t seed = 12345;
+    for (auto& sample : pcm) {
+        seed = seed * 1664525 + 1013904223;
+        sample = (int16_t)(seed >> 16);
+    }
+    for (size_t i = 0; i < samples; i++) {
+        pcm32[i] = (int32_t)pcm[i] << 15;
+    }
+
+    size_t count = 0;
+    auto add = [&](const char* name, uint32_t ticks) {
+        if (count < max_timings) {
+            timings[count++] = { name, ticks };
+        }
+    };
+    add("Int16ToInt32 unity", Measure(counter, [&]() {
+        SampleConversion::Int16ToInt32(pcm.data(), pcm32.data(), samples, SAMPLE_UNITY_FACTOR);
+    }));
+    add("Int16ToInt32 half", Measure(counter, [&]() {
+        SampleConversion::Int16ToInt32(pcm.data(), pcm32.data(), samples, SAMPLE_UNITY_FACTOR / 2);
+    }));
+    add("Int16ToInt32 boost", Measure(counter, [&]() {
+        SampleConversion::Int16ToInt32(pcm.data(), pcm32.data(), samples, SAMPLE_UNITY_FACTOR * 2);
+    }));
+    add("Int32ToInt16", Measure(counter, [&]() {
+        SampleConversion::Int32ToInt16(pcm32.data(), output.data(), samples, 14);
+    }));
+    // In place, so this includes copying the input back
+    add("ApplyGain", Measure(counter, [&]() {
+        output = pcm;
+        SampleConversion::ApplyGain(output.data(), samples, 4);
+    }));
+    add("Deinterleave", Measure(counter, [&]() {
+        SampleConversion::Deinterleave(pcm.data(), left.data(), right.data(), frames);
+    }));
+    add("Interleave", Measure(counter, [&]() {
+        SampleConversion::Interleave(left.data(), right.data(), output.data(), frames);
+    }));
+    add("ExtractChannel", Measure(counter, [&]() {
+        SampleConversion::ExtractChannel(pcm.data(), output.data(), frames, 2, 0);
+    }));
+    add("StereoToMono", Measure(counter, [&]() {
+        SampleConversion::StereoToMono(pcm.data(), output.data(), frames);
+    }));
+    add("MonoToStereo", Measure(counter, [&]() {
+        SampleConversion::MonoToStereo(left.data(), output.data(), frames);
+    }));
+    return count;
+}
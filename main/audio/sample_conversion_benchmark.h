@@ -0,0 +1,47 @@
+#ifndef SAMPLE_CONVERSION_BENCHMARK_H
+#define SAMPLE_CONVERSION_BENCHMARK_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Samples per call, one 60 ms frame of 16 kHz stereo
+#define SAMPLE_CONVERSION_BENCHMARK_SAMPLES 1920
+#define SAMPLE_CONVERSION_BENCHMARK_ROUNDS 16
+#define SAMPLE_CONVERSION_BENCHMARK_KERNELS 10
+
+struct SampleConversionTiming {
+    const char* name;
+    uint32_t ticks;     // Fastest round, in the unit of the counter
+};
+
+/*
+ * Times the SampleConversion kernels, the baseline any target specific version has to beat.
+ *
+ * The counter is the CPU cycle counter on the target, logged at startup when
+ * CONFIG_USE_SAMPLE_CONVERSION_BENCHMARK is set, and a nanosecond clock in
+ * tests/host/sample_conversion_benchmark.cc, which also times the original codec loops.
+ */
+class SampleConversionBenchmark {
+public:
+    using Counter = uint32_t (*)();
+
+    // Fills up to max_timings results and returns how many
+    static size_t Run(Counter counter, SampleConversionTiming* timings, size_t max_timings);
+
+    // The fastest of the rounds, so interrupts and cache misses of a single round do not count
+    template <typename Function>
+    static uint32_t Measure(Counter counter, Function function) {
+        uint32_t best = UINT32_MAX;
+        for (int round = 0; round < SAMPLE_CONVERSION_BENCHMARK_ROUNDS; round++) {
+            uint32_t start = counter();
+            function();
+            uint32_t ticks = counter() - start;
+            if (ticks < best) {
+                best = ticks;
+            }
+        }
+        return best;
+    }
+};
+
+#endif // SAMPLE_CONVERSION_BENCHMARK_H
@@ -0,0 +1,177 @@
+#include "sound_cache.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "SoundCache"
+
+#ifndef CONFIG_SOUND_PCM_CACHE_SIZE_KB
+#define CONFIG_SOUND_PCM_CACHE_SIZE_KB 0
+#endif
+
+
+SoundPcm::~SoundPcm() {
+    if (data != nullptr) {
+        heap_caps_free(data);
+    }
+}
+
+const SoundIndex* SoundCache::GetIndex(const std::string_view& ogg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Key key(ogg.data(), ogg.size());
+    auto it = indexes_.find(key);
+    if (it == indexes_.end()) {
+        it = indexes_.emplace(key, SoundIndex()).first;
+        BuildIndex(ogg, it->second);
+        statistics_.indexed++;
+    }
+    // Entries are never removed, so the pointer stays valid
+    return &it->second;
+}
+
+void SoundCache::BuildIndex(const std::string_view& ogg, SoundIndex& index) {
+    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
+    size_t size = ogg.size();
+    size_t offset = 0;
+
+    auto find_page = [&](size_t start)->size_t {
+        for (size_t i = start; i + 4 <= size; ++i) {
+            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
+        }
+        return static_cast<size_t>(-1);
+    };
+
+    bool seen_head = false;
+    bool seen_tags = false;
+
+    while (true) {
+        size_t pos = find_page(offset);
+        if (pos == static_cast<size_t>(-1)) break;
+        offset = pos;
+        if (offset + 27 > size) break;
+
+        const uint8_t* page = buf + offset;
+        uint8_t page_segments = page[26];
+        size_t seg_table_off = offset + 27;
+        if (seg_table_off + page_segments > size) break;
+
+        size_t body_size = 0;
+        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
+
+        size_t body_off = seg_table_off + page_segments;
+        if (body_off + body_size > size) break;
+
+        // Parse packets using lacing
+        size_t cur = body_off;
+        size_t seg_idx = 0;
+        while (seg_idx < page_segments) {
+            size_t pkt_len = 0;
+            size_t pkt_start = cur;
+            bool continued = false;
+            do {
+                uint8_t l = page[27 + seg_idx++];
+                pkt_len += l;
+                cur += l;
+                continued = (l == 255);
+            } while (continued && seg_idx < page_segments);
+
+            if (pkt_len == 0) continue;
+            const uint8_t* pkt_ptr = buf + pkt_start;
+
+            if (!seen_head) {
+                // OpusHead: [0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip,
+                // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
+                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
+                    seen_head = true;
+                    index.sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
+                }
+                continue;
+            }
+            if (!seen_tags) {
+                // Expect OpusTags in second packet
+                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
+                    seen_tags = true;
+                }
+                continue;
+            }
+
+            index.packets.push_back({ (uint32_t)pkt_start, (uint32_t)pkt_len });
+        }
+
+        offset = body_off + body_size;
+    }
+    index.packets.shrink_to_fit();
+    ESP_LOGI(TAG, "Indexed sound %p: %d packets, %d Hz", ogg.data(), (int)index.packets.size(), index.sample_rate);
+}
+
+SoundPcmPtr SoundCache::GetPcm(const std::string_view& ogg) {
+    if (CONFIG_SOUND_PCM_CACHE_SIZE_KB == 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    Key key(ogg.data(), ogg.size());
+    for (auto& entry : pcm_entries_) {
+        if (entry.key == key) {
+            entry.last_used = ++clock_;
+            statistics_.pcm_hits++;
+            return entry.pcm;
+        }
+    }
+    statistics_.pcm_misses++;
+    return nullptr;
+}
+
+SoundPcmPtr SoundCache::CreatePcm(size_t max_samples) {
+    size_t bytes = max_samples * sizeof(int16_t);
+    if (bytes == 0 || bytes > CONFIG_SOUND_PCM_CACHE_SIZE_KB * 1024) {
+        return nullptr;
+    }
+    auto pcm = std::make_shared<SoundPcm>();
+    pcm->data = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+    if (pcm->data == nullptr) {
+        return nullptr;
+    }
+    pcm->capacity = max_samples;
+    return pcm;
+}
+
+void SoundCache::StorePcm(const std::string_view& ogg, SoundPcmPtr pcm) {
+    // Give back the unused tail of the estimate
+    size_t bytes = pcm->samples * sizeof(int16_t);
+    if (pcm->samples == 0) {
+        return;
+    }
+    auto data = (int16_t*)heap_caps_realloc(pcm->data, bytes, MALLOC_CAP_SPIRAM);
+    if (data != nullptr) {
+        pcm->data = data;
+        pcm->capacity = pcm->samples;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Key key(ogg.data(), ogg.size());
+    for (auto& entry : pcm_entries_) {
+        if (entry.key == key) {
+            return;
+        }
+    }
+    while (!pcm_entries_.empty() && statistics_.pcm_bytes + bytes > CONFIG_SOUND_PCM_CACHE_SIZE_KB * 1024) {
+        auto oldest = pcm_entries_.begin();
+        for (auto it = pcm_entries_.begin(); it != pcm_entries_.end(); ++it) {
+            if (it->last_used < oldest->last_used) {
+                oldest = it;
+            }
+        }
+        // A sound still playing keeps its buffer through the shared pointer
+        statistics_.pcm_bytes -= oldest->pcm->samples * sizeof(int16_t);
+        statistics_.pcm_evictions++;
+        pcm_entries_.erase(oldest);
+    }
+    pcm_entries_.push_back({ key, pcm, ++clock_ });
+    statistics_.pcm_bytes += bytes;
+}
+
+SoundCacheStatistics SoundCache::statistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
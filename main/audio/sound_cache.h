@@ -0,0 +1,80 @@
+#ifndef SOUND_CACHE_H
+#define SOUND_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+struct SoundPacket {
+    uint32_t offset;
+    uint32_t size;
+};
+
+// Opus packets of an Ogg file, found once so playing it again does not parse the pages
+struct SoundIndex {
+    int sample_rate = 16000;
+    std::vector<SoundPacket> packets;
+};
+
+// Decoded sound at the codec output rate, in PSRAM
+struct SoundPcm {
+    int16_t* data = nullptr;
+    size_t samples = 0;
+    size_t capacity = 0;
+
+    ~SoundPcm();
+};
+using SoundPcmPtr = std::shared_ptr<SoundPcm>;
+
+struct SoundCacheStatistics {
+    uint32_t indexed = 0;
+    uint32_t pcm_hits = 0;
+    uint32_t pcm_misses = 0;
+    uint32_t pcm_evictions = 0;
+    size_t pcm_bytes = 0;
+};
+
+/*
+ * Packet index and decoded PCM for the UI sounds (Lang::Sounds::OGG_*).
+ *
+ * Sounds are constant data embedded in the firmware, so they are keyed by address.
+ * The index of a sound is built on its first play and kept, it is a few bytes per packet.
+ * With CONFIG_SOUND_PCM_CACHE_SIZE_KB > 0 the decode task also keeps the decoded PCM of the
+ * most recently played sounds, so they start without waiting for the Opus decoder.
+ */
+class SoundCache {
+public:
+    // Never returns nullptr, a sound that is not Ogg Opus gets an empty index
+    const SoundIndex* GetIndex(const std::string_view& ogg);
+
+    // PCM cache, the functions do nothing when it is disabled
+    SoundPcmPtr GetPcm(const std::string_view& ogg);
+    SoundPcmPtr CreatePcm(size_t max_samples);
+    void StorePcm(const std::string_view& ogg, SoundPcmPtr pcm);
+
+    SoundCacheStatistics statistics();
+
+private:
+    using Key = std::pair<const char*, size_t>;
+    struct PcmEntry {
+        Key key;
+        SoundPcmPtr pcm;
+        uint32_t last_used;
+    };
+
+    std::mutex mutex_;
+    std::map<Key, SoundIndex> indexes_;
+    std::vector<PcmEntry> pcm_entries_;
+    uint32_t clock_ = 0;
+    SoundCacheStatistics statistics_;
+
+    static void BuildIndex(const std::string_view& ogg, SoundIndex& index);
+};
+
+#endif // SOUND_CACHE_H
@@ -0,0 +1,249 @@
+#include "spectrum_analyzer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if __has_include(<esp_dsp.h>)
+#include <esp_dsp.h>
+#define SPECTRUM_USE_ESP_DSP 1
+#endif
+
+#define TAG "SpectrumAnalyzer"
+
+
+SpectrumAnalyzer::~SpectrumAnalyzer() {
+    Stop();
+}
+
+void SpectrumAnalyzer::Start() {
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if (running_) {
+        return;
+    }
+    PrepareTables();
+    std::fill(std::begin(levels_), std::end(levels_), 0.0f);
+    std::fill(std::begin(peaks_), std::end(peaks_), 0.0f);
+    std::fill(std::begin(peak_hold_), std::end(peak_hold_), 0);
+    analysed_position_ = write_position_.load(std::memory_order_acquire);
+    analyze_time_.Reset();
+
+    running_ = true;
+    task_running_ = true;
+    xTaskCreate([](void* arg) {
+        auto analyzer = (SpectrumAnalyzer*)arg;
+        analyzer->AnalyzerTask();
+        analyzer->task_running_ = false;
+        vTaskDelete(NULL);
+    }, "spectrum", 4096, this, SPECTRUM_TASK_PRIORITY, nullptr);
+    ESP_LOGI(TAG, "Started at %d Hz", CONFIG_MUSIC_SPECTRUM_RATE_HZ);
+}
+
+void SpectrumAnalyzer::Stop() {
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    // The task notices within one period
+    while (task_running_) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    // Leave an empty frame so the display does not freeze on the last one
+    std::fill(std::begin(levels_), std::end(levels_), 0.0f);
+    std::fill(std::begin(peaks_), std::end(peaks_), 0.0f);
+    Publish();
+
+    char buffer[128];
+    analyze_time_.Format(buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "Stopped, analyse time: %s", buffer);
+}
+
+void SpectrumAnalyzer::Feed(const int16_t* pcm, size_t samples, int sample_rate) {
+    if (!running_.load(std::memory_order_relaxed) || samples == 0) {
+        return;
+    }
+    // Only the newest samples matter
+    if (samples > kRingSize / 2) {
+        pcm += samples - kRingSize / 2;
+        samples = kRingSize / 2;
+    }
+    sample_rate_.store(sample_rate, std::memory_order_relaxed);
+
+    uint32_t position = write_position_.load(std::memory_order_relaxed);
+    size_t offset = position % kRingSize;
+    size_t first = std::min(samples, kRingSize - offset);
+    memcpy(&ring_[offset], pcm, first * sizeof(int16_t));
+    memcpy(&ring_[0], pcm + first, (samples - first) * sizeof(int16_t));
+    write_position_.store(position + samples, std::memory_order_release);
+}
+
+bool SpectrumAnalyzer::GetFrame(SpectrumFrame& frame, uint32_t last_sequence) const {
+    for (int attempt = 0; attempt < SPECTRUM_READ_ATTEMPTS; attempt++) {
+        uint32_t before = frame_sequence_.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        for (int i = 0; i < SPECTRUM_BAND_COUNT; i++) {
+            frame.bands[i] = frame_bands_[i].load(std::memory_order_relaxed);
+            frame.peaks[i] = frame_peaks_[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (frame_sequence_.load(std::memory_order_relaxed) == before) {
+            frame.sequence = before / 2;
+            return frame.sequence != last_sequence;
+        }
+    }
+    return false;
+}
+
+void SpectrumAnalyzer::AnalyzerTask() {
+    TickType_t period = std::max<TickType_t>(pdMS_TO_TICKS(1000 / CONFIG_MUSIC_SPECTRUM_RATE_HZ), 1);
+    TickType_t last_wake = xTaskGetTickCount();
+    while (running_) {
+        int64_t start_time = esp_timer_get_time();
+        if (Analyze()) {
+            analyze_time_.Record(esp_timer_get_time() - start_time);
+        }
+        Publish();
+        vTaskDelayUntil(&last_wake, period);
+    }
+}
+
+void SpectrumAnalyzer::PrepareTables() {
+    if (tables_ready_) {
+        return;
+    }
+    for (int i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        window_[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / (SPECTRUM_FFT_SIZE - 1));
+    }
+#if SPECTRUM_USE_ESP_DSP
+    esp_err_t ret = dsps_fft2r_init_fc32(NULL, SPECTRUM_FFT_SIZE);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize the esp-dsp FFT: %d", ret);
+    }
+#else
+    for (int k = 0; k < SPECTRUM_FFT_SIZE / 2; k++) {
+        twiddles_[2 * k] = cosf(2.0f * (float)M_PI * k / SPECTRUM_FFT_SIZE);
+        twiddles_[2 * k + 1] = sinf(2.0f * (float)M_PI * k / SPECTRUM_FFT_SIZE);
+    }
+#endif
+    tables_ready_ = true;
+}
+
+// Logarithmically spaced band edges, every band at least one bin wide
+void SpectrumAnalyzer::UpdateBandBins(int sample_rate) {
+    band_sample_rate_ = sample_rate;
+    float max_frequency = std::min(SPECTRUM_MAX_FREQUENCY, sample_rate / 2);
+    float ratio = max_frequency / SPECTRUM_MIN_FREQUENCY;
+    for (int b = 0; b <= SPECTRUM_BAND_COUNT; b++) {
+        float frequency = SPECTRUM_MIN_FREQUENCY * powf(ratio, (float)b / SPECTRUM_BAND_COUNT);
+        int bin = (int)lroundf(frequency * SPECTRUM_FFT_SIZE / sample_rate);
+        if (b > 0 && bin <= band_bins_[b - 1]) {
+            bin = band_bins_[b - 1] + 1;
+        }
+        band_bins_[b] = std::min(std::max(bin, 1), SPECTRUM_FFT_SIZE / 2);
+    }
+}
+
+bool SpectrumAnalyzer::Analyze() {
+    const float dt = 1.0f / CONFIG_MUSIC_SPECTRUM_RATE_HZ;
+    uint32_t end = write_position_.load(std::memory_order_acquire);
+    int sample_rate = sample_rate_.load(std::memory_order_relaxed);
+    bool fresh = end != analysed_position_ && sample_rate > 0;
+    analysed_position_ = end;
+
+    float values[SPECTRUM_BAND_COUNT] = {};
+    if (fresh) {
+        if (sample_rate != band_sample_rate_) {
+            UpdateBandBins(sample_rate);
+        }
+
+        // Newest window, scaled to -1..1
+        uint32_t start = end - SPECTRUM_FFT_SIZE;
+        for (int i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+            fft_[2 * i] = ring_[(start + i) % kRingSize] * (window_[i] / 32768.0f);
+            fft_[2 * i + 1] = 0.0f;
+        }
+        Fft(fft_);
+
+        // A full scale sine peaks at N / 4 with the Hann window, that is 0 dBFS
+        const float reference = 1.0f / ((SPECTRUM_FFT_SIZE / 4.0f) * (SPECTRUM_FFT_SIZE / 4.0f));
+        for (int b = 0; b < SPECTRUM_BAND_COUNT; b++) {
+            float power = 0.0f;
+            for (int k = band_bins_[b]; k < band_bins_[b + 1]; k++) {
+                power += fft_[2 * k] * fft_[2 * k] + fft_[2 * k + 1] * fft_[2 * k + 1];
+            }
+            float db = 10.0f * log10f(power * reference + 1e-12f);
+            values[b] = std::clamp((db + SPECTRUM_RANGE_DB) / SPECTRUM_RANGE_DB, 0.0f, 1.0f);
+        }
+    }
+
+    // Rise at once, fall slowly; without new audio the bands fall to zero
+    const int hold_frames = SPECTRUM_PEAK_HOLD_MS * CONFIG_MUSIC_SPECTRUM_RATE_HZ / 1000;
+    for (int b = 0; b < SPECTRUM_BAND_COUNT; b++) {
+        levels_[b] = std::max(values[b], levels_[b] - SPECTRUM_BAND_DECAY_PER_SECOND * dt);
+        if (levels_[b] >= peaks_[b]) {
+            peaks_[b] = levels_[b];
+            peak_hold_[b] = hold_frames;
+        } else if (peak_hold_[b] > 0) {
+            peak_hold_[b]--;
+        } else {
+            peaks_[b] = std::max(levels_[b], peaks_[b] - SPECTRUM_PEAK_DECAY_PER_SECOND * dt);
+        }
+    }
+    return fresh;
+}
+
+void SpectrumAnalyzer::Fft(float* data) {
+#if SPECTRUM_USE_ESP_DSP
+    dsps_fft2r_fc32(data, SPECTRUM_FFT_SIZE);
+    dsps_bit_rev_fc32(data, SPECTRUM_FFT_SIZE);
+#else
+    // Iterative radix-2 decimation in time, bit reversal first
+    const int n = SPECTRUM_FFT_SIZE;
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(data[2 * i], data[2 * j]);
+            std::swap(data[2 * i + 1], data[2 * j + 1]);
+        }
+    }
+    for (int length = 2; length <= n; length <<= 1) {
+        int step = n / length;
+        int half = length / 2;
+        for (int i = 0; i < n; i += length) {
+            for (int k = 0; k < half; k++) {
+                float wr = twiddles_[2 * k * step];
+                float wi = -twiddles_[2 * k * step + 1];
+                float* a = &data[2 * (i + k)];
+                float* b = &data[2 * (i + k + half)];
+                float vr = b[0] * wr - b[1] * wi;
+                float vi = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - vr;
+                b[1] = a[1] - vi;
+                a[0] += vr;
+                a[1] += vi;
+            }
+        }
+    }
+#endif
+}
+
+void SpectrumAnalyzer::Publish() {
+    uint32_t sequence = frame_sequence_.load(std::memory_order_relaxed);
+    frame_sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < SPECTRUM_BAND_COUNT; i++) {
+        frame_bands_[i].store(levels_[i], std::memory_order_relaxed);
+        frame_peaks_[i].store(peaks_[i], std::memory_order_relaxed);
+    }
+    frame_sequence_.store(sequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,110 @@
+#ifndef SPECTRUM_ANALYZER_H
+#define SPECTRUM_ANALYZER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "audio_timing.h"
+
+// FFT length in samples, 512 at 44.1 kHz resolves 86 Hz per bin
+#define SPECTRUM_FFT_SIZE 512
+#define SPECTRUM_BAND_COUNT 16
+#define SPECTRUM_MIN_FREQUENCY 60
+#define SPECTRUM_MAX_FREQUENCY 16000
+// Band levels map -SPECTRUM_RANGE_DB..0 dBFS to 0..1
+#define SPECTRUM_RANGE_DB 60
+// Falling bands lose this much per second, peaks hold before they fall
+#define SPECTRUM_BAND_DECAY_PER_SECOND 1.5f
+#define SPECTRUM_PEAK_HOLD_MS 400
+#define SPECTRUM_PEAK_DECAY_PER_SECOND 0.6f
+#define SPECTRUM_TASK_PRIORITY 1
+// GetFrame() attempts while Publish() is writing, before it reports no new frame
+#define SPECTRUM_READ_ATTEMPTS 4
+
+
+struct SpectrumFrame {
+    float bands[SPECTRUM_BAND_COUNT] = {};  // 0..1, low to high frequencies
+    float peaks[SPECTRUM_BAND_COUNT] = {};
+    uint32_t sequence = 0;                  // Increments with every analysed frame
+};
+
+/*
+ * Spectrum of the music being decoded, for visualizers.
+ *
+ * The decoder calls Feed() with its mono PCM, which only copies it into a sample ring.
+ * A task at SPECTRUM_TASK_PRIORITY wakes at CONFIG_MUSIC_SPECTRUM_RATE_HZ, applies a Hann
+ * window to the newest SPECTRUM_FFT_SIZE samples, runs a real FFT (esp-dsp when the component
+ * is available, a portable radix-2 FFT otherwise), sums the bins into logarithmic bands and
+ * smooths them with a falling decay and peak hold.
+ *
+ * Results are published lock free behind a sequence counter: Publish() makes it odd, stores
+ * the bands and makes it even again, and GetFrame() copies the bands and retries if the
+ * counter was odd or changed meanwhile. The display never sees a torn frame and never blocks;
+ * if the analyzer task is preempted in the middle of a write, GetFrame() gives up after
+ * SPECTRUM_READ_ATTEMPTS and the display keeps its previous frame.
+ * Start() and Stop() may be called from any task, they are serialised by their own mutex.
+ */
+class SpectrumAnalyzer {
+public:
+    SpectrumAnalyzer() = default;
+    SpectrumAnalyzer(const SpectrumAnalyzer&) = delete;
+    SpectrumAnalyzer& operator=(const SpectrumAnalyzer&) = delete;
+    ~SpectrumAnalyzer();
+
+    void Start();
+    void Stop();
+    bool running() const { return running_.load(std::memory_order_relaxed); }
+
+    // Decoder side, cheap enough to call for every frame
+    void Feed(const int16_t* pcm, size_t samples, int sample_rate);
+
+    // Display side: copies the newest frame, returns false if nothing was analysed since the last call
+    bool GetFrame(SpectrumFrame& frame, uint32_t last_sequence = 0) const;
+
+    const AudioTimingHistogram& analyze_time() const { return analyze_time_; }
+
+private:
+    // Power of two, holds a few FFT windows so the task reads samples the decoder is not writing
+    static constexpr size_t kRingSize = SPECTRUM_FFT_SIZE * 4;
+
+    std::atomic<bool> running_ = false;
+    std::atomic<bool> task_running_ = false;
+
+    int16_t ring_[kRingSize] = {};
+    std::atomic<uint32_t> write_position_ = 0;
+    std::atomic<int> sample_rate_ = 0;
+    uint32_t analysed_position_ = 0;
+
+    alignas(16) float window_[SPECTRUM_FFT_SIZE];
+    alignas(16) float fft_[SPECTRUM_FFT_SIZE * 2];  // Interleaved complex, re im
+    float twiddles_[SPECTRUM_FFT_SIZE];             // Portable FFT: cos, sin for k < N / 2
+    bool tables_ready_ = false;
+
+    int band_sample_rate_ = 0;
+    int band_bins_[SPECTRUM_BAND_COUNT + 1] = {};   // First bin of each band, and the end
+    float levels_[SPECTRUM_BAND_COUNT] = {};
+    float peaks_[SPECTRUM_BAND_COUNT] = {};
+    int peak_hold_[SPECTRUM_BAND_COUNT] = {};       // Frames left before the peak starts to fall
+
+    std::mutex control_mutex_;          // Start() and Stop()
+    // Written by Publish() only, odd while it stores the bands
+    std::atomic<uint32_t> frame_sequence_ = 0;
+    std::atomic<float> frame_bands_[SPECTRUM_BAND_COUNT] = {};
+    std::atomic<float> frame_peaks_[SPECTRUM_BAND_COUNT] = {};
+
+    AudioTimingHistogram analyze_time_;
+
+    void AnalyzerTask();
+    void PrepareTables();
+    void UpdateBandBins(int sample_rate);
+    bool Analyze();
+    void Fft(float* data);
+    void Publish();
+};
+
+#endif // SPECTRUM_ANALYZER_H
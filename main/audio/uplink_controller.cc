@@ -0,0 +1,81 @@
+#include "uplink_controller.h"
+
+#include <esp_log.h>
+
+#define TAG "UplinkController"
+
+
+void UplinkController::Reset(int min_frame_duration_ms, int max_complexity) {
+    min_frame_duration_ms_ = min_frame_duration_ms;
+    frame_duration_ms_ = min_frame_duration_ms;
+    max_complexity_ = max_complexity;
+    // Keep the complexity found so far, the CPU does not change between sessions
+    if (complexity_ > max_complexity_) {
+        complexity_ = max_complexity_;
+    }
+    window_ms_ = 0;
+    window_frames_ = 0;
+    max_queued_ms_ = 0;
+    window_failures_ = 0;
+    window_encode_time_us_ = 0;
+    clean_windows_ = 0;
+}
+
+bool UplinkController::Update(size_t send_queue_depth, uint32_t send_failures, int64_t encode_time_us) {
+    int queued_ms = send_queue_depth * frame_duration_ms_;
+    if (queued_ms > max_queued_ms_) {
+        max_queued_ms_ = queued_ms;
+    }
+    window_failures_ += send_failures;
+    statistics_.send_failures += send_failures;
+    window_encode_time_us_ += encode_time_us;
+    window_frames_++;
+    window_ms_ += frame_duration_ms_;
+
+    // React to a failed send right away, the rest waits for the end of the window
+    if (window_failures_ == 0 && window_ms_ < UPLINK_WINDOW_MS) {
+        return false;
+    }
+
+    bool changed = false;
+    int64_t frame_us = frame_duration_ms_ * 1000;
+    int64_t average_encode_us = window_encode_time_us_ / window_frames_;
+    if (average_encode_us * 2 > frame_us && complexity_ > 0) {
+        complexity_--;
+        statistics_.complexity_changes++;
+        changed = true;
+    } else if (average_encode_us * 4 < frame_us && complexity_ < max_complexity_) {
+        complexity_++;
+        statistics_.complexity_changes++;
+        changed = true;
+    }
+
+    if (window_failures_ > 0 || max_queued_ms_ >= UPLINK_CONGESTED_QUEUE_MS) {
+        statistics_.congested_windows++;
+        clean_windows_ = 0;
+        if (frame_duration_ms_ < UPLINK_MAX_FRAME_DURATION_MS) {
+            frame_duration_ms_ += 20;
+            statistics_.frame_duration_changes++;
+            changed = true;
+            ESP_LOGW(TAG, "Uplink congested (queued %dms, %lu failures), frame duration %dms",
+                max_queued_ms_, window_failures_, frame_duration_ms_);
+        }
+    } else if (max_queued_ms_ <= frame_duration_ms_) {
+        if (++clean_windows_ >= UPLINK_RECOVERY_WINDOWS && frame_duration_ms_ > min_frame_duration_ms_) {
+            frame_duration_ms_ -= 20;
+            statistics_.frame_duration_changes++;
+            clean_windows_ = 0;
+            changed = true;
+            ESP_LOGI(TAG, "Uplink recovered, frame duration %dms", frame_duration_ms_);
+        }
+    } else {
+        clean_windows_ = 0;
+    }
+
+    window_ms_ = 0;
+    window_frames_ = 0;
+    max_queued_ms_ = 0;
+    window_failures_ = 0;
+    window_encode_time_us_ = 0;
+    return changed;
+}
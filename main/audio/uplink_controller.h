@@ -0,0 +1,58 @@
+#ifndef UPLINK_CONTROLLER_H
+#define UPLINK_CONTROLLER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define UPLINK_MAX_FRAME_DURATION_MS 60
+#define UPLINK_WINDOW_MS 1000
+// Audio waiting in the send queue beyond this means the network does not keep up
+#define UPLINK_CONGESTED_QUEUE_MS 400
+// Clean windows required before going back to shorter frames
+#define UPLINK_RECOVERY_WINDOWS 3
+
+
+struct UplinkStatistics {
+    uint32_t send_failures = 0;
+    uint32_t congested_windows = 0;
+    uint32_t frame_duration_changes = 0;
+    uint32_t complexity_changes = 0;
+};
+
+/*
+ * Adapts the uplink Opus encoder to the link and to the CPU, one decision per window of audio.
+ *
+ * Network: a deep send queue or a failed send moves to the next longer frame duration (fewer,
+ * larger packets), and a few clean windows move back towards the negotiated duration.
+ * CPU: complexity drops when encoding takes more than half of the frame duration and grows
+ * again, up to the configured maximum, while it takes less than a quarter.
+ *
+ * Only used by the encode task.
+ */
+class UplinkController {
+public:
+    void Reset(int min_frame_duration_ms, int max_complexity);
+
+    // Called for every frame that went to the send queue, returns true if a setting changed
+    bool Update(size_t send_queue_depth, uint32_t send_failures, int64_t encode_time_us);
+
+    int frame_duration_ms() const { return frame_duration_ms_; }
+    int complexity() const { return complexity_; }
+    const UplinkStatistics& statistics() const { return statistics_; }
+
+private:
+    int min_frame_duration_ms_ = UPLINK_MAX_FRAME_DURATION_MS;
+    int frame_duration_ms_ = UPLINK_MAX_FRAME_DURATION_MS;
+    int max_complexity_ = 0;
+    int complexity_ = 0;
+
+    int window_ms_ = 0;
+    int window_frames_ = 0;
+    int max_queued_ms_ = 0;
+    uint32_t window_failures_ = 0;
+    int64_t window_encode_time_us_ = 0;
+    int clean_windows_ = 0;
+    UplinkStatistics statistics_;
+};
+
+#endif // UPLINK_CONTROLLER_H
@@ -0,0 +1,80 @@
+#include "uplink_dtx.h"
+
+// Pre-roll slots for the shortest frame duration
+#define UPLINK_DTX_MIN_FRAME_DURATION_MS 20
+
+
+UplinkDtx::UplinkDtx() {
+    preroll_.Reset(UPLINK_DTX_PREROLL_MS / UPLINK_DTX_MIN_FRAME_DURATION_MS);
+}
+
+void UplinkDtx::Reset() {
+    AudioStreamPacketPtr packet;
+    while (preroll_.TryPop(packet)) {
+    }
+    preroll_ms_ = 0;
+    talking_ = false;
+    hangover_ms_ = 0;
+    // The first frame of a session goes out right away as a keepalive
+    silence_ms_ = UPLINK_DTX_KEEPALIVE_MS;
+    statistics_ = UplinkDtxStatistics();
+}
+
+bool UplinkDtx::Process(AudioStreamPacketPtr& packet, bool voice) {
+    statistics_.frames++;
+    if (voice) {
+        if (!talking_) {
+            talking_ = true;
+            statistics_.talkspurts++;
+        }
+        hangover_ms_ = UPLINK_DTX_HANGOVER_MS;
+        return true;
+    }
+
+    if (talking_) {
+        hangover_ms_ -= packet->frame_duration;
+        if (hangover_ms_ <= 0) {
+            talking_ = false;
+            silence_ms_ = 0;
+        }
+        return true;
+    }
+
+    silence_ms_ += packet->frame_duration;
+    if (silence_ms_ >= UPLINK_DTX_KEEPALIVE_MS) {
+        // The held back frames are older than the keepalive, they can no longer be sent
+        while (!preroll_.empty()) {
+            DropOldestPreroll();
+        }
+        silence_ms_ = 0;
+        statistics_.keepalives++;
+        return true;
+    }
+
+    while (preroll_.full() || preroll_ms_ + packet->frame_duration > UPLINK_DTX_PREROLL_MS) {
+        if (preroll_.empty()) {
+            break;
+        }
+        DropOldestPreroll();
+    }
+    preroll_ms_ += packet->frame_duration;
+    preroll_.TryPush(std::move(packet));
+    return false;
+}
+
+bool UplinkDtx::PopPreroll(AudioStreamPacketPtr& packet) {
+    if (!preroll_.TryPop(packet)) {
+        return false;
+    }
+    preroll_ms_ -= packet->frame_duration;
+    return true;
+}
+
+void UplinkDtx::DropOldestPreroll() {
+    AudioStreamPacketPtr packet;
+    if (preroll_.TryPop(packet)) {
+        preroll_ms_ -= packet->frame_duration;
+        statistics_.suppressed++;
+        statistics_.suppressed_bytes += packet->payload.size();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef UPLINK_DTX_H
+#define UPLINK_DTX_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "audio_ring.h"
+#include "protocol.h"
+
+// Silent frames kept back and sent ahead of the first voice frame
+#define UPLINK_DTX_PREROLL_MS 300
+// Frames still sent after the VAD reports silence, covers short pauses between words
+#define UPLINK_DTX_HANGOVER_MS 600
+// One frame goes out this often during silence, so the server sees the stream is alive
+#define UPLINK_DTX_KEEPALIVE_MS 1000
+
+
+struct UplinkDtxStatistics {
+    uint32_t frames = 0;
+    uint32_t suppressed = 0;
+    uint32_t suppressed_bytes = 0;
+    uint32_t keepalives = 0;
+    uint32_t talkspurts = 0;
+};
+
+/*
+ * Discontinuous transmission for the uplink, driven by the VAD of the audio processor.
+ *
+ * Every frame is still encoded, so the encoder state stays continuous. While the VAD reports
+ * silence the encoded frames are held back in a short pre-roll instead of being sent; when
+ * voice starts, the pre-roll goes out first so the onset the VAD needed to detect is not lost.
+ * During long silences a single frame is sent every UPLINK_DTX_KEEPALIVE_MS. With Opus DTX
+ * enabled in the encoder those frames are a few bytes of comfort noise.
+ *
+ * Only used by the encode task.
+ */
+class UplinkDtx {
+public:
+    UplinkDtx();
+
+    // Starts a new session, frames held back from the previous one are dropped
+    void Reset();
+
+    // Returns true if the frame goes out now, after the frames returned by PopPreroll().
+    // Otherwise the packet is kept and moved from.
+    bool Process(AudioStreamPacketPtr& packet, bool voice);
+    bool PopPreroll(AudioStreamPacketPtr& packet);
+
+    const UplinkDtxStatistics& statistics() const { return statistics_; }
+
+private:
+    AudioRing<AudioStreamPacketPtr> preroll_;
+    int preroll_ms_ = 0;
+    bool talking_ = false;
+    int hangover_ms_ = 0;
+    int silence_ms_ = 0;
+    UplinkDtxStatistics statistics_;
+
+    void DropOldestPreroll();
+};
+
+#endif // UPLINK_DTX_H
@@ -18,9 +18,11 @@ public:
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual size_t GetFeedSize() = 0;
-    virtual void EncodeWakeWordData() = 0;
-    virtual bool GetWakeWordOpus(std::vector<uint8_t>& opus) = 0;
+    // Audio the engine listened to, AudioService keeps the last seconds of it Opus encoded
+    virtual void OnAudioData(std::function<void(const int16_t* data, size_t samples)> callback) = 0;
     virtual const std::string& GetLastDetectedWakeWord() const = 0;
+    // Speech started while listening, a wake word may follow. Engines without a VAD never call it
+    virtual void OnSpeechStarted(std::function<void()> callback) {}
 };
 
 #endif
@@ -9,12 +9,9 @@
 #include <esp_nsn_models.h>
 #include <model_path.h>
 
-#include <deque>
 #include <string>
 #include <vector>
 #include <functional>
-#include <mutex>
-#include <condition_variable>
 
 #include "audio_codec.h"
 #include "wake_word.h"
@@ -30,9 +27,9 @@ public:
     void Start();
     void Stop();
     size_t GetFeedSize();
-    void EncodeWakeWordData();
-    bool GetWakeWordOpus(std::vector<uint8_t>& opus);
+    void OnAudioData(std::function<void(const int16_t* data, size_t samples)> callback);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    void OnSpeechStarted(std::function<void()> callback) override;
 
 private:
     srmodel_list_t *models_ = nullptr;
@@ -44,16 +41,10 @@ private:
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
+    std::function<void(const int16_t* data, size_t samples)> audio_data_callback_;
+    std::function<void()> speech_started_callback_;
+    bool speaking_ = false;
 
-    TaskHandle_t wake_word_encode_task_ = nullptr;
-    StaticTask_t* wake_word_encode_task_buffer_ = nullptr;
-    StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::deque<std::vector<int16_t>> wake_word_pcm_;
-    std::deque<std::vector<uint8_t>> wake_word_opus_;
-    std::mutex wake_word_mutex_;
-    std::condition_variable wake_word_cv_;
-
-    void StoreWakeWordData(const int16_t* data, size_t size);
     void AudioDetectionTask();
 };
 
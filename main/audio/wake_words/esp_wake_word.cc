@@ -79,9 +79,6 @@ size_t EspWakeWord::GetFeedSize() {
     return wakenet_iface_->get_samp_chunksize(wakenet_data_);
 }
 
-void EspWakeWord::EncodeWakeWordData() {
-}
-
-bool EspWakeWord::GetWakeWordOpus(std::vector<uint8_t>& opus) {
-    return false;
+void EspWakeWord::OnAudioData(std::function<void(const int16_t* data, size_t samples)> callback) {
+    // WakeNet alone keeps no wake word audio for the server
 }
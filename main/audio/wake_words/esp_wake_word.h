@@ -24,8 +24,7 @@ public:
     void Start();
     void Stop();
     size_t GetFeedSize();
-    void EncodeWakeWordData();
-    bool GetWakeWordOpus(std::vector<uint8_t>& opus);
+    void OnAudioData(std::function<void(const int16_t* data, size_t samples)> callback);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
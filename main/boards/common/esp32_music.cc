@@ -2,6 +2,7 @@
 #include "board.h"
 #include "system_info.h"
 #include "audio/audio_codec.h"
+#include "audio/sample_conversion.h"
 #include "application.h"
 #include "protocols/protocol.h"
 #include "display/display.h"
@@ -14,9 +15,7 @@
 #include <cJSON.h>
 #include <cstring>
 #include <chrono>
-#include <sstream>
 #include <algorithm>
-#include <cctype> // 为isdigit函数
 #include <thread> // 为线程ID比较
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -185,14 +184,24 @@ static std::string url_encode(const std::string &str)
 
 Esp32Music::Esp32Music() : last_downloaded_data_(), current_music_url_(), current_song_name_(),
                            song_name_displayed_(false), current_lyric_url_(), lyrics_(),
-                           current_lyric_index_(-1), lyric_thread_(), is_lyric_running_(false),
+                           current_lyric_index_(-1), lyric_thread_(),
                            display_mode_(DISPLAY_MODE_LYRICS), is_playing_(false), is_downloading_(false),
-                           play_thread_(), download_thread_(), audio_buffer_(), buffer_mutex_(),
-                           buffer_cv_(), buffer_size_(0), mp3_decoder_(nullptr), mp3_frame_info_(),
+                           play_thread_(), download_thread_(), stream_buffer_(), mp3_decoder_(nullptr), mp3_frame_info_(),
                            mp3_decoder_initialized_(false)
 {
     ESP_LOGI(TAG, "Music player initialized with default spectrum display mode");
     InitializeMp3Decoder();
+
+    esp_timer_create_args_t lyric_timer_args = {
+        .callback = [](void *arg) {
+            static_cast<Esp32Music *>(arg)->OnLyricTimer();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "lyric_timer",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&lyric_timer_args, &lyric_timer_));
 }
 
 Esp32Music::~Esp32Music()
@@ -202,13 +211,9 @@ Esp32Music::~Esp32Music()
     // 停止所有操作
     is_downloading_ = false;
     is_playing_ = false;
-    is_lyric_running_ = false;
 
     // 通知所有等待的线程
-    {
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
-        buffer_cv_.notify_all();
-    }
+    stream_buffer_.Close();
 
     // 等待下载线程结束，设置5秒超时
     if (download_thread_.joinable())
@@ -235,10 +240,7 @@ Esp32Music::~Esp32Music()
             is_downloading_ = false;
 
             // 通知条件变量
-            {
-                std::lock_guard<std::mutex> lock(buffer_mutex_);
-                buffer_cv_.notify_all();
-            }
+            stream_buffer_.Close();
 
             // 检查线程是否已经结束
             if (!download_thread_.joinable())
@@ -284,10 +286,7 @@ Esp32Music::~Esp32Music()
             is_playing_ = false;
 
             // 通知条件变量
-            {
-                std::lock_guard<std::mutex> lock(buffer_mutex_);
-                buffer_cv_.notify_all();
-            }
+            stream_buffer_.Close();
 
             // 检查线程是否已经结束
             if (!play_thread_.joinable())
@@ -310,9 +309,11 @@ Esp32Music::~Esp32Music()
         lyric_thread_.join();
         ESP_LOGI(TAG, "Lyric thread finished");
     }
+    esp_timer_stop(lyric_timer_);
+    esp_timer_delete(lyric_timer_);
+    delete pending_lyrics_.exchange(nullptr);
 
-    // 清理缓冲区和MP3解码器
-    ClearAudioBuffer();
+    // 清理MP3解码器，环形缓冲区随对象释放
     CleanupMp3Decoder();
 
     ESP_LOGI(TAG, "Music player destroyed successfully");
@@ -327,7 +328,49 @@ bool Esp32Music::Download(const std::string &song_name, const std::string &artis
 
     // 保存歌名用于后续显示
     current_song_name_ = song_name;
+    current_lyric_url_.clear();
+
+    std::string cached_path;
+#if CONFIG_USE_MUSIC_CACHE
+    // 最近播放过的歌曲直接从本地缓存播放；歌词也已缓存（或不显示歌词）时不再请求音乐API
+    cache_.Initialize(CONFIG_MUSIC_CACHE_SD_PATH, (size_t)CONFIG_MUSIC_CACHE_SIZE_MB * 1024 * 1024);
+    cache_key_ = MusicCache::Key(song_name, artist_name);
+    cached_path = cache_.Lookup(cache_key_);
+    if (!cached_path.empty() && (display_mode_ != DISPLAY_MODE_LYRICS || cache_.HasLyrics(cache_key_)))
+    {
+        ESP_LOGI(TAG, "Playing %s by %s from the music cache: %s", song_name.c_str(), artist_name.c_str(), cached_path.c_str());
+        last_downloaded_data_ = "{\"cached\": true}";
+        song_name_displayed_ = false;
+        StartStreaming(MUSIC_CACHE_URL_PREFIX + cached_path);
+        StartLyrics();
+        return true;
+    }
+    if (!cached_path.empty())
+    {
+        ESP_LOGI(TAG, "%s is cached without lyrics, asking the music API for the lyric URL", song_name.c_str());
+    }
+#endif
+
+    if (RequestMusic(song_name, artist_name, cached_path))
+    {
+        return true;
+    }
+    if (!cached_path.empty())
+    {
+        // 音乐API不可用时仍从缓存播放，只是没有歌词
+        ESP_LOGW(TAG, "Music API failed, playing %s from the music cache without lyrics", song_name.c_str());
+        last_downloaded_data_ = "{\"cached\": true}";
+        song_name_displayed_ = false;
+        StartStreaming(MUSIC_CACHE_URL_PREFIX + cached_path);
+        StartLyrics();
+        return true;
+    }
+    return false;
+}
 
+// 请求音乐API获取音频和歌词地址并开始播放；cached_path不为空时音频从缓存播放，只使用歌词地址
+bool Esp32Music::RequestMusic(const std::string &song_name, const std::string &artist_name, const std::string &cached_path)
+{
     // 第一步：请求stream_pcm接口获取音频信息
     std::string base_url = "http://110.42.59.54:2233";
     std::string full_url = base_url + "/stream_pcm?song=" + url_encode(song_name) + "&artist=" + url_encode(artist_name);
@@ -423,7 +466,7 @@ bool Esp32Music::Download(const std::string &song_name, const std::string &artis
                 
                 // 立即开始播放音乐，跳过TTS播报
                 ESP_LOGI(TAG, "Starting music playback for: %s", song_name.c_str());
-                StartStreaming(current_music_url_);
+                StartStreaming(cached_path.empty() ? current_music_url_ : MUSIC_CACHE_URL_PREFIX + cached_path);
 
                 // 处理歌词URL - 只有在歌词显示模式下才启动歌词
                 if (cJSON_IsString(lyric_url) && lyric_url->valuestring && strlen(lyric_url->valuestring) > 0)
@@ -433,31 +476,7 @@ bool Esp32Music::Download(const std::string &song_name, const std::string &artis
 
                     current_lyric_url_ = lyric_path;
 
-                    // 根据显示模式决定是否启动歌词
-                    if (display_mode_ == DISPLAY_MODE_LYRICS)
-                    {
-                        ESP_LOGI(TAG, "Loading lyrics for: %s (lyrics display mode)", song_name.c_str());
-
-                        // 启动歌词下载和显示
-                        if (is_lyric_running_)
-                        {
-                            is_lyric_running_ = false;
-                            if (lyric_thread_.joinable())
-                            {
-                                lyric_thread_.join();
-                            }
-                        }
-
-                        is_lyric_running_ = true;
-                        current_lyric_index_ = -1;
-                        lyrics_.clear();
-
-                        lyric_thread_ = std::thread(&Esp32Music::LyricDisplayThread, this);
-                    }
-                    else
-                    {
-                        ESP_LOGI(TAG, "Lyric URL found but spectrum display mode is active, skipping lyrics");
-                    }
+                    StartLyrics();
                 }
                 else
                 {
@@ -512,53 +531,119 @@ bool Esp32Music::StartStreaming(const std::string &music_url)
     // 等待之前的线程完全结束
     if (download_thread_.joinable())
     {
-        {
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
-            buffer_cv_.notify_all(); // 通知线程退出
-        }
+        stream_buffer_.Close();
         download_thread_.join();
     }
     if (play_thread_.joinable())
     {
-        {
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
-            buffer_cv_.notify_all(); // 通知线程退出
-        }
+        stream_buffer_.Close();
         play_thread_.join();
     }
 
-    // 清空缓冲区
-    ClearAudioBuffer();
+    // 新的歌曲：清空上一首的文件信息、统计和未处理的跳转
+    seek_requested_ = false;
+    current_music_url_ = music_url;
+    content_length_ = 0;
+    audio_data_offset_ = 0;
+    average_bitrate_ = 0;
+    resume_count_ = 0;
+    decode_time_.Reset();
+    output_time_.Reset();
+    Application::GetInstance().ResetMusicResampler();
+
+    return StartStreamThreads(0, 0);
+}
 
-    // 配置线程栈大小以避免栈溢出
-    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+// 从文件的指定字节位置开始下载和解码，start_time_ms为该位置对应的播放时间
+bool Esp32Music::StartStreamThreads(size_t start_offset, int64_t start_time_ms)
+{
+    // 按采样率选择环形缓冲区大小，大小不变时复用上一首歌的内存
+    auto codec = Board::GetInstance().GetAudioCodec();
+    size_t buffer_capacity = MAX_BUFFER_SIZE;
+    if (codec && codec->output_sample_rate() >= 48000)
+    {
+        buffer_capacity = HIGH_SAMPLE_RATE_BUFFER_SIZE;
+    }
+    if (!stream_buffer_.Reset(buffer_capacity))
+    {
+        ESP_LOGE(TAG, "Failed to allocate music stream buffer");
+        return false;
+    }
+
+    stream_start_offset_ = start_offset;
+    stream_start_time_ms_ = start_time_ms;
+
+    // 下载和解码分别固定在不同的核上：网络协议栈在核0，MP3解码在核1，互不抢占
+    esp_pthread_cfg_t default_cfg = esp_pthread_get_default_config();
+    esp_pthread_cfg_t cfg = default_cfg;
     cfg.stack_size = 8192; // 8KB栈大小
     cfg.prio = 5;          // 中等优先级
-    cfg.thread_name = "audio_stream";
-    esp_pthread_set_cfg(&cfg);
 
     // 开始下载线程
+    cfg.thread_name = "music_download";
+#if !CONFIG_FREERTOS_UNICORE
+    cfg.pin_to_core = CONFIG_MUSIC_DOWNLOAD_TASK_CORE;
+#endif
+    esp_pthread_set_cfg(&cfg);
     is_downloading_ = true;
-    download_thread_ = std::thread(&Esp32Music::DownloadAudioStream, this, music_url);
+    download_thread_ = std::thread(&Esp32Music::DownloadAudioStream, this, current_music_url_, start_offset);
 
-    // 开始播放线程（会等待缓冲区有足够数据）
+    // 开始解码线程（会等待缓冲区有足够数据）
+    cfg.thread_name = "music_decode";
+#if !CONFIG_FREERTOS_UNICORE
+    cfg.pin_to_core = CONFIG_MUSIC_DECODE_TASK_CORE;
+#endif
+    esp_pthread_set_cfg(&cfg);
     is_playing_ = true;
     play_thread_ = std::thread(&Esp32Music::PlayAudioStream, this);
 
+    // 恢复默认配置，避免之后创建的线程（如歌词线程）也被固定到核上
+    esp_pthread_set_cfg(&default_cfg);
+
     ESP_LOGI(TAG, "Streaming threads started successfully");
 
     return true;
 }
 
+// 跳转到指定播放时间：只记录跳转请求后立即返回，不在调用者（MCP任务）中等待线程。
+// 下载线程以Range请求从对应的字节位置重新下载并清空缓冲区，解码线程遇到断点时重置MP3解码器
+bool Esp32Music::Seek(int64_t position_ms)
+{
+    if (!is_playing_ || current_music_url_.empty())
+    {
+        ESP_LOGW(TAG, "Seek ignored, no music is playing");
+        return false;
+    }
+
+    // 按平均码率估算字节位置，对固定码率的MP3是准确的
+    int bitrate = average_bitrate_;
+    if (bitrate <= 0)
+    {
+        ESP_LOGW(TAG, "Seek ignored, bitrate not known yet");
+        return false;
+    }
+    size_t offset = audio_data_offset_ + position_ms * (bitrate / 8) / 1000;
+    if (content_length_ > 0 && offset >= content_length_)
+    {
+        ESP_LOGW(TAG, "Seek position %lldms is beyond the end of the song", position_ms);
+        return false;
+    }
+    ESP_LOGI(TAG, "Seeking to %lldms, byte offset %d (bitrate %d)", position_ms, offset, bitrate);
+
+    seek_offset_ = offset;
+    seek_time_ms_ = position_ms;
+    seek_requested_ = true;
+    // 丢弃已经在混音器中的旧位置的音频，解码线程若正等待混音器也随即返回
+    Application::GetInstance().GetAudioService().ClearMixerStream(kAudioMixerStreamMusic);
+    return true;
+}
+
 // 停止流式播放
 bool Esp32Music::StopStreaming()
 {
     ESP_LOGI(TAG, "Stopping music streaming - current state: downloading=%d, playing=%d",
              is_downloading_.load(), is_playing_.load());
 
-    // 重置采样率到原始值
-    ResetSampleRate();
-
     // 检查是否有流式播放正在进行
     if (!is_playing_ && !is_downloading_)
     {
@@ -570,6 +655,10 @@ bool Esp32Music::StopStreaming()
     is_downloading_ = false;
     is_playing_ = false;
 
+    // 清空混音器中尚未播放的音乐，同时唤醒可能阻塞在写入上的播放线程
+    auto &audio_service = Application::GetInstance().GetAudioService();
+    audio_service.ClearMixerStream(kAudioMixerStreamMusic);
+
     // 清空歌名显示
     auto &board = Board::GetInstance();
     auto display = board.GetDisplay();
@@ -580,10 +669,7 @@ bool Esp32Music::StopStreaming()
     }
 
     // 通知所有等待的线程
-    {
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
-        buffer_cv_.notify_all();
-    }
+    stream_buffer_.Close();
 
     // 等待线程结束（避免重复代码，让StopStreaming也能等待线程完全停止）
     if (download_thread_.joinable())
@@ -592,52 +678,19 @@ bool Esp32Music::StopStreaming()
         ESP_LOGI(TAG, "Download thread joined in StopStreaming");
     }
 
-    // 等待播放线程结束，使用更安全的方式
+    // 播放线程阻塞在环形缓冲区或混音器写入上时，Close()和ClearMixerStream()都会唤醒它，可以直接join
     if (play_thread_.joinable())
     {
-        // 先设置停止标志
-        is_playing_ = false;
-
-        // 通知条件变量，确保线程能够退出
-        {
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
-            buffer_cv_.notify_all();
-        }
-
-        // 使用超时机制等待线程结束，避免死锁
-        bool thread_finished = false;
-        int wait_count = 0;
-        const int max_wait = 100; // 最多等待1秒
-
-        while (!thread_finished && wait_count < max_wait)
-        {
-            vTaskDelay(pdMS_TO_TICKS(10));
-            wait_count++;
-
-            // 检查线程是否仍然可join
-            if (!play_thread_.joinable())
-            {
-                thread_finished = true;
-                break;
-            }
-        }
-
-        if (play_thread_.joinable())
-        {
-            if (wait_count >= max_wait)
-            {
-                ESP_LOGW(TAG, "Play thread join timeout, detaching thread");
-                play_thread_.detach();
-            }
-            else
-            {
-                play_thread_.join();
-                ESP_LOGI(TAG, "Play thread joined in StopStreaming");
-            }
-        }
+        play_thread_.join();
+        ESP_LOGI(TAG, "Play thread joined in StopStreaming");
     }
 
+    // 播放线程退出前可能又写入了一帧
+    audio_service.ClearMixerStream(kAudioMixerStreamMusic);
+
     // 在线程完全结束后，只在频谱模式下停止FFT显示
+    esp_timer_stop(lyric_timer_);
+    spectrum_.Stop();
     if (display && display_mode_ == DISPLAY_MODE_SPECTRUM)
     {
         display->stopFft();
@@ -652,26 +705,16 @@ bool Esp32Music::StopStreaming()
     return true;
 }
 
-// 流式下载音频数据
-void Esp32Music::DownloadAudioStream(const std::string &music_url)
+// 打开音频流，从start_offset开始请求，返回nullptr表示连接失败
+std::unique_ptr<Http> Esp32Music::OpenAudioStream(const std::string &music_url, size_t start_offset)
 {
-    ESP_LOGD(TAG, "Starting audio stream download from: %s", music_url.c_str());
-
-    // 验证URL有效性
-    if (music_url.empty() || music_url.find("http") != 0)
-    {
-        ESP_LOGE(TAG, "Invalid URL format: %s", music_url.c_str());
-        is_downloading_ = false;
-        return;
-    }
-
     auto network = Board::GetInstance().GetNetwork();
     auto http = network->CreateHttp(0);
 
     // 设置基本请求头
     http->SetHeader("User-Agent", "ESP32-Music-Player/1.0");
     http->SetHeader("Accept", "*/*");
-    http->SetHeader("Range", "bytes=0-"); // 支持断点续传
+    http->SetHeader("Range", "bytes=" + std::to_string(start_offset) + "-"); // 支持断点续传和跳转
 
     // 添加ESP32认证头
     add_auth_headers(http.get());
@@ -679,8 +722,7 @@ void Esp32Music::DownloadAudioStream(const std::string &music_url)
     if (!http->Open("GET", music_url))
     {
         ESP_LOGE(TAG, "Failed to connect to music stream URL");
-        is_downloading_ = false;
-        return;
+        return nullptr;
     }
 
     int status_code = http->GetStatusCode();
@@ -688,126 +730,308 @@ void Esp32Music::DownloadAudioStream(const std::string &music_url)
     { // 206 for partial content
         ESP_LOGE(TAG, "HTTP GET failed with status code: %d", status_code);
         http->Close();
-        is_downloading_ = false;
-        return;
+        return nullptr;
     }
 
-    ESP_LOGI(TAG, "Started downloading audio stream, status: %d", status_code);
-
-    // 分块读取音频数据
-    const size_t chunk_size = 4096; // 4KB每块
-    char buffer[chunk_size];
-    size_t total_downloaded = 0;
+    // 记录文件总长度，用于判断连接是否提前断开和跳转范围
+    size_t body_length = http->GetBodyLength();
+    if (body_length > 0)
+    {
+        content_length_ = (status_code == 206 ? start_offset : 0) + body_length;
+    }
 
-    while (is_downloading_ && is_playing_)
+    // 服务器不支持Range时从文件开头返回，丢弃已经下载过的部分
+    if (status_code == 200 && start_offset > 0)
     {
-        int bytes_read = http->Read(buffer, chunk_size);
-        if (bytes_read < 0)
+        ESP_LOGW(TAG, "Server ignored the Range header, skipping %d bytes", start_offset);
+        char discard[512];
+        size_t skipped = 0;
+        while (skipped < start_offset && is_downloading_ && is_playing_)
         {
-            ESP_LOGE(TAG, "Failed to read audio data: error code %d", bytes_read);
-            break;
-        }
-        if (bytes_read == 0)
-        {
-            ESP_LOGI(TAG, "Audio stream download completed, total: %d bytes", total_downloaded);
-            break;
+            int ret = http->Read(discard, std::min(sizeof(discard), start_offset - skipped));
+            if (ret <= 0)
+            {
+                http->Close();
+                return nullptr;
+            }
+            skipped += ret;
         }
+    }
 
-        // 打印数据块信息
-        // ESP_LOGI(TAG, "Downloaded chunk: %d bytes at offset %d", bytes_read, total_downloaded);
+    ESP_LOGI(TAG, "Opened audio stream at offset %d, status: %d, length: %d", start_offset, status_code, content_length_.load());
+    return http;
+}
 
-        // 安全地打印数据块的十六进制内容（前16字节）
-        if (bytes_read >= 16)
-        {
-            // ESP_LOGI(TAG, "Data: %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X ...",
-            //         (unsigned char)buffer[0], (unsigned char)buffer[1], (unsigned char)buffer[2], (unsigned char)buffer[3],
-            //         (unsigned char)buffer[4], (unsigned char)buffer[5], (unsigned char)buffer[6], (unsigned char)buffer[7],
-            //         (unsigned char)buffer[8], (unsigned char)buffer[9], (unsigned char)buffer[10], (unsigned char)buffer[11],
-            //         (unsigned char)buffer[12], (unsigned char)buffer[13], (unsigned char)buffer[14], (unsigned char)buffer[15]);
-        }
-        else
-        {
-            ESP_LOGI(TAG, "Data chunk too small: %d bytes", bytes_read);
-        }
+// 流式下载音频数据，网络错误时从已下载的位置重新连接继续下载
+void Esp32Music::DownloadAudioStream(const std::string &music_url, size_t start_offset)
+{
+    ESP_LOGD(TAG, "Starting audio stream download from: %s", music_url.c_str());
+
+    // 缓存命中时从本地文件读取
+    if (music_url.rfind(MUSIC_CACHE_URL_PREFIX, 0) == 0)
+    {
+        ReadCachedStream(music_url.substr(strlen(MUSIC_CACHE_URL_PREFIX)), start_offset);
+        return;
+    }
+
+    // 验证URL有效性
+    if (music_url.empty() || music_url.find("http") != 0)
+    {
+        ESP_LOGE(TAG, "Invalid URL format: %s", music_url.c_str());
+        is_downloading_ = false;
+        stream_buffer_.Finish();
+        return;
+    }
+
+    // 直接读入环形缓冲区的空闲空间，不再为每块数据分配内存
+    const size_t chunk_size = 4096; // 每次最多读取4KB
+    size_t offset = start_offset;   // 已写入缓冲区的数据在文件中的结束位置
+    int attempts = 0;               // 连续失败的次数，有数据下载成功后清零
+    bool finished = false;
+    bool completed = false;         // 完整下载到文件末尾
 
-        // 尝试检测文件格式（检查文件头）
-        if (total_downloaded == 0 && bytes_read >= 4)
+    // 从头下载时同时写入缓存，完整下载后才加入缓存
+    bool caching = start_offset == 0 && !cache_key_.empty() && cache_.BeginWrite(cache_key_);
+
+    // 下载结束：通知播放线程剩余数据播放完后结束，完整下载的歌曲加入缓存
+    auto finish_download = [this, &caching, &completed, &offset, start_offset]()
+    {
+        is_downloading_ = false;
+        stream_buffer_.Finish();
+        if (caching)
         {
-            if (memcmp(buffer, "ID3", 3) == 0)
+            if (completed)
             {
-                ESP_LOGI(TAG, "Detected MP3 file with ID3 tag");
+                cache_.CommitWrite();
             }
-            else if (buffer[0] == 0xFF && (buffer[1] & 0xE0) == 0xE0)
+            else
             {
-                ESP_LOGI(TAG, "Detected MP3 file header");
+                cache_.AbortWrite();
             }
-            else if (memcmp(buffer, "RIFF", 4) == 0)
+            caching = false;
+        }
+        ESP_LOGI(TAG, "Audio stream download finished at offset %d, started at %d", offset, start_offset);
+    };
+
+    // 下载完成后线程继续等待，直到播放结束，这样跳转回已播放的部分时仍由本线程重新下载
+    while (is_playing_)
+    {
+        if (seek_requested_.exchange(false))
+        {
+            // 跳转后的数据不再是从头开始的完整文件，放弃写入缓存
+            if (caching)
             {
-                ESP_LOGI(TAG, "Detected WAV file");
+                cache_.AbortWrite();
+                caching = false;
             }
-            else if (memcmp(buffer, "fLaC", 4) == 0)
+            offset = seek_offset_;
+            attempts = 0;
+            finished = false;
+            completed = false;
+            is_downloading_ = true;
+            stream_buffer_.Flush();
+            ESP_LOGI(TAG, "Seek: downloading from offset %d", offset);
+        }
+        if (finished || !is_downloading_)
+        {
+            vTaskDelay(pdMS_TO_TICKS(MUSIC_SEEK_POLL_INTERVAL_MS));
+            continue;
+        }
+
+        if (attempts > 0)
+        {
+            if (attempts > MUSIC_RESUME_MAX_ATTEMPTS)
             {
-                ESP_LOGI(TAG, "Detected FLAC file");
+                ESP_LOGE(TAG, "Giving up on the audio stream after %d attempts at offset %d", attempts - 1, offset);
+                finished = true;
+                finish_download();
+                continue;
             }
-            else if (memcmp(buffer, "OggS", 4) == 0)
+            // 重连前等待，期间缓冲区中的数据继续播放；跳转请求打断等待
+            int delay_ms = MUSIC_RESUME_RETRY_DELAY_MS * attempts;
+            ESP_LOGW(TAG, "Resuming audio stream at offset %d in %dms (attempt %d)", offset, delay_ms, attempts);
+            for (int waited = 0; waited < delay_ms && is_downloading_ && is_playing_ && !seek_requested_; waited += 100)
             {
-                ESP_LOGI(TAG, "Detected OGG file");
+                vTaskDelay(pdMS_TO_TICKS(100));
             }
-            else
+            if (!is_downloading_ || !is_playing_ || seek_requested_)
             {
-                ESP_LOGI(TAG, "Unknown audio format, first 4 bytes: %02X %02X %02X %02X",
-                         (unsigned char)buffer[0], (unsigned char)buffer[1],
-                         (unsigned char)buffer[2], (unsigned char)buffer[3]);
+                continue;
             }
+            resume_count_++;
         }
 
-        // 创建音频数据块
-        uint8_t *chunk_data = (uint8_t *)heap_caps_malloc(bytes_read, MALLOC_CAP_SPIRAM);
-        if (!chunk_data)
+        auto http = OpenAudioStream(music_url, offset);
+        if (!http)
         {
-            ESP_LOGE(TAG, "Failed to allocate memory for audio chunk");
-            break;
+            attempts++;
+            continue;
         }
-        memcpy(chunk_data, buffer, bytes_read);
 
-        // 等待缓冲区有空间
+        while (is_downloading_ && is_playing_ && !seek_requested_)
         {
-            std::unique_lock<std::mutex> lock(buffer_mutex_);
-            buffer_cv_.wait(lock, [this]
-                            { return buffer_size_ < MAX_BUFFER_SIZE || !is_downloading_; });
-
-            if (is_downloading_)
+            uint8_t *write_ptr = nullptr;
+            size_t writable = stream_buffer_.WaitWritable(&write_ptr);
+            if (writable == 0)
             {
-                audio_buffer_.push(AudioChunk(chunk_data, bytes_read));
-                buffer_size_ += bytes_read;
-                total_downloaded += bytes_read;
+                // 缓冲区已关闭，停止下载
+                finished = true;
+                break;
+            }
 
-                // 通知播放线程有新数据
-                buffer_cv_.notify_one();
+            int bytes_read = http->Read(reinterpret_cast<char *>(write_ptr), std::min(writable, chunk_size));
+            if (bytes_read < 0)
+            {
+                ESP_LOGE(TAG, "Failed to read audio data at offset %d: error code %d", offset, bytes_read);
+                attempts++;
+                break;
+            }
+            if (bytes_read == 0)
+            {
+                // 已知文件长度时，提前结束的连接视为网络错误
+                if (content_length_ > 0 && offset < content_length_)
+                {
+                    ESP_LOGW(TAG, "Audio stream closed early at %d of %d bytes", offset, content_length_.load());
+                    attempts++;
+                    break;
+                }
+                ESP_LOGI(TAG, "Audio stream download completed, total: %d bytes", offset);
+                finished = true;
+                completed = true;
+                break;
+            }
 
-                if (total_downloaded % (256 * 1024) == 0)
-                { // 每256KB打印一次进度
-                    ESP_LOGI(TAG, "Downloaded %d bytes, buffer size: %d", total_downloaded, buffer_size_);
+            // 尝试检测文件格式（检查文件头）
+            if (offset == 0 && bytes_read >= 4)
+            {
+                if (memcmp(write_ptr, "ID3", 3) == 0)
+                {
+                    ESP_LOGI(TAG, "Detected MP3 file with ID3 tag");
+                }
+                else if (write_ptr[0] == 0xFF && (write_ptr[1] & 0xE0) == 0xE0)
+                {
+                    ESP_LOGI(TAG, "Detected MP3 file header");
+                }
+                else if (memcmp(write_ptr, "RIFF", 4) == 0)
+                {
+                    ESP_LOGI(TAG, "Detected WAV file");
+                }
+                else if (memcmp(write_ptr, "fLaC", 4) == 0)
+                {
+                    ESP_LOGI(TAG, "Detected FLAC file");
+                }
+                else if (memcmp(write_ptr, "OggS", 4) == 0)
+                {
+                    ESP_LOGI(TAG, "Detected OGG file");
+                }
+                else
+                {
+                    ESP_LOGI(TAG, "Unknown audio format, first 4 bytes: %02X %02X %02X %02X",
+                             write_ptr[0], write_ptr[1], write_ptr[2], write_ptr[3]);
                 }
             }
-            else
+
+            // 先写入缓存再提交，提交后数据可能很快被解码线程消费
+            if (caching && !cache_.Write(write_ptr, bytes_read))
             {
-                heap_caps_free(chunk_data);
-                break;
+                caching = false;
+            }
+
+            // 提交写入的数据，唤醒播放线程
+            stream_buffer_.Commit(bytes_read);
+            attempts = 0;
+            size_t previous_offset = offset;
+            offset += bytes_read;
+
+            if (offset / (256 * 1024) != previous_offset / (256 * 1024))
+            { // 每256KB打印一次进度和缓冲区水位
+                auto stats = stream_buffer_.statistics();
+                ESP_LOGI(TAG, "Downloaded %d bytes, buffer: %d/%d bytes (%d%%)", offset,
+                         stats.size, stats.capacity, (int)(stats.size * 100 / stats.capacity));
             }
         }
+
+        http->Close();
+        if (finished)
+        {
+            finish_download();
+        }
     }
 
-    http->Close();
-    is_downloading_ = false;
+    // 播放停止时下载可能仍在进行
+    if (!finished)
+    {
+        finish_download();
+    }
+    ESP_LOGI(TAG, "Audio stream download thread exited");
+}
 
-    // 通知播放线程下载完成
+// 从缓存文件读取音频数据，代替网络下载
+void Esp32Music::ReadCachedStream(const std::string &path, size_t start_offset)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        ESP_LOGE(TAG, "Failed to open cached song: %s", path.c_str());
+    }
+    else
     {
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
-        buffer_cv_.notify_all();
+        fseek(file, 0, SEEK_END);
+        content_length_ = ftell(file);
+        fseek(file, start_offset, SEEK_SET);
     }
 
-    ESP_LOGI(TAG, "Audio stream download thread finished");
+    // 读完后同下载线程一样等待跳转请求，直到播放结束
+    size_t total_read = 0;
+    bool finished = file == nullptr;
+    if (finished)
+    {
+        is_downloading_ = false;
+        stream_buffer_.Finish();
+    }
+    while (file != nullptr && is_playing_)
+    {
+        if (seek_requested_.exchange(false))
+        {
+            fseek(file, seek_offset_, SEEK_SET);
+            finished = false;
+            is_downloading_ = true;
+            stream_buffer_.Flush();
+            ESP_LOGI(TAG, "Seek: reading cached song from offset %d", seek_offset_.load());
+        }
+        if (finished || !is_downloading_)
+        {
+            vTaskDelay(pdMS_TO_TICKS(MUSIC_SEEK_POLL_INTERVAL_MS));
+            continue;
+        }
+
+        uint8_t *write_ptr = nullptr;
+        size_t writable = stream_buffer_.WaitWritable(&write_ptr);
+        size_t bytes_read = 0;
+        if (writable > 0 && !seek_requested_)
+        {
+            bytes_read = fread(write_ptr, 1, std::min(writable, (size_t)(16 * 1024)), file);
+            stream_buffer_.Commit(bytes_read);
+            total_read += bytes_read;
+        }
+        if (writable == 0 || (bytes_read == 0 && !seek_requested_))
+        {
+            finished = true;
+            is_downloading_ = false;
+            stream_buffer_.Finish();
+        }
+    }
+    if (file != nullptr)
+    {
+        fclose(file);
+        if (!finished)
+        {
+            is_downloading_ = false;
+            stream_buffer_.Finish();
+        }
+    }
+    cache_.RecordBytesSaved(total_read);
+    ESP_LOGI(TAG, "Cached song read finished, %d bytes from offset %d", total_read, start_offset);
 }
 
 // 流式播放音频数据
@@ -815,15 +1039,18 @@ void Esp32Music::PlayAudioStream()
 {
     ESP_LOGI(TAG, "Starting audio stream playback");
 
-    // 初始化时间跟踪变量
-    current_play_time_ms_ = 0;
+    // 初始化时间跟踪变量，跳转后从跳转位置开始计时
+    current_play_time_ms_ = stream_start_time_ms_;
     last_frame_time_ms_ = 0;
     total_frames_decoded_ = 0;
+    // 跳转后歌词时间轴按新的位置重新查找
+    ScheduleLyricUpdate(0);
 
     auto codec = Board::GetInstance().GetAudioCodec();
-    if (!codec || !codec->output_enabled())
+    // 输出由音频服务的输出任务按需开启，这里只检查编解码器是否存在
+    if (!codec)
     {
-        ESP_LOGE(TAG, "Audio codec not available or not enabled");
+        ESP_LOGE(TAG, "Audio codec not available");
         is_playing_ = false;
         return;
     }
@@ -835,75 +1062,38 @@ void Esp32Music::PlayAudioStream()
         return;
     }
 
-    // 记录原始采样率，用于播放结束后恢复
-    int original_sample_rate = codec->output_sample_rate();
-    ESP_LOGI(TAG, "Original audio codec sample rate: %d Hz", original_sample_rate);
-
-    // 等待缓冲区有足够数据开始播放
+    // 等待缓冲区有足够数据开始播放，根据采样率动态调整缓冲区大小要求
+    size_t min_buffer_size = MIN_BUFFER_SIZE;
+    if (codec->output_sample_rate() >= 48000) {
+        min_buffer_size = MIN_BUFFER_SIZE_HIGH;
+        ESP_LOGI(TAG, "High sample rate detected, using larger buffer: %d bytes", min_buffer_size);
+    }
+    if (!stream_buffer_.WaitFill(min_buffer_size))
     {
-        std::unique_lock<std::mutex> lock(buffer_mutex_);
-        // 根据采样率动态调整缓冲区大小要求
-        auto codec = Board::GetInstance().GetAudioCodec();
-        size_t min_buffer_size = MIN_BUFFER_SIZE;
-        if (codec && codec->output_sample_rate() >= 48000) {
-            min_buffer_size = MIN_BUFFER_SIZE_HIGH;
-            ESP_LOGI(TAG, "High sample rate detected, using larger buffer: %d bytes", min_buffer_size);
-        }
-        
-        buffer_cv_.wait(lock, [this, min_buffer_size]
-                        { return buffer_size_ >= min_buffer_size || (!is_downloading_ && !audio_buffer_.empty()); });
+        ESP_LOGW(TAG, "Music stream stopped before playback started");
+        is_playing_ = false;
+        return;
     }
 
-    ESP_LOGI(TAG, "Starting playback with buffer size: %d", buffer_size_);
+    ESP_LOGI(TAG, "Starting playback with buffer size: %d", stream_buffer_.size());
 
     size_t total_played = 0;
-    uint8_t *mp3_input_buffer = nullptr;
-    int bytes_left = 0;
-    uint8_t *read_ptr = nullptr;
 
-    // 分配MP3输入缓冲区
-    mp3_input_buffer = (uint8_t *)heap_caps_malloc(8192, MALLOC_CAP_SPIRAM);
-    if (!mp3_input_buffer)
-    {
-        ESP_LOGE(TAG, "Failed to allocate MP3 input buffer");
-        is_playing_ = false;
-        return;
-    }
+    // 标记是否已经处理过ID3标签，以及标签中尚未跳过的字节数；从文件中间开始时没有标签
+    bool id3_processed = stream_start_offset_ > 0;
+    size_t id3_remaining = 0;
+    // 用于估算跳转位置的平均码率
+    int64_t bitrate_sum = 0;
+    int bitrate_frames = 0;
 
-    // 标记是否已经处理过ID3标签
-    bool id3_processed = false;
+    // 解码缓冲区只分配一次，按最大帧长分配
+    pcm_buffer_.resize(MP3_MAX_FRAME_SAMPLES);
+    int64_t next_statistics_time_ms = 10000;
 
+    auto &app = Application::GetInstance();
     while (is_playing_)
     {
-        // 检查设备状态，只有在空闲状态才播放音乐
-        auto &app = Application::GetInstance();
-        DeviceState current_state = app.GetDeviceState();
-
-        // 状态转换：说话中-》聆听中-》待机状态-》播放音乐
-        if (current_state == kDeviceStateListening || current_state == kDeviceStateSpeaking)
-        {
-            if (current_state == kDeviceStateSpeaking)
-            {
-                ESP_LOGI(TAG, "Device is in speaking state, switching to listening state for music playback");
-            }
-            if (current_state == kDeviceStateListening)
-            {
-                ESP_LOGI(TAG, "Device is in listening state, switching to idle state for music playback");
-            }
-            // 切换状态
-            app.ToggleChatState(); // 变成待机状态
-            vTaskDelay(pdMS_TO_TICKS(300));
-            continue;
-        }
-        else if (current_state != kDeviceStateIdle)
-        { // 不是待机状态，就一直卡在这里，不让播放音乐
-            ESP_LOGD(TAG, "Device state is %d, pausing music playback", current_state);
-            // 如果不是空闲状态，暂停播放
-            vTaskDelay(pdMS_TO_TICKS(50));
-            continue;
-        }
-
-        // 设备状态检查通过，显示当前播放的歌名
+        // 显示当前播放的歌名
         if (!song_name_displayed_ && !current_song_name_.empty())
         {
             auto &board = Board::GetInstance();
@@ -922,6 +1112,7 @@ void Esp32Music::PlayAudioStream()
             {
                 if (display_mode_ == DISPLAY_MODE_SPECTRUM)
                 {
+                    spectrum_.Start();
                     display->start();
                     ESP_LOGI(TAG, "Display start() called for spectrum visualization");
                 }
@@ -932,81 +1123,59 @@ void Esp32Music::PlayAudioStream()
             }
         }
 
-        // 如果需要更多MP3数据，从缓冲区读取
-        if (bytes_left < 4096)
-        { // 保持至少4KB数据用于解码
-            AudioChunk chunk;
+        // 直接在环形缓冲区中解码，跨越缓冲区末尾的数据由缓冲区拼接成连续内存
+        uint8_t *read_ptr = nullptr;
+        size_t available = stream_buffer_.Peek(&read_ptr, MP3_INPUT_WINDOW_SIZE);
+        if (available == 0)
+        {
+            // 下载完成且缓冲区为空（或已停止），播放结束
+            ESP_LOGI(TAG, "Playback finished, total played: %d bytes", total_played);
+            break;
+        }
 
-            // 从缓冲区获取音频数据
+        // 跳转后缓冲区从新的位置开始：解码器中残留的旧帧数据（比特池）必须丢弃，否则第一帧会解出杂音
+        if (stream_buffer_.TakeDiscontinuity())
+        {
+            CleanupMp3Decoder();
+            if (!InitializeMp3Decoder())
             {
-                std::unique_lock<std::mutex> lock(buffer_mutex_);
-                if (audio_buffer_.empty())
-                {
-                    if (!is_downloading_)
-                    {
-                        // 下载完成且缓冲区为空，播放结束
-                        ESP_LOGI(TAG, "Playback finished, total played: %d bytes", total_played);
-                        break;
-                    }
-                    // 等待新数据
-                    buffer_cv_.wait(lock, [this]
-                                    { return !audio_buffer_.empty() || !is_downloading_; });
-                    if (audio_buffer_.empty())
-                    {
-                        continue;
-                    }
-                }
-
-                chunk = audio_buffer_.front();
-                audio_buffer_.pop();
-                buffer_size_ -= chunk.size;
-
-                // 通知下载线程缓冲区有空间
-                buffer_cv_.notify_one();
+                break;
             }
+            id3_processed = true;
+            id3_remaining = 0;
+            current_play_time_ms_ = seek_time_ms_.load();
+            // 解码线程是混音器音乐流唯一的写入者，在这里清空才能保证不再播放旧位置的音频
+            app.GetAudioService().ClearMixerStream(kAudioMixerStreamMusic);
+            app.ResetMusicResampler();
+            ScheduleLyricUpdate(0);
+            ESP_LOGI(TAG, "Seeked to %lldms", current_play_time_ms_.load());
+        }
 
-            // 将新数据添加到MP3输入缓冲区
-            if (chunk.data && chunk.size > 0)
-            {
-                // 移动剩余数据到缓冲区开头
-                if (bytes_left > 0 && read_ptr != mp3_input_buffer)
-                {
-                    memmove(mp3_input_buffer, read_ptr, bytes_left);
-                }
-
-                // 检查缓冲区空间
-                size_t space_available = 8192 - bytes_left;
-                size_t copy_size = std::min(chunk.size, space_available);
-
-                // 复制新数据
-                memcpy(mp3_input_buffer + bytes_left, chunk.data, copy_size);
-                bytes_left += copy_size;
-                read_ptr = mp3_input_buffer;
-
-                // 检查并跳过ID3标签（仅在开始时处理一次）
-                if (!id3_processed && bytes_left >= 10)
-                {
-                    size_t id3_skip = SkipId3Tag(read_ptr, bytes_left);
-                    if (id3_skip > 0)
-                    {
-                        read_ptr += id3_skip;
-                        bytes_left -= id3_skip;
-                        ESP_LOGI(TAG, "Skipped ID3 tag: %u bytes", (unsigned int)id3_skip);
-                    }
-                    id3_processed = true;
-                }
-
-                // 释放chunk内存
-                heap_caps_free(chunk.data);
-            }
+        // 检查并跳过ID3标签（仅在开始时处理一次），标签可能比解码窗口大，分段丢弃
+        if (!id3_processed)
+        {
+            id3_processed = true;
+            id3_remaining = SkipId3Tag(read_ptr, available);
+            audio_data_offset_ = id3_remaining;
+        }
+        if (id3_remaining > 0)
+        {
+            size_t skip = std::min(id3_remaining, available);
+            stream_buffer_.Consume(skip);
+            id3_remaining -= skip;
+            continue;
         }
 
+        int bytes_left = available;
+
         // 尝试找到MP3帧同步
         int sync_offset = MP3FindSyncWord(read_ptr, bytes_left);
         if (sync_offset < 0)
         {
-            ESP_LOGW(TAG, "No MP3 sync word found, skipping %d bytes", bytes_left);
-            bytes_left = 0;
+            // 保留末尾3字节，同步字可能跨越窗口边界
+            size_t skip = available > 3 ? available - 3 : available;
+            ESP_LOGW(TAG, "No MP3 sync word found, skipping %d bytes", skip);
+            stream_buffer_.Consume(skip);
             continue;
         }
 
@@ -1018,14 +1187,23 @@ void Esp32Music::PlayAudioStream()
         }
 
         // 解码MP3帧
-        int16_t pcm_buffer[2304];
+        int16_t *pcm_buffer = pcm_buffer_.data();
+        int64_t decode_start_time = esp_timer_get_time();
         int decode_result = MP3Decode(mp3_decoder_, &read_ptr, &bytes_left, pcm_buffer, 0);
+        // 解码器推进了read_ptr，把已解码的数据从环形缓冲区移除
+        stream_buffer_.Consume(available - bytes_left);
 
         if (decode_result == 0)
         {
             // 解码成功，获取帧信息
             MP3GetLastFrameInfo(mp3_decoder_, &mp3_frame_info_);
             total_frames_decoded_++;
+            if (mp3_frame_info_.bitrate > 0)
+            {
+                bitrate_sum += mp3_frame_info_.bitrate;
+                bitrate_frames++;
+                average_bitrate_ = bitrate_sum / bitrate_frames;
+            }
 
             // 基本的帧信息有效性检查，防止除零错误
             if (mp3_frame_info_.samprate == 0 || mp3_frame_info_.nChans == 0)
@@ -1043,88 +1221,41 @@ void Esp32Music::PlayAudioStream()
             current_play_time_ms_ += frame_duration_ms;
 
             ESP_LOGD(TAG, "Frame %d: time=%lldms, duration=%dms, rate=%d, ch=%d",
-                     total_frames_decoded_, current_play_time_ms_, frame_duration_ms,
+                     total_frames_decoded_, current_play_time_ms_.load(), frame_duration_ms,
                      mp3_frame_info_.samprate, mp3_frame_info_.nChans);
 
-            // 更新歌词显示
-            int buffer_latency_ms = 600; // 实测调整值
-            UpdateLyricDisplay(current_play_time_ms_ + buffer_latency_ms);
-
-            // 将PCM数据发送到Application的音频解码队列
+            // 将PCM数据写入混音器的音乐缓冲区
             if (mp3_frame_info_.outputSamps > 0)
             {
-                int16_t *final_pcm_data = pcm_buffer;
                 int final_sample_count = mp3_frame_info_.outputSamps;
-                std::vector<int16_t> mono_buffer;
 
-                // 如果是双通道，转换为单通道混合
+                // 如果是双通道，在解码缓冲区中原地混合为单声道 (L + R) / 2
                 if (mp3_frame_info_.nChans == 2)
                 {
-                    // 双通道转单通道：将左右声道混合
-                    int stereo_samples = mp3_frame_info_.outputSamps; // 包含左右声道的总样本数
-                    int mono_samples = stereo_samples / 2;            // 实际的单声道样本数
-
-                    mono_buffer.resize(mono_samples);
-
-                    for (int i = 0; i < mono_samples; ++i)
-                    {
-                        // 混合左右声道 (L + R) / 2
-                        int left = pcm_buffer[i * 2];      // 左声道
-                        int right = pcm_buffer[i * 2 + 1]; // 右声道
-                        mono_buffer[i] = (int16_t)((left + right) / 2);
-                    }
-
-                    final_pcm_data = mono_buffer.data();
-                    final_sample_count = mono_samples;
-
-                    ESP_LOGD(TAG, "Converted stereo to mono: %d -> %d samples",
-                             stereo_samples, mono_samples);
+                    final_sample_count = mp3_frame_info_.outputSamps / 2;
+                    SampleConversion::StereoToMono(pcm_buffer, pcm_buffer, final_sample_count);
                 }
-                else if (mp3_frame_info_.nChans == 1)
-                {
-                    // 已经是单声道，无需转换
-                    ESP_LOGD(TAG, "Already mono audio: %d samples", final_sample_count);
-                }
-                else
+                else if (mp3_frame_info_.nChans != 1)
                 {
                     ESP_LOGW(TAG, "Unsupported channel count: %d, treating as mono",
                              mp3_frame_info_.nChans);
                 }
+                decode_time_.Record(esp_timer_get_time() - decode_start_time);
 
-                // 创建AudioStreamPacket
-                AudioStreamPacket packet;
-                packet.sample_rate = mp3_frame_info_.samprate;
-                packet.frame_duration = 60; // 使用Application默认的帧时长
-                packet.timestamp = 0;
+                // 频谱分析只在频谱模式下运行，未运行时Feed直接返回
+                spectrum_.Feed(pcm_buffer, final_sample_count, mp3_frame_info_.samprate);
 
-                // 将int16_t PCM数据转换为uint8_t字节数组
-                size_t pcm_size_bytes = final_sample_count * sizeof(int16_t);
-                packet.payload.resize(pcm_size_bytes);
-                memcpy(packet.payload.data(), final_pcm_data, pcm_size_bytes);
+                // 重采样后写入混音器，缓冲区满时阻塞；停止播放时混音器被清空，写入随即返回
+                int64_t output_start_time = esp_timer_get_time();
+                app.AddAudioData(pcm_buffer, final_sample_count, mp3_frame_info_.samprate);
+                output_time_.Record(esp_timer_get_time() - output_start_time);
+                total_played += final_sample_count * sizeof(int16_t);
 
-                if (final_pcm_data_fft == nullptr)
+                // 每播放10秒打印一次各阶段统计
+                if (current_play_time_ms_ >= next_statistics_time_ms)
                 {
-                    final_pcm_data_fft = (int16_t *)heap_caps_malloc(
-                        final_sample_count * sizeof(int16_t),
-                        MALLOC_CAP_SPIRAM);
-                }
-
-                memcpy(
-                    final_pcm_data_fft,
-                    final_pcm_data,
-                    final_sample_count * sizeof(int16_t));
-
-                ESP_LOGD(TAG, "Sending %d PCM samples (%d bytes, rate=%d, channels=%d->1) to Application",
-                         final_sample_count, pcm_size_bytes, mp3_frame_info_.samprate, mp3_frame_info_.nChans);
-
-                // 发送到Application的音频解码队列
-                app.AddAudioData(std::move(packet));
-                total_played += pcm_size_bytes;
-
-                // 打印播放进度
-                if (total_played % (128 * 1024) == 0)
-                {
-                    ESP_LOGI(TAG, "Played %d bytes, buffer size: %d", total_played, buffer_size_);
+                    next_statistics_time_ms += 10000;
+                    LogPipelineStatistics();
                 }
             }
         }
@@ -1136,45 +1267,30 @@ void Esp32Music::PlayAudioStream()
             // 跳过一些字节继续尝试
             if (bytes_left > 1)
             {
-                read_ptr++;
-                bytes_left--;
+                stream_buffer_.Consume(1);
             }
             else
             {
-                bytes_left = 0;
+                stream_buffer_.Consume(bytes_left);
             }
         }
     }
 
-    // 清理
-    if (mp3_input_buffer)
-    {
-        heap_caps_free(mp3_input_buffer);
-    }
+    // 音乐数据已全部写入，混音器中剩余的部分播放完不算欠载
+    app.GetAudioService().FinishMixerStream(kAudioMixerStreamMusic);
+
+    // 报告各阶段统计，便于调整缓冲区大小
+    LogPipelineStatistics();
 
     // 播放结束时进行基本清理，但不调用StopStreaming避免线程自我等待
     ESP_LOGI(TAG, "Audio stream playback finished, total played: %d bytes", total_played);
     ESP_LOGI(TAG, "Performing basic cleanup from play thread");
 
-    // 恢复音频编解码器的原始采样率
-    if (codec && codec->output_sample_rate() != original_sample_rate)
-    {
-        ESP_LOGI(TAG, "Restoring audio codec sample rate from %d to %d Hz", 
-                 codec->output_sample_rate(), original_sample_rate);
-        if (codec->SetOutputSampleRate(original_sample_rate))
-        {
-            ESP_LOGI(TAG, "Successfully restored original sample rate: %d Hz", original_sample_rate);
-        }
-        else
-        {
-            ESP_LOGW(TAG, "Failed to restore original sample rate");
-        }
-    }
-
     // 停止播放标志
     is_playing_ = false;
 
     // 只在频谱显示模式下才停止FFT显示
+    spectrum_.Stop();
     if (display_mode_ == DISPLAY_MODE_SPECTRUM)
     {
         auto &board = Board::GetInstance();
@@ -1190,56 +1306,43 @@ void Esp32Music::PlayAudioStream()
         ESP_LOGI(TAG, "Not in spectrum mode, skipping FFT stop");
     }
 
-    // 播放结束后重新启动聆听模式
-    auto &app = Application::GetInstance();
-    ESP_LOGI(TAG, "Restarting listening mode after music playback");
-    
-    // 检查当前状态，如果正在TTS播报，等待播报完成后再启动聆听
-    DeviceState current_state = app.GetDeviceState();
-    if (current_state == kDeviceStateSpeaking) {
-        ESP_LOGI(TAG, "TTS is speaking, waiting for completion...");
-        int wait_count = 0;
-        while (app.GetDeviceState() == kDeviceStateSpeaking && wait_count < 100) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            wait_count++;
-        }
-        if (wait_count >= 100) {
-            ESP_LOGW(TAG, "TTS took too long, forcing listening mode restart");
-        } else {
-            ESP_LOGI(TAG, "TTS completed, now restarting listening mode");
-        }
+    // 播放结束后重新启动聆听模式；对话进行中（TTS与音乐已由混音器同时播放）则无需切换状态
+    if (app.GetDeviceState() == kDeviceStateIdle)
+    {
+        ESP_LOGI(TAG, "Starting listening mode after music playback");
+        app.StartListening();
     }
-    
-    // 使用更可靠的方法重启聆听模式
-    // 先确保设备处于idle状态
-    if (app.GetDeviceState() != kDeviceStateIdle) {
-        ESP_LOGI(TAG, "Device is not in idle state, forcing to idle");
-        app.ToggleChatState(); // 切换到idle状态
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-    }
-    
-    // 重新启动聆听模式，使用自动停止模式
-    ESP_LOGI(TAG, "Starting listening mode with auto-stop mode");
-    app.StartListening();
 }
 
-// 清空音频缓冲区
-void Esp32Music::ClearAudioBuffer()
+// 打印流水线各阶段的统计：下载 -> 解码 -> 输出
+void Esp32Music::LogPipelineStatistics()
 {
-    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    auto stats = stream_buffer_.statistics();
+    ESP_LOGI(TAG, "Stream buffer: capacity %d bytes, lowest fill %d bytes, underruns %lu, resumed %lu times",
+             stats.capacity, stats.low_water_mark, stats.underruns, resume_count_.load());
+
+    char buffer[128];
+    decode_time_.Format(buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "Decode time: %s", buffer);
+    output_time_.Format(buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "Output time (resample + mixer wait): %s", buffer);
 
-    while (!audio_buffer_.empty())
+    auto mixer = Application::GetInstance().GetAudioService().GetMixerStatistics(kAudioMixerStreamMusic);
+    ESP_LOGI(TAG, "Mixer music buffer: underruns %lu, starved %lldms", mixer.underruns, mixer.starved_us / 1000);
+
+    if (spectrum_.analyze_time().count() > 0)
     {
-        AudioChunk chunk = audio_buffer_.front();
-        audio_buffer_.pop();
-        if (chunk.data)
-        {
-            heap_caps_free(chunk.data);
-        }
+        spectrum_.analyze_time().Format(buffer, sizeof(buffer));
+        ESP_LOGI(TAG, "Spectrum analyse time: %s", buffer);
     }
 
-    buffer_size_ = 0;
-    ESP_LOGI(TAG, "Audio buffer cleared");
+    auto cache = cache_.statistics();
+    if (cache.lookups > 0)
+    {
+        ESP_LOGI(TAG, "Music cache: hits %lu of %lu (%lu%%), saved %llu bytes, stored %lu evicted %lu, used %u of %u bytes",
+                 cache.hits, cache.lookups, cache.hits * 100 / cache.lookups, cache.bytes_saved,
+                 cache.stores, cache.evictions, cache.bytes_used, cache.budget);
+    }
 }
 
 // 初始化MP3解码器
@@ -1270,27 +1373,6 @@ void Esp32Music::CleanupMp3Decoder()
     ESP_LOGI(TAG, "MP3 decoder cleaned up");
 }
 
-// 重置采样率到原始值
-void Esp32Music::ResetSampleRate()
-{
-    auto &board = Board::GetInstance();
-    auto codec = board.GetAudioCodec();
-    if (codec && codec->original_output_sample_rate() > 0 &&
-        codec->output_sample_rate() != codec->original_output_sample_rate())
-    {
-        ESP_LOGI(TAG, "重置采样率：从 %d Hz 重置到原始值 %d Hz",
-                 codec->output_sample_rate(), codec->original_output_sample_rate());
-        if (codec->SetOutputSampleRate(-1))
-        { // -1 表示重置到原始值
-            ESP_LOGI(TAG, "成功重置采样率到原始值: %d Hz", codec->output_sample_rate());
-        }
-        else
-        {
-            ESP_LOGW(TAG, "无法重置采样率到原始值");
-        }
-    }
-}
-
 // 跳过MP3文件开头的ID3标签
 size_t Esp32Music::SkipId3Tag(uint8_t *data, size_t size)
 {
@@ -1314,17 +1396,43 @@ size_t Esp32Music::SkipId3Tag(uint8_t *data, size_t size)
     // ID3v2头部(10字节) + 标签内容
     size_t total_skip = 10 + tag_size;
 
-    // 确保不超过可用数据大小
-    if (total_skip > size)
-    {
-        total_skip = size;
-    }
-
     ESP_LOGI(TAG, "Found ID3v2 tag, skipping %u bytes", (unsigned int)total_skip);
     return total_skip;
 }
 
 // 下载歌词
+// 根据显示模式决定是否启动歌词，歌词优先从缓存读取
+void Esp32Music::StartLyrics()
+{
+    // 等待上一首歌的加载线程，线程已自行结束时也需要join
+    if (lyric_thread_.joinable())
+    {
+        lyric_thread_.join();
+    }
+    // 用空的时间轴替换上一首歌的歌词
+    PublishLyrics(new LyricTimeline());
+
+    if (display_mode_ != DISPLAY_MODE_LYRICS)
+    {
+        ESP_LOGI(TAG, "Spectrum display mode is active, skipping lyrics");
+        return;
+    }
+    ESP_LOGI(TAG, "Loading lyrics for: %s (lyrics display mode)", current_song_name_.c_str());
+
+    lyric_thread_ = std::thread(&Esp32Music::LoadLyricsThread, this);
+}
+
+bool Esp32Music::LoadCachedLyrics()
+{
+    std::string lyric_content;
+    if (cache_key_.empty() || !cache_.LoadLyrics(cache_key_, lyric_content))
+    {
+        return false;
+    }
+    ESP_LOGI(TAG, "Loaded lyrics from the music cache, %d bytes", lyric_content.length());
+    return ParseLyrics(lyric_content);
+}
+
 bool Esp32Music::DownloadLyrics(const std::string &lyric_url)
 {
     ESP_LOGI(TAG, "Downloading lyrics from: %s", lyric_url.c_str());
@@ -1492,198 +1600,111 @@ bool Esp32Music::DownloadLyrics(const std::string &lyric_url)
     }
 
     ESP_LOGI(TAG, "Lyrics downloaded successfully, size: %d bytes", lyric_content.length());
-    return ParseLyrics(lyric_content);
+    if (!ParseLyrics(lyric_content))
+    {
+        return false;
+    }
+    // 解析成功后保存到缓存，下次播放这首歌时不再下载
+    if (!cache_key_.empty())
+    {
+        cache_.StoreLyrics(cache_key_, lyric_content);
+    }
+    return true;
 }
 
-// 解析歌词
+// 解析歌词，一次遍历生成按时间排序的时间轴
 bool Esp32Music::ParseLyrics(const std::string &lyric_content)
 {
-    ESP_LOGI(TAG, "Parsing lyrics content");
-
-    // 使用锁保护lyrics_数组访问
-    std::lock_guard<std::mutex> lock(lyrics_mutex_);
-
-    lyrics_.clear();
-
-    // 按行分割歌词内容
-    std::istringstream stream(lyric_content);
-    std::string line;
-
-    while (std::getline(stream, line))
+    int64_t start_time = esp_timer_get_time();
+    auto lyrics = new LyricTimeline();
+    if (!lyrics->Parse(lyric_content))
     {
-        // 去除行尾的回车符
-        if (!line.empty() && line.back() == '\r')
-        {
-            line.pop_back();
-        }
-
-        // 跳过空行
-        if (line.empty())
-        {
-            continue;
-        }
-
-        // 解析LRC格式: [mm:ss.xx]歌词文本
-        if (line.length() > 10 && line[0] == '[')
-        {
-            size_t close_bracket = line.find(']');
-            if (close_bracket != std::string::npos)
-            {
-                std::string tag_or_time = line.substr(1, close_bracket - 1);
-                std::string content = line.substr(close_bracket + 1);
-
-                // 检查是否是元数据标签而不是时间戳
-                // 元数据标签通常是 [ti:标题], [ar:艺术家], [al:专辑] 等
-                size_t colon_pos = tag_or_time.find(':');
-                if (colon_pos != std::string::npos)
-                {
-                    std::string left_part = tag_or_time.substr(0, colon_pos);
-
-                    // 检查冒号左边是否是时间（数字）
-                    bool is_time_format = true;
-                    for (char c : left_part)
-                    {
-                        if (!isdigit(c))
-                        {
-                            is_time_format = false;
-                            break;
-                        }
-                    }
-
-                    // 如果不是时间格式，跳过这一行（元数据标签）
-                    if (!is_time_format)
-                    {
-                        // 可以在这里处理元数据，例如提取标题、艺术家等信息
-                        ESP_LOGD(TAG, "Skipping metadata tag: [%s]", tag_or_time.c_str());
-                        continue;
-                    }
-
-                    // 是时间格式，解析时间戳
-                    try
-                    {
-                        int minutes = std::stoi(tag_or_time.substr(0, colon_pos));
-                        float seconds = std::stof(tag_or_time.substr(colon_pos + 1));
-                        int timestamp_ms = minutes * 60 * 1000 + (int)(seconds * 1000);
-
-                        // 安全处理歌词文本，确保UTF-8编码正确
-                        std::string safe_lyric_text;
-                        if (!content.empty())
-                        {
-                            // 创建安全副本并验证字符串
-                            safe_lyric_text = content;
-                            // 确保字符串以null结尾
-                            safe_lyric_text.shrink_to_fit();
-                        }
-
-                        lyrics_.push_back(std::make_pair(timestamp_ms, safe_lyric_text));
-
-                        if (!safe_lyric_text.empty())
-                        {
-                            // 限制日志输出长度，避免中文字符截断问题
-                            size_t log_len = std::min(safe_lyric_text.length(), size_t(50));
-                            std::string log_text = safe_lyric_text.substr(0, log_len);
-                            ESP_LOGD(TAG, "Parsed lyric: [%d ms] %s", timestamp_ms, log_text.c_str());
-                        }
-                        else
-                        {
-                            ESP_LOGD(TAG, "Parsed lyric: [%d ms] (empty)", timestamp_ms);
-                        }
-                    }
-                    catch (const std::exception &e)
-                    {
-                        ESP_LOGW(TAG, "Failed to parse time: %s", tag_or_time.c_str());
-                    }
-                }
-            }
-        }
+        delete lyrics;
+        return false;
     }
 
-    // 按时间戳排序
-    std::sort(lyrics_.begin(), lyrics_.end());
-
-    ESP_LOGI(TAG, "Parsed %d lyric lines", lyrics_.size());
-    return !lyrics_.empty();
+    ESP_LOGI(TAG, "Parsed %d lyric lines in %lldus", lyrics->size(), esp_timer_get_time() - start_time);
+    PublishLyrics(lyrics);
+    return true;
 }
 
-// 歌词显示线程
-void Esp32Music::LyricDisplayThread()
+// 歌词加载线程：读取缓存或下载并解析，完成后退出，显示由歌词定时器负责
+void Esp32Music::LoadLyricsThread()
 {
-    ESP_LOGI(TAG, "Lyric display thread started");
-
-    if (!DownloadLyrics(current_lyric_url_))
+    if (LoadCachedLyrics())
     {
-        ESP_LOGE(TAG, "Failed to download or parse lyrics");
-        is_lyric_running_ = false;
         return;
     }
-
-    // 定期检查是否需要更新显示(频率可以降低)
-    while (is_lyric_running_ && is_playing_)
+    // 从缓存播放且音乐API不可用时没有歌词地址
+    if (current_lyric_url_.empty())
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ESP_LOGW(TAG, "No lyrics cached and no lyric URL for this song");
+        return;
     }
-
-    ESP_LOGI(TAG, "Lyric display thread finished");
-}
-
-void Esp32Music::UpdateLyricDisplay(int64_t current_time_ms)
-{
-    std::lock_guard<std::mutex> lock(lyrics_mutex_);
-
-    if (lyrics_.empty())
+    if (!DownloadLyrics(current_lyric_url_))
     {
-        return;
+        ESP_LOGE(TAG, "Failed to download or parse lyrics");
     }
+}
 
-    // 查找当前应该显示的歌词
-    int new_lyric_index = -1;
+// 交给定时器任务替换当前的时间轴，定时器尚未取走的旧时间轴在这里释放
+void Esp32Music::PublishLyrics(LyricTimeline *lyrics)
+{
+    delete pending_lyrics_.exchange(lyrics);
+    ScheduleLyricUpdate(0);
+}
 
-    // 从当前歌词索引开始查找，提高效率
-    int start_index = (current_lyric_index_.load() >= 0) ? current_lyric_index_.load() : 0;
+void Esp32Music::ScheduleLyricUpdate(int64_t delay_ms)
+{
+    delay_ms = std::max<int64_t>(delay_ms, MUSIC_LYRIC_MIN_INTERVAL_MS);
+    esp_timer_stop(lyric_timer_);
+    esp_timer_start_once(lyric_timer_, delay_ms * 1000);
+}
 
-    // 正向查找：找到最后一个时间戳小于等于当前时间的歌词
-    for (int i = start_index; i < (int)lyrics_.size(); i++)
+// 在定时器任务中运行：二分查找当前歌词，并把定时器设到下一句歌词的时间
+void Esp32Music::OnLyricTimer()
+{
+    LyricTimeline *pending = pending_lyrics_.exchange(nullptr);
+    if (pending != nullptr)
     {
-        if (lyrics_[i].first <= current_time_ms)
-        {
-            new_lyric_index = i;
-        }
-        else
-        {
-            break; // 时间戳已超过当前时间
-        }
+        lyrics_.reset(pending);
+        current_lyric_index_ = -1;
     }
-
-    // 如果没有找到(可能当前时间比第一句歌词还早)，显示空
-    if (new_lyric_index == -1)
+    // 停止播放后不再更新，下次播放开始时重新设定
+    if (!lyrics_ || lyrics_->empty() || !is_playing_)
     {
-        new_lyric_index = -1;
+        return;
     }
 
-    // 如果歌词索引发生变化，更新显示
-    if (new_lyric_index != current_lyric_index_)
+    // 解码时间领先于扬声器：混音器中还缓冲着尚未播放的音乐
+    int buffered_ms = Application::GetInstance().GetAudioService().GetMixerBufferedMs(kAudioMixerStreamMusic);
+    int64_t position_ms = current_play_time_ms_ - buffered_ms + MUSIC_LYRIC_LATENCY_MS;
+    int index = lyrics_->Find(position_ms);
+    if (index != current_lyric_index_)
     {
-        current_lyric_index_ = new_lyric_index;
+        current_lyric_index_ = index;
 
-        auto &board = Board::GetInstance();
-        auto display = board.GetDisplay();
-        if (display)
+        // 显示在主任务中更新，定时器任务的栈较小
+        if (display_mode_ == DISPLAY_MODE_LYRICS)
         {
-            std::string lyric_text;
-
-            if (current_lyric_index_ >= 0 && current_lyric_index_ < (int)lyrics_.size())
+            std::string lyric_text = index >= 0 ? lyrics_->text(index) : "";
+            ESP_LOGD(TAG, "Lyric update at %lldms: %s", position_ms, lyric_text.empty() ? "(no lyric)" : lyric_text.c_str());
+            Application::GetInstance().Schedule([lyric_text = std::move(lyric_text)]()
             {
-                lyric_text = lyrics_[current_lyric_index_].second;
-            }
-
-            // 显示歌词
-            display->SetChatMessage("lyric", lyric_text.c_str());
-
-            ESP_LOGD(TAG, "Lyric update at %lldms: %s",
-                     current_time_ms,
-                     lyric_text.empty() ? "(no lyric)" : lyric_text.c_str());
+                auto display = Board::GetInstance().GetDisplay();
+                if (display)
+                {
+                    display->SetChatMessage("lyric", lyric_text.c_str());
+                }
+            });
         }
     }
+
+    // 解码时间尚未到达下一句时（例如网络卡顿），到时再次检查
+    if (index + 1 < (int)lyrics_->size())
+    {
+        ScheduleLyricUpdate(lyrics_->time_ms(index + 1) - position_ms);
+    }
 }
 
 // 显示模式控制方法实现
@@ -1695,4 +1716,27 @@ void Esp32Music::SetDisplayMode(DisplayMode mode)
     ESP_LOGI(TAG, "Display mode changed from %s to %s",
              (old_mode == DISPLAY_MODE_SPECTRUM) ? "SPECTRUM" : "LYRICS",
              (mode == DISPLAY_MODE_SPECTRUM) ? "SPECTRUM" : "LYRICS");
+
+    // 播放中切换模式时，频谱分析随之启停
+    auto display = Board::GetInstance().GetDisplay();
+    if (!is_playing_ || old_mode == mode)
+    {
+        return;
+    }
+    if (mode == DISPLAY_MODE_SPECTRUM)
+    {
+        spectrum_.Start();
+        if (display)
+        {
+            display->start();
+        }
+    }
+    else
+    {
+        spectrum_.Stop();
+        if (display)
+        {
+            display->stopFft();
+        }
+    }
 }
\ No newline at end of file
@@ -2,28 +2,37 @@
 #define ESP32_MUSIC_H
 
 #include <string>
+#include <memory>
 #include <thread>
 #include <atomic>
-#include <queue>
 #include <mutex>
-#include <condition_variable>
 #include <vector>
+#include <esp_timer.h>
 
 #include "music.h"
+#include "music_stream_buffer.h"
+#include "music_cache.h"
+#include "lyric_timeline.h"
+#include "audio/audio_timing.h"
+#include "audio/spectrum_analyzer.h"
 
 // MP3解码器支持
 extern "C" {
 #include "mp3dec.h"
 }
 
-// 音频数据块结构
-struct AudioChunk {
-    uint8_t* data;
-    size_t size;
-    
-    AudioChunk() : data(nullptr), size(0) {}
-    AudioChunk(uint8_t* d, size_t s) : data(d), size(s) {}
-};
+class Http;
+
+// 网络错误时从断开的位置重新连接的最大次数，每次重试的等待时间递增
+#define MUSIC_RESUME_MAX_ATTEMPTS 5
+#define MUSIC_RESUME_RETRY_DELAY_MS 1000
+// 下载完成后下载线程仍等待跳转请求，直到播放结束
+#define MUSIC_SEEK_POLL_INTERVAL_MS 100
+// 缓存命中时的播放地址前缀，下载线程从本地文件读取
+#define MUSIC_CACHE_URL_PREFIX "file://"
+// 歌词提前于扬声器实际播放位置显示的毫秒数（实测调整值），以及歌词定时器的最短间隔
+#define MUSIC_LYRIC_LATENCY_MS 600
+#define MUSIC_LYRIC_MIN_INTERVAL_MS 10
 
 class Esp32Music : public Music {
 public:
@@ -41,32 +50,50 @@ private:
     
     // 歌词相关
     std::string current_lyric_url_;
-    std::vector<std::pair<int, std::string>> lyrics_;  // 时间戳和歌词文本
-    std::mutex lyrics_mutex_;  // 保护lyrics_数组的互斥锁
-    std::atomic<int> current_lyric_index_;
-    std::thread lyric_thread_;
-    std::atomic<bool> is_lyric_running_;
+    // 歌词时间轴只在定时器任务中替换和读取，加载线程通过pending_lyrics_交给它
+    std::unique_ptr<LyricTimeline> lyrics_;
+    std::atomic<LyricTimeline*> pending_lyrics_{nullptr};
+    int current_lyric_index_;
+    esp_timer_handle_t lyric_timer_ = nullptr;  // 在下一句歌词的时间触发
+    std::thread lyric_thread_;                  // 加载歌词，完成后退出
     
     std::atomic<DisplayMode> display_mode_;
     std::atomic<bool> is_playing_;
     std::atomic<bool> is_downloading_;
     std::thread play_thread_;
     std::thread download_thread_;
-    int64_t current_play_time_ms_;  // 当前播放时间(毫秒)
+    std::atomic<bool> seek_requested_{false};       // 由下载线程处理：从seek_offset_重新下载并清空缓冲区
+    std::atomic<size_t> seek_offset_{0};            // 跳转目标在文件中的字节位置
+    std::atomic<int64_t> seek_time_ms_{0};          // 跳转目标的播放时间，解码线程遇到缓冲区的断点时使用
+    size_t stream_start_offset_ = 0;                // 本次下载在文件中的起始位置
+    int64_t stream_start_time_ms_ = 0;              // 起始位置对应的播放时间
+    std::atomic<size_t> content_length_{0};         // 文件总长度，未知时为0
+    std::atomic<size_t> audio_data_offset_{0};      // ID3标签之后第一帧的位置
+    std::atomic<int> average_bitrate_{0};           // 已解码帧的平均码率，用于估算跳转位置
+    std::atomic<uint32_t> resume_count_{0};         // 断点续传的次数
+
+    // 最近播放歌曲的本地缓存，按歌名和歌手索引
+    MusicCache cache_;
+    std::string cache_key_;
+    std::atomic<int64_t> current_play_time_ms_;  // 当前播放时间(毫秒)，歌词定时器读取
     int64_t last_frame_time_ms_;    // 上一帧的时间戳
     int total_frames_decoded_;      // 已解码的帧数
 
-    // 音频缓冲区
-    std::queue<AudioChunk> audio_buffer_;
-    std::mutex buffer_mutex_;
-    std::condition_variable buffer_cv_;
-    size_t buffer_size_;
+    // 音频缓冲区：PSRAM中的环形缓冲区，HTTP直接写入，MP3解码器直接读取
+    MusicStreamBuffer stream_buffer_;
     
     // 高采样率优化：增加缓冲区大小以适应48000Hz采样率
     static constexpr size_t HIGH_SAMPLE_RATE_BUFFER_SIZE = 512 * 1024;  // 512KB缓冲区
     static constexpr size_t MIN_BUFFER_SIZE_HIGH = 128 * 1024;          // 高采样率最小缓冲区
     static constexpr size_t MAX_BUFFER_SIZE = 256 * 1024;  // 256KB缓冲区（降低以减少brownout风险）
     static constexpr size_t MIN_BUFFER_SIZE = 32 * 1024;   // 32KB最小播放缓冲（降低以减少brownout风险）
+    static constexpr size_t MP3_INPUT_WINDOW_SIZE = 4096;  // 每次解码时提供给MP3解码器的连续数据（大于最大帧长）
+    static constexpr size_t MP3_MAX_FRAME_SAMPLES = 2304;  // MPEG-1 Layer III双声道一帧的最大样本数
+    
+    // 流水线：下载线程 -> stream_buffer_ -> 解码线程 -> 混音器音乐缓冲区 -> 音频输出任务
+    std::vector<int16_t> pcm_buffer_;   // 解码输出，双声道在原地混合为单声道
+    AudioTimingHistogram decode_time_;  // MP3解码 + 混合为单声道
+    AudioTimingHistogram output_time_;  // 重采样 + 写入混音器，包含缓冲区满时的等待
     
     // MP3解码器相关
     HMP3Decoder mp3_decoder_;
@@ -74,23 +101,30 @@ private:
     bool mp3_decoder_initialized_;
     
     // 私有方法
-    void DownloadAudioStream(const std::string& music_url);
+    bool RequestMusic(const std::string& song_name, const std::string& artist_name, const std::string& cached_path);
+    std::unique_ptr<Http> OpenAudioStream(const std::string& music_url, size_t start_offset);
+    void DownloadAudioStream(const std::string& music_url, size_t start_offset);
+    void ReadCachedStream(const std::string& path, size_t start_offset);
+    bool StartStreamThreads(size_t start_offset, int64_t start_time_ms);
     void PlayAudioStream();
-    void ClearAudioBuffer();
     bool InitializeMp3Decoder();
     void CleanupMp3Decoder();
-    void ResetSampleRate();  // 重置采样率到原始值
+    void LogPipelineStatistics();
     
     // 歌词相关私有方法
+    void StartLyrics();
+    bool LoadCachedLyrics();
     bool DownloadLyrics(const std::string& lyric_url);
     bool ParseLyrics(const std::string& lyric_content);
-    void LyricDisplayThread();
-    void UpdateLyricDisplay(int64_t current_time_ms);
+    void LoadLyricsThread();
+    void PublishLyrics(LyricTimeline* lyrics);
+    void ScheduleLyricUpdate(int64_t delay_ms);
+    void OnLyricTimer();
     
-    // ID3标签处理
+    // ID3标签处理，返回需要跳过的总字节数（可能大于size）
     size_t SkipId3Tag(uint8_t* data, size_t size);
 
-    int16_t* final_pcm_data_fft = nullptr;
+    SpectrumAnalyzer spectrum_;
 
 public:
     Esp32Music();
@@ -103,9 +137,10 @@ public:
     // 新增方法
     virtual bool StartStreaming(const std::string& music_url) override;
     virtual bool StopStreaming() override;  // 停止流式播放
-    virtual size_t GetBufferSize() const override { return buffer_size_; }
+    virtual bool Seek(int64_t position_ms) override;  // 跳转到指定播放时间
+    virtual size_t GetBufferSize() const override { return stream_buffer_.size(); }
     virtual bool IsDownloading() const override { return is_downloading_; }
-    virtual int16_t* GetAudioData() override { return final_pcm_data_fft; }
+    virtual SpectrumAnalyzer* GetSpectrumAnalyzer() override { return &spectrum_; }
     
     // 显示模式控制方法
     void SetDisplayMode(DisplayMode mode);
@@ -0,0 +1,98 @@
+#include "lyric_timeline.h"
+
+#include <algorithm>
+
+
+static bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// "mm:ss", "mm:ss.xx", "mm:ss.xxx" or "mm:ss:xx"
+bool LyricTimeline::ParseTime(std::string_view tag, int32_t& time_ms) {
+    size_t i = 0;
+    auto number = [&tag, &i](int32_t& value) {
+        size_t start = i;
+        value = 0;
+        while (i < tag.size() && IsDigit(tag[i]) && i - start < 5) {
+            value = value * 10 + (tag[i++] - '0');
+        }
+        return i > start;
+    };
+
+    int32_t minutes;
+    int32_t seconds;
+    if (!number(minutes) || i >= tag.size() || tag[i++] != ':' || !number(seconds)) {
+        return false;
+    }
+    int32_t fraction_ms = 0;
+    if (i < tag.size() && (tag[i] == '.' || tag[i] == ':')) {
+        i++;
+        for (int scale = 100; i < tag.size() && IsDigit(tag[i]); i++, scale /= 10) {
+            fraction_ms += (tag[i] - '0') * scale;
+        }
+    }
+    if (i != tag.size()) {
+        return false;
+    }
+    time_ms = (minutes * 60 + seconds) * 1000 + fraction_ms;
+    return true;
+}
+
+bool LyricTimeline::Parse(std::string_view content) {
+    text_.clear();
+    lines_.clear();
+    // Every text and its terminator is shorter than the line it came from
+    text_.reserve(content.size() + 1);
+
+    if (content.substr(0, 3) == "\xEF\xBB\xBF") {
+        content.remove_prefix(3);
+    }
+
+    size_t position = 0;
+    while (position < content.size()) {
+        size_t end = content.find('\n', position);
+        if (end == std::string_view::npos) {
+            end = content.size();
+        }
+        std::string_view line = content.substr(position, end - position);
+        position = end + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+
+        // One or more time tags, then the text
+        size_t first = lines_.size();
+        while (!line.empty() && line[0] == '[') {
+            size_t close = line.find(']');
+            int32_t time_ms;
+            if (close == std::string_view::npos || !ParseTime(line.substr(1, close - 1), time_ms)) {
+                break;
+            }
+            lines_.push_back(Line{time_ms, 0});
+            line.remove_prefix(close + 1);
+        }
+        if (lines_.size() == first) {
+            continue;
+        }
+
+        uint32_t offset = text_.size();
+        text_.append(line.data(), line.size());
+        text_.push_back('\0');
+        for (size_t i = first; i < lines_.size(); i++) {
+            lines_[i].offset = offset;
+        }
+    }
+
+    // Files are usually in order already, lines with several time tags are not
+    auto earlier = [](const Line& a, const Line& b) { return a.time_ms < b.time_ms; };
+    if (!std::is_sorted(lines_.begin(), lines_.end(), earlier)) {
+        std::stable_sort(lines_.begin(), lines_.end(), earlier);
+    }
+    return !lines_.empty();
+}
+
+int LyricTimeline::Find(int64_t time_ms) const {
+    auto it = std::upper_bound(lines_.begin(), lines_.end(), time_ms,
+        [](int64_t time, const Line& line) { return time < line.time_ms; });
+    return (int)(it - lines_.begin()) - 1;
+}
@@ -0,0 +1,45 @@
+#ifndef LYRIC_TIMELINE_H
+#define LYRIC_TIMELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/*
+ * Timed lyrics parsed from LRC, sorted by time for binary search.
+ *
+ * Parse() reads the content once without copying lines: "[mm:ss.xx]text" lines become
+ * entries, a line with several time tags becomes one entry per tag sharing its text, and
+ * tags such as [ti:...] or [ar:...] are skipped. The texts are stored back to back, each
+ * NUL terminated, in one blob, and entries only hold their time and offset.
+ *
+ * A timeline is not modified after Parse(), so any task may read it.
+ */
+class LyricTimeline {
+public:
+    bool Parse(std::string_view content);
+
+    size_t size() const { return lines_.size(); }
+    bool empty() const { return lines_.empty(); }
+    int32_t time_ms(int index) const { return lines_[index].time_ms; }
+    const char* text(int index) const { return text_.data() + lines_[index].offset; }
+
+    // Index of the line shown at the time, -1 before the first line
+    int Find(int64_t time_ms) const;
+
+private:
+    struct Line {
+        int32_t time_ms;
+        uint32_t offset;
+    };
+
+    std::string text_;
+    std::vector<Line> lines_;
+
+    static bool ParseTime(std::string_view tag, int32_t& time_ms);
+};
+
+#endif // LYRIC_TIMELINE_H
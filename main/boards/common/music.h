@@ -1,8 +1,11 @@
 #ifndef MUSIC_H
 #define MUSIC_H
 
+#include <cstdint>
 #include <string>
 
+class SpectrumAnalyzer;
+
 class Music {
 public:
     virtual ~Music() = default;  // 添加虚析构函数
@@ -13,9 +16,11 @@ public:
     // 新增流式播放相关方法
     virtual bool StartStreaming(const std::string& music_url) = 0;
     virtual bool StopStreaming() = 0;  // 停止流式播放
+    virtual bool Seek(int64_t position_ms) = 0;  // 跳转到指定播放时间
     virtual size_t GetBufferSize() const = 0;
     virtual bool IsDownloading() const = 0;
-    virtual int16_t* GetAudioData() = 0;
+    // Spectrum of the playing music, running while the spectrum display mode is active
+    virtual SpectrumAnalyzer* GetSpectrumAnalyzer() = 0;
 };
 
 #endif // MUSIC_H
\ No newline at end of file
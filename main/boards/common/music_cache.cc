@@ -0,0 +1,332 @@
+#include "music_cache.h"
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_vfs_fat.h>
+#include <sys/stat.h>
+#include <cctype>
+#include <cinttypes>
+#include <cstring>
+
+#define TAG "MusicCache"
+
+
+MusicCache::~MusicCache() {
+    AbortWrite();
+}
+
+bool MusicCache::Initialize(const char* sd_path, size_t budget) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A missing partition or card does not appear between songs, mounting is not retried
+    if (initialized_) {
+        return enabled_;
+    }
+    initialized_ = true;
+
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT, MUSIC_CACHE_PARTITION_LABEL);
+    if (partition != nullptr) {
+        esp_vfs_fat_mount_config_t mount_config = {};
+        mount_config.format_if_mount_failed = true;
+        mount_config.max_files = 4;
+        mount_config.allocation_unit_size = CONFIG_WL_SECTOR_SIZE;
+        wl_handle_t wl_handle = WL_INVALID_HANDLE;
+        esp_err_t ret = esp_vfs_fat_spiflash_mount_rw_wl(MUSIC_CACHE_MOUNT_POINT, MUSIC_CACHE_PARTITION_LABEL, &mount_config, &wl_handle);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to mount partition %s: %s", MUSIC_CACHE_PARTITION_LABEL, esp_err_to_name(ret));
+            return false;
+        }
+        base_path_ = MUSIC_CACHE_MOUNT_POINT;
+        // Leave room for the FAT and the index on a small partition
+        if (budget > partition->size * 9 / 10) {
+            budget = partition->size * 9 / 10;
+        }
+    } else {
+        // The board mounts the SD card, the cache only needs its directory
+        struct stat st;
+        if (sd_path == nullptr || sd_path[0] == '\0' || (stat(sd_path, &st) != 0 && mkdir(sd_path, 0777) != 0)) {
+            ESP_LOGI(TAG, "No %s partition or SD card, music cache disabled", MUSIC_CACHE_PARTITION_LABEL);
+            return false;
+        }
+        base_path_ = sd_path;
+    }
+
+    budget_ = budget;
+    statistics_.budget = budget;
+    LoadIndexLocked();
+    enabled_ = true;
+    ESP_LOGI(TAG, "Music cache at %s: %u songs, %u of %u bytes", base_path_.c_str(),
+        entries_.size(), statistics_.bytes_used, budget_);
+    return true;
+}
+
+std::string MusicCache::Key(const std::string& song_name, const std::string& artist_name) {
+    // FNV-1a over the lower case names, so the same request always maps to the same files
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](const std::string& text) {
+        for (unsigned char c : text) {
+            hash = (hash ^ (uint8_t)tolower(c)) * 16777619u;
+        }
+    };
+    add(song_name);
+    add("\n");
+    add(artist_name);
+
+    char key[9];
+    snprintf(key, sizeof(key), "%08" PRIx32, hash);
+    return key;
+}
+
+std::string MusicCache::PathLocked(const std::string& key, const char* extension) const {
+    return base_path_ + "/" + key + extension;
+}
+
+std::list<MusicCache::Entry>::iterator MusicCache::FindLocked(const std::string& key) {
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key == key) {
+            return it;
+        }
+    }
+    return entries_.end();
+}
+
+std::string MusicCache::Lookup(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!enabled_) {
+        return "";
+    }
+    statistics_.lookups++;
+    auto it = FindLocked(key);
+    if (it == entries_.end() || it->mp3_size == 0) {
+        return "";
+    }
+    statistics_.hits++;
+    entries_.splice(entries_.begin(), entries_, it);
+    SaveIndexLocked();
+    return PathLocked(key, ".mp3");
+}
+
+void MusicCache::RecordBytesSaved(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    statistics_.bytes_saved += bytes;
+}
+
+bool MusicCache::HasLyrics(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!enabled_) {
+        return false;
+    }
+    auto it = FindLocked(key);
+    return it != entries_.end() && it->lyric_size > 0;
+}
+
+bool MusicCache::LoadLyrics(const std::string& key, std::string& content) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!enabled_) {
+        return false;
+    }
+    auto it = FindLocked(key);
+    if (it == entries_.end() || it->lyric_size == 0) {
+        return false;
+    }
+    FILE* file = fopen(PathLocked(key, ".lrc").c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    content.resize(it->lyric_size);
+    size_t read = fread(&content[0], 1, content.size(), file);
+    fclose(file);
+    content.resize(read);
+    return read > 0;
+}
+
+void MusicCache::StoreLyrics(const std::string& key, const std::string& content) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!enabled_ || content.empty()) {
+        return;
+    }
+    // Lyrics belong to a cached song; a song that is still downloading is added by CommitWrite()
+    auto it = FindLocked(key);
+    if (it == entries_.end() && key != write_key_) {
+        return;
+    }
+    FILE* file = fopen(PathLocked(key, ".lrc").c_str(), "wb");
+    if (file == nullptr) {
+        ESP_LOGW(TAG, "Failed to write lyrics for %s", key.c_str());
+        return;
+    }
+    size_t written = fwrite(content.data(), 1, content.size(), file);
+    fclose(file);
+    if (written != content.size()) {
+        remove(PathLocked(key, ".lrc").c_str());
+        return;
+    }
+
+    if (it == entries_.end()) {
+        write_lyric_size_ = written;
+        return;
+    }
+    statistics_.bytes_used += written - it->lyric_size;
+    it->lyric_size = written;
+    SaveIndexLocked();
+}
+
+bool MusicCache::BeginWrite(const std::string& key) {
+    AbortWrite();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!enabled_) {
+        return false;
+    }
+    write_file_ = fopen(PathLocked(key, ".tmp").c_str(), "wb");
+    if (write_file_ == nullptr) {
+        ESP_LOGW(TAG, "Failed to create cache file for %s", key.c_str());
+        return false;
+    }
+    // Flash erases per sector, larger writes mean fewer of them
+    setvbuf(write_file_, nullptr, _IOFBF, 16 * 1024);
+    write_key_ = key;
+    write_size_ = 0;
+    write_lyric_size_ = 0;
+    return true;
+}
+
+bool MusicCache::Write(const uint8_t* data, size_t size) {
+    if (write_file_ == nullptr) {
+        return false;
+    }
+    if (write_size_ + size > budget_ || fwrite(data, 1, size, write_file_) != size) {
+        ESP_LOGW(TAG, "Song %s does not fit the cache, not caching it", write_key_.c_str());
+        AbortWrite();
+        return false;
+    }
+    write_size_ += size;
+    return true;
+}
+
+void MusicCache::CommitWrite() {
+    if (write_file_ == nullptr) {
+        return;
+    }
+    bool ok = fclose(write_file_) == 0 && write_size_ > 0;
+    write_file_ = nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string temp_path = PathLocked(write_key_, ".tmp");
+    std::string path = PathLocked(write_key_, ".mp3");
+    if (!ok) {
+        remove(temp_path.c_str());
+        if (FindLocked(write_key_) == entries_.end()) {
+            remove(PathLocked(write_key_, ".lrc").c_str());
+        }
+        write_key_.clear();
+        return;
+    }
+
+    auto it = FindLocked(write_key_);
+    size_t lyric_size = write_lyric_size_;
+    if (it != entries_.end()) {
+        lyric_size = it->lyric_size;
+        statistics_.bytes_used -= it->mp3_size + it->lyric_size;
+        entries_.erase(it);
+    }
+    EvictLocked(write_size_ + lyric_size);
+
+    remove(path.c_str());
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        ESP_LOGW(TAG, "Failed to rename %s", temp_path.c_str());
+        remove(temp_path.c_str());
+        remove(PathLocked(write_key_, ".lrc").c_str());
+        write_key_.clear();
+        SaveIndexLocked();
+        return;
+    }
+
+    entries_.push_front(Entry{write_key_, write_size_, lyric_size});
+    statistics_.bytes_used += write_size_ + lyric_size;
+    statistics_.stores++;
+    SaveIndexLocked();
+    ESP_LOGI(TAG, "Cached song %s, %u bytes, %u of %u bytes used", write_key_.c_str(), write_size_,
+        statistics_.bytes_used, budget_);
+    write_key_.clear();
+}
+
+void MusicCache::AbortWrite() {
+    if (write_file_ == nullptr) {
+        return;
+    }
+    fclose(write_file_);
+    write_file_ = nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    remove(PathLocked(write_key_, ".tmp").c_str());
+    // Lyrics stored while the song was downloading have no entry to belong to
+    if (FindLocked(write_key_) == entries_.end()) {
+        remove(PathLocked(write_key_, ".lrc").c_str());
+    }
+    write_key_.clear();
+}
+
+void MusicCache::EvictLocked(size_t incoming) {
+    while (!entries_.empty() && statistics_.bytes_used + incoming > budget_) {
+        auto last = std::prev(entries_.end());
+        ESP_LOGI(TAG, "Evicting song %s, %u bytes", last->key.c_str(), last->mp3_size + last->lyric_size);
+        RemoveLocked(last);
+        statistics_.evictions++;
+    }
+}
+
+void MusicCache::RemoveLocked(std::list<Entry>::iterator it) {
+    remove(PathLocked(it->key, ".mp3").c_str());
+    remove(PathLocked(it->key, ".lrc").c_str());
+    statistics_.bytes_used -= it->mp3_size + it->lyric_size;
+    entries_.erase(it);
+}
+
+// One line per entry, most recently used first: "<key> <mp3 bytes> <lyric bytes>"
+void MusicCache::LoadIndexLocked() {
+    entries_.clear();
+    statistics_.bytes_used = 0;
+    FILE* file = fopen(PathLocked(MUSIC_CACHE_INDEX_FILE, "").c_str(), "r");
+    if (file == nullptr) {
+        return;
+    }
+
+    char key[16];
+    unsigned long mp3_size;
+    unsigned long lyric_size;
+    while (fscanf(file, "%15s %lu %lu", key, &mp3_size, &lyric_size) == 3) {
+        // Drop entries whose files went missing, e.g. after a power loss during a write
+        struct stat st;
+        if (mp3_size > 0 && (stat(PathLocked(key, ".mp3").c_str(), &st) != 0 || (size_t)st.st_size != mp3_size)) {
+            continue;
+        }
+        if (lyric_size > 0 && stat(PathLocked(key, ".lrc").c_str(), &st) != 0) {
+            lyric_size = 0;
+        }
+        if (mp3_size == 0) {
+            continue;
+        }
+        entries_.push_back(Entry{key, mp3_size, lyric_size});
+        statistics_.bytes_used += mp3_size + lyric_size;
+    }
+    fclose(file);
+
+    // The budget may have shrunk since the index was written
+    EvictLocked(0);
+}
+
+void MusicCache::SaveIndexLocked() {
+    FILE* file = fopen(PathLocked(MUSIC_CACHE_INDEX_FILE, "").c_str(), "w");
+    if (file == nullptr) {
+        ESP_LOGW(TAG, "Failed to write the cache index");
+        return;
+    }
+    for (auto& entry : entries_) {
+        fprintf(file, "%s %u %u\n", entry.key.c_str(), entry.mp3_size, entry.lyric_size);
+    }
+    fclose(file);
+}
+
+MusicCacheStatistics MusicCache::statistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
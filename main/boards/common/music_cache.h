@@ -0,0 +1,98 @@
+#ifndef MUSIC_CACHE_H
+#define MUSIC_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <list>
+#include <mutex>
+
+// A FAT data partition with this label is mounted for the cache, otherwise it goes to the SD card
+#define MUSIC_CACHE_PARTITION_LABEL "music"
+#define MUSIC_CACHE_MOUNT_POINT "/music"
+// File names stay within 8.3 so FAT works without long file name support
+#define MUSIC_CACHE_INDEX_FILE "index.dat"
+
+
+struct MusicCacheStatistics {
+    uint32_t lookups = 0;
+    uint32_t hits = 0;
+    uint32_t stores = 0;
+    uint32_t evictions = 0;
+    uint64_t bytes_saved = 0;       // MP3 bytes played from the cache instead of the network
+    size_t bytes_used = 0;
+    size_t budget = 0;
+};
+
+/*
+ * LRU cache of recently played songs on flash or SD card.
+ *
+ * Each entry is keyed by a hash of song and artist and holds the MP3 file as downloaded
+ * and, once fetched, the lyric file. The index lists the entries most recently played first
+ * and is rewritten on every change; entries are evicted from the back until the MP3 and
+ * lyric bytes fit the budget.
+ *
+ * An MP3 is written while it streams: BeginWrite() opens a temporary file, Write() is called
+ * with every downloaded chunk, and CommitWrite() only adds it to the index when the download
+ * completed. One writer at a time, the other calls may come from any task.
+ */
+class MusicCache {
+public:
+    MusicCache() = default;
+    MusicCache(const MusicCache&) = delete;
+    MusicCache& operator=(const MusicCache&) = delete;
+    ~MusicCache();
+
+    // Mounts the partition or creates the SD card directory and loads the index.
+    // Returns false if neither is available; the cache then stays disabled and later calls
+    // return false without trying again.
+    bool Initialize(const char* sd_path, size_t budget);
+    bool enabled() const { return enabled_; }
+
+    static std::string Key(const std::string& song_name, const std::string& artist_name);
+
+    // Path of the cached MP3, empty on a miss. A hit becomes the most recently used entry.
+    std::string Lookup(const std::string& key);
+    void RecordBytesSaved(size_t bytes);
+
+    bool HasLyrics(const std::string& key);
+    bool LoadLyrics(const std::string& key, std::string& content);
+    void StoreLyrics(const std::string& key, const std::string& content);
+
+    bool BeginWrite(const std::string& key);
+    bool Write(const uint8_t* data, size_t size);
+    void CommitWrite();
+    void AbortWrite();
+
+    MusicCacheStatistics statistics();
+
+private:
+    struct Entry {
+        std::string key;
+        size_t mp3_size = 0;
+        size_t lyric_size = 0;
+    };
+
+    bool initialized_ = false;      // Initialize() ran, whether or not it succeeded
+    bool enabled_ = false;
+    std::string base_path_;
+    size_t budget_ = 0;
+    std::list<Entry> entries_;      // Most recently used first
+    std::mutex mutex_;
+    MusicCacheStatistics statistics_;
+
+    FILE* write_file_ = nullptr;
+    std::string write_key_;
+    size_t write_size_ = 0;
+    size_t write_lyric_size_ = 0;   // Lyrics stored before the song finished downloading
+
+    std::string PathLocked(const std::string& key, const char* extension) const;
+    std::list<Entry>::iterator FindLocked(const std::string& key);
+    void LoadIndexLocked();
+    void SaveIndexLocked();
+    void EvictLocked(size_t incoming);
+    void RemoveLocked(std::list<Entry>::iterator it);
+};
+
+#endif // MUSIC_CACHE_H
@@ -0,0 +1,154 @@
+#include "music_stream_buffer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "MusicStreamBuffer"
+
+
+MusicStreamBuffer::~MusicStreamBuffer() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+bool MusicStreamBuffer::Reset(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity != capacity_) {
+        if (buffer_ != nullptr) {
+            heap_caps_free(buffer_);
+        }
+        buffer_ = (uint8_t*)heap_caps_malloc(capacity + MUSIC_STREAM_BUFFER_GUARD_SIZE, MALLOC_CAP_SPIRAM);
+        if (buffer_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes", capacity + MUSIC_STREAM_BUFFER_GUARD_SIZE);
+            capacity_ = 0;
+            return false;
+        }
+        capacity_ = capacity;
+        ESP_LOGI(TAG, "Allocated %u bytes", capacity);
+    }
+    write_total_ = 0;
+    read_total_ = 0;
+    flush_total_ = 0;
+    discontinuity_ = false;
+    finished_ = false;
+    closed_ = false;
+    low_water_mark_ = capacity;
+    underruns_ = 0;
+    return true;
+}
+
+void MusicStreamBuffer::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    cv_.notify_all();
+}
+
+size_t MusicStreamBuffer::WaitWritable(uint8_t** data) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return closed_ || write_total_ - read_total_ < capacity_; });
+    if (closed_) {
+        return 0;
+    }
+    size_t position = write_total_ % capacity_;
+    size_t free = capacity_ - (write_total_ - read_total_);
+    *data = buffer_ + position;
+    return std::min(free, capacity_ - position);
+}
+
+void MusicStreamBuffer::Commit(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_total_ += bytes;
+    cv_.notify_all();
+}
+
+void MusicStreamBuffer::Finish() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+    cv_.notify_all();
+}
+
+void MusicStreamBuffer::Flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The space is freed when the consumer skips the data, it may still be decoding part of it
+    flush_total_ = write_total_;
+    finished_ = false;
+    cv_.notify_all();
+}
+
+void MusicStreamBuffer::SkipFlushedLocked() {
+    if (read_total_ < flush_total_) {
+        read_total_ = flush_total_;
+        discontinuity_ = true;
+        cv_.notify_all();
+    }
+}
+
+bool MusicStreamBuffer::WaitFill(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    bytes = std::min(bytes, capacity_);
+    cv_.wait(lock, [this, bytes]() { return closed_ || finished_ || write_total_ - read_total_ >= bytes; });
+    return !closed_ && write_total_ > read_total_;
+}
+
+size_t MusicStreamBuffer::Peek(uint8_t** data, size_t max_bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    max_bytes = std::min(max_bytes, (size_t)MUSIC_STREAM_BUFFER_GUARD_SIZE);
+    SkipFlushedLocked();
+    if (write_total_ - read_total_ < max_bytes && !finished_ && !closed_) {
+        underruns_++;
+        do {
+            cv_.wait(lock, [this, max_bytes]() {
+                return closed_ || finished_ || read_total_ < flush_total_ || write_total_ - read_total_ >= max_bytes;
+            });
+            SkipFlushedLocked();
+        } while (write_total_ - read_total_ < max_bytes && !finished_ && !closed_);
+    }
+    if (closed_) {
+        return 0;
+    }
+
+    size_t size = write_total_ - read_total_;
+    if (size < low_water_mark_) {
+        low_water_mark_ = size;
+    }
+    size_t position = read_total_ % capacity_;
+    size_t contiguous = capacity_ - position;
+    size_t available = std::min(size, max_bytes);
+    if (available > contiguous) {
+        // The producer only writes behind write_total_, the wrapped bytes we copy are stable
+        memcpy(buffer_ + capacity_, buffer_, available - contiguous);
+    }
+    *data = buffer_ + position;
+    return available;
+}
+
+void MusicStreamBuffer::Consume(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    read_total_ += std::min(bytes, write_total_ - read_total_);
+    cv_.notify_all();
+}
+
+bool MusicStreamBuffer::TakeDiscontinuity() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool discontinuity = discontinuity_;
+    discontinuity_ = false;
+    return discontinuity;
+}
+
+size_t MusicStreamBuffer::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return write_total_ - read_total_;
+}
+
+MusicStreamBufferStatistics MusicStreamBuffer::statistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MusicStreamBufferStatistics statistics;
+    statistics.capacity = capacity_;
+    statistics.size = write_total_ - read_total_;
+    statistics.low_water_mark = low_water_mark_;
+    statistics.underruns = underruns_;
+    return statistics;
+}
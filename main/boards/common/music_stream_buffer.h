@@ -0,0 +1,82 @@
+#ifndef MUSIC_STREAM_BUFFER_H
+#define MUSIC_STREAM_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+
+// Bytes behind the end of the ring, the consumer sees up to this much data contiguous across the wrap
+#define MUSIC_STREAM_BUFFER_GUARD_SIZE 4096
+
+
+struct MusicStreamBufferStatistics {
+    size_t capacity = 0;
+    size_t size = 0;
+    size_t low_water_mark = 0;      // Lowest fill level seen by the consumer since the last Reset()
+    uint32_t underruns = 0;         // Times the consumer had to wait for data
+};
+
+/*
+ * One contiguous byte ring in PSRAM between the music download thread and the decoder.
+ *
+ * The producer gets a pointer to the free space and reads from HTTP straight into it,
+ * the consumer decodes straight out of the ring; nothing is allocated or copied per chunk.
+ * A decoder needs its input contiguous, so when the data it asks for wraps around the
+ * end, the wrapped part is copied once into a guard area behind the end of the buffer.
+ *
+ * One producer and one consumer thread. Close() wakes both and makes every wait return.
+ * After a seek the producer calls Flush(); the consumer skips the flushed bytes at its next
+ * Peek() and sees TakeDiscontinuity() once, the bytes it is still decoding stay untouched.
+ */
+class MusicStreamBuffer {
+public:
+    MusicStreamBuffer() = default;
+    MusicStreamBuffer(const MusicStreamBuffer&) = delete;
+    MusicStreamBuffer& operator=(const MusicStreamBuffer&) = delete;
+    ~MusicStreamBuffer();
+
+    // Empties and reopens the ring, the memory is kept while the capacity stays the same.
+    // Call it while neither thread runs. Returns false if the buffer could not be allocated.
+    bool Reset(size_t capacity);
+    void Close();
+
+    // Producer: waits for free space and returns the contiguous part of it, 0 once closed
+    size_t WaitWritable(uint8_t** data);
+    void Commit(size_t bytes);
+    // No more data will be written, the consumer drains what is left
+    void Finish();
+    // Drops everything written so far and reopens a finished stream, new data follows
+    void Flush();
+
+    // Consumer: waits until at least bytes are buffered, the producer finished, or the ring closed
+    bool WaitFill(size_t bytes);
+    // Waits for up to max_bytes of contiguous data and returns how much there is, 0 at the end
+    size_t Peek(uint8_t** data, size_t max_bytes);
+    void Consume(size_t bytes);
+    // True once after Peek() skipped flushed data, the decoder state belongs to the old position
+    bool TakeDiscontinuity();
+
+    size_t size() const;
+    size_t capacity() const { return capacity_; }
+    MusicStreamBufferStatistics statistics();
+
+private:
+    uint8_t* buffer_ = nullptr;
+    size_t capacity_ = 0;
+    // Total bytes written and read, the positions are taken modulo the capacity
+    size_t write_total_ = 0;
+    size_t read_total_ = 0;
+    size_t flush_total_ = 0;        // write_total_ at the last Flush(), the consumer skips up to it
+    bool discontinuity_ = false;
+    bool finished_ = false;
+    bool closed_ = false;
+    size_t low_water_mark_ = 0;
+    uint32_t underruns_ = 0;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+
+    void SkipFlushedLocked();
+};
+
+#endif // MUSIC_STREAM_BUFFER_H
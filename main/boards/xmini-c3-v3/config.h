@@ -16,6 +16,9 @@
 #define AUDIO_CODEC_I2C_SDA_PIN  GPIO_NUM_0
 #define AUDIO_CODEC_I2C_SCL_PIN  GPIO_NUM_1
 #define AUDIO_CODEC_ES8311_ADDR  ES8311_CODEC_DEFAULT_ADDR
+// Battery powered, turn the codec and the amplifier off sooner than the default.
+// Applied in GetAudioCodec() through AudioCodec::SetPowerTimeout(), read by AudioPowerManager
+#define AUDIO_POWER_TIMEOUT_MS   5000
 
 #define BUILTIN_LED_GPIO        GPIO_NUM_2
 #define BOOT_BUTTON_GPIO        GPIO_NUM_9
@@ -40,8 +40,10 @@ public:
     virtual Theme* GetTheme() { return current_theme_; }
     virtual void UpdateStatusBar(bool update_all = false);
     virtual void SetPowerSaveMode(bool on);
+    // Music started in spectrum mode: poll Music::GetSpectrumAnalyzer()->GetFrame() to draw it
     virtual void start() {}
     virtual void clearScreen() {}
+    // Music stopped or left spectrum mode
     virtual void stopFft() {}
 
     inline int width() const { return width_; }
@@ -155,6 +155,23 @@ void McpServer::AddCommonTools() {
                 return "{\"success\": true, \"message\": \"音乐开始播放\"}";
             });
 
+        AddTool("self.music.seek",
+            "跳转到正在播放的歌曲的指定位置，比如用户说'快进到一分钟'、'从头播放'、'跳到第30秒'时调用。"
+            "参数:"
+            "  `position`: 目标播放位置，单位为秒。"
+            "返回:"
+            "  跳转结果信息。",
+            PropertyList({
+                Property("position", kPropertyTypeInteger, 0, 3600)//Position in seconds
+            }),
+            [music](const PropertyList& properties) -> ReturnValue {
+                int position = properties["position"].value<int>();
+                if (!music->Seek((int64_t)position * 1000)) {
+                    return "{\"success\": false, \"message\": \"当前无法跳转\"}";
+                }
+                return "{\"success\": true, \"message\": \"已跳转\"}";
+            });
+
         AddTool("self.music.set_display_mode",
             "设置音乐播放时的显示模式。可以选择显示频谱或歌词，比如用户说'打开频谱'或者'显示频谱'，'打开歌词'或者'显示歌词'就设置对应的显示模式。"
             "参数:"
@@ -0,0 +1,42 @@
+#include "audio_crypt.h"
+
+#include <cstring>
+#include <arpa/inet.h>
+
+
+AudioCrypt::AudioCrypt() {
+    mbedtls_aes_init(&aes_ctx_);
+}
+
+AudioCrypt::~AudioCrypt() {
+    mbedtls_aes_free(&aes_ctx_);
+}
+
+bool AudioCrypt::SetKey(const uint8_t* key, size_t key_size, const uint8_t* nonce, size_t nonce_size) {
+    if (key_size != AUDIO_CRYPT_KEY_SIZE || nonce_size != AUDIO_CRYPT_HEADER_SIZE) {
+        return false;
+    }
+    memcpy(nonce_, nonce, AUDIO_CRYPT_HEADER_SIZE);
+    return mbedtls_aes_setkey_enc(&aes_ctx_, key, AUDIO_CRYPT_KEY_SIZE * 8) == 0;
+}
+
+void AudioCrypt::WriteHeader(uint8_t* header, uint8_t flags, uint16_t payload_size, uint32_t timestamp, uint32_t sequence) const {
+    memcpy(header, nonce_, AUDIO_CRYPT_HEADER_SIZE);
+    header[1] |= flags;
+    payload_size = htons(payload_size);
+    timestamp = htonl(timestamp);
+    sequence = htonl(sequence);
+    memcpy(&header[2], &payload_size, sizeof(payload_size));
+    memcpy(&header[8], &timestamp, sizeof(timestamp));
+    memcpy(&header[12], &sequence, sizeof(sequence));
+}
+
+// With CONFIG_MBEDTLS_HARDWARE_AES mbedtls runs this on the AES peripheral, which takes longer
+// inputs such as batches by DMA
+bool AudioCrypt::Crypt(const uint8_t* header, const uint8_t* input, size_t size, uint8_t* output) {
+    uint8_t counter[AUDIO_CRYPT_HEADER_SIZE];
+    uint8_t stream_block[16];
+    size_t nc_off = 0;
+    memcpy(counter, header, sizeof(counter));
+    return mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, counter, stream_block, input, output) == 0;
+}
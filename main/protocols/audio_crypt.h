@@ -0,0 +1,42 @@
+#ifndef AUDIO_CRYPT_H
+#define AUDIO_CRYPT_H
+
+#include <mbedtls/aes.h>
+#include <cstddef>
+#include <cstdint>
+
+// The UDP header doubles as the AES-CTR nonce
+#define AUDIO_CRYPT_HEADER_SIZE 16
+#define AUDIO_CRYPT_KEY_SIZE 16
+
+
+/*
+ * AES-128-CTR of the audio packets of the MQTT UDP channel, on mbedtls alone so the host tests
+ * build it too; see tests/host/audio_crypt_test.cc.
+ *
+ * Every packet starts with a 16 byte header made from the nonce of the server hello:
+ * |type 1u|flags 1u|payload_size 2u|ssrc 4u|timestamp 4u|sequence 4u|, numbers in network order.
+ * The header is the initial counter block of the packet, so the same Crypt() call encrypts
+ * and decrypts.
+ */
+class AudioCrypt {
+public:
+    AudioCrypt();
+    ~AudioCrypt();
+    AudioCrypt(const AudioCrypt&) = delete;
+    AudioCrypt& operator=(const AudioCrypt&) = delete;
+
+    // False unless the key and the nonce are 16 bytes each
+    bool SetKey(const uint8_t* key, size_t key_size, const uint8_t* nonce, size_t nonce_size);
+    // The nonce with the fields of this packet filled in
+    void WriteHeader(uint8_t* header, uint8_t flags, uint16_t payload_size, uint32_t timestamp, uint32_t sequence) const;
+    // Encrypts or decrypts size bytes with the key stream counting up from the packet header,
+    // output may be input
+    bool Crypt(const uint8_t* header, const uint8_t* input, size_t size, uint8_t* output);
+
+private:
+    mbedtls_aes_context aes_ctx_;
+    uint8_t nonce_[AUDIO_CRYPT_HEADER_SIZE] = {};
+};
+
+#endif // AUDIO_CRYPT_H
@@ -0,0 +1,320 @@
+#include "control_message.h"
+
+#include <cctype>
+#include <cstdint>
+
+
+struct ControlMessageTokenizer {
+    std::string_view json;
+    size_t position = 0;
+    char* buffer;
+    size_t buffer_size;
+    size_t buffer_used = 0;
+
+    bool AtEnd() const { return position >= json.size(); }
+    char Peek() const { return json[position]; }
+
+    void SkipSpace() {
+        while (!AtEnd() && (Peek() == ' ' || Peek() == '\t' || Peek() == '\r' || Peek() == '\n')) {
+            position++;
+        }
+    }
+
+    bool Expect(char c) {
+        SkipSpace();
+        if (AtEnd() || Peek() != c) {
+            return false;
+        }
+        position++;
+        return true;
+    }
+
+    bool ReadHex(uint32_t& value) {
+        if (json.size() - position < 4) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = json[position++];
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                value |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                value |= c - 'A' + 10;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Reads the string at the position; value may be null to skip it
+    bool ReadString(std::string_view* value) {
+        if (!Expect('"')) {
+            return false;
+        }
+        size_t start = position;
+        while (!AtEnd() && Peek() != '"' && Peek() != '\\') {
+            position++;
+        }
+        if (AtEnd()) {
+            return false;
+        }
+        if (Peek() == '"') {
+            if (value != nullptr) {
+                *value = json.substr(start, position - start);
+            }
+            position++;
+            return true;
+        }
+
+        if (value == nullptr) {
+            while (!AtEnd() && Peek() != '"') {
+                position += Peek() == '\\' ? 2 : 1;
+            }
+            return !AtEnd() && json[position++] == '"';
+        }
+
+        // Escapes never make a string longer, but the buffer is shared by all fields
+        char* output = buffer + buffer_used;
+        size_t capacity = buffer_size - buffer_used;
+        size_t length = position - start;
+        if (length > capacity) {
+            return false;
+        }
+        json.copy(output, length, start);
+        auto put = [output, capacity, &length](char c) {
+            if (length >= capacity) {
+                return false;
+            }
+            output[length++] = c;
+            return true;
+        };
+
+        while (!AtEnd()) {
+            char c = json[position++];
+            if (c == '"') {
+                *value = std::string_view(output, length);
+                buffer_used += length;
+                return true;
+            }
+            if (c != '\\') {
+                if (!put(c)) {
+                    return false;
+                }
+                continue;
+            }
+            if (AtEnd()) {
+                return false;
+            }
+            char escaped = json[position++];
+            bool ok = true;
+            switch (escaped) {
+            case '"':
+            case '\\':
+            case '/':
+                ok = put(escaped);
+                break;
+            case 'b':
+                ok = put('\b');
+                break;
+            case 'f':
+                ok = put('\f');
+                break;
+            case 'n':
+                ok = put('\n');
+                break;
+            case 'r':
+                ok = put('\r');
+                break;
+            case 't':
+                ok = put('\t');
+                break;
+            case 'u': {
+                uint32_t code;
+                if (!ReadHex(code)) {
+                    return false;
+                }
+                // cJSON ends its strings at \u0000 and rejects surrogates that are not a
+                // high one followed by the \uXXXX of a low one
+                if (code == 0 || (code >= 0xDC00 && code <= 0xDFFF)) {
+                    return false;
+                }
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    if (json.substr(position, 2) != "\\u") {
+                        return false;
+                    }
+                    position += 2;
+                    uint32_t low;
+                    if (!ReadHex(low) || low < 0xDC00 || low > 0xDFFF) {
+                        return false;
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                if (code < 0x80) {
+                    ok = put(code);
+                } else if (code < 0x800) {
+                    ok = put(0xC0 | (code >> 6)) && put(0x80 | (code & 0x3F));
+                } else if (code < 0x10000) {
+                    ok = put(0xE0 | (code >> 12)) && put(0x80 | ((code >> 6) & 0x3F)) && put(0x80 | (code & 0x3F));
+                } else {
+                    ok = put(0xF0 | (code >> 18)) && put(0x80 | ((code >> 12) & 0x3F)) &&
+                        put(0x80 | ((code >> 6) & 0x3F)) && put(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default:
+                return false;
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // true, false, null or a number; cJSON fails the whole text on anything else
+    static bool IsLiteral(std::string_view value) {
+        if (value == "true" || value == "false" || value == "null") {
+            return true;
+        }
+        if (value.empty() || (value[0] != '-' && (value[0] < '0' || value[0] > '9'))) {
+            return false;
+        }
+        for (char c : value) {
+            if ((c < '0' || c > '9') && c != '-' && c != '+' && c != '.' && c != 'e' && c != 'E') {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Skips a number, literal, object or array, strings inside included
+    bool SkipValue() {
+        SkipSpace();
+        if (AtEnd()) {
+            return false;
+        }
+        if (Peek() == '"') {
+            return ReadString(nullptr);
+        }
+        if (Peek() != '{' && Peek() != '[') {
+            size_t start = position;
+            while (!AtEnd() && Peek() != ',' && Peek() != '}' && Peek() != ']' && Peek() != ' ' &&
+                Peek() != '\t' && Peek() != '\r' && Peek() != '\n') {
+                position++;
+            }
+            return IsLiteral(json.substr(start, position - start));
+        }
+
+        int depth = 0;
+        while (!AtEnd()) {
+            char c = Peek();
+            if (c == '"') {
+                if (!ReadString(nullptr)) {
+                    return false;
+                }
+                continue;
+            }
+            position++;
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+static bool EqualsIgnoreCase(std::string_view key, const char* name) {
+    size_t i = 0;
+    for (; i < key.size() && name[i] != '\0'; i++) {
+        if (tolower((unsigned char)key[i]) != tolower((unsigned char)name[i])) {
+            return false;
+        }
+    }
+    return i == key.size() && name[i] == '\0';
+}
+
+bool ControlMessage::Parse(std::string_view json, char* buffer, size_t buffer_size) {
+    *this = ControlMessage();
+    ControlMessageTokenizer tokenizer{json, 0, buffer, buffer_size};
+    if (!tokenizer.Expect('{')) {
+        return false;
+    }
+    tokenizer.SkipSpace();
+    if (!tokenizer.AtEnd() && tokenizer.Peek() == '}') {
+        tokenizer.position++;
+        tokenizer.SkipSpace();
+        return tokenizer.AtEnd();
+    }
+
+    const struct {
+        const char* name;
+        std::string_view* value;
+    } fields[] = {
+        {"type", &type},
+        {"state", &state},
+        {"text", &text},
+        {"emotion", &emotion},
+        {"session_id", &session_id},
+    };
+    uint32_t seen = 0;
+    while (true) {
+        std::string_view key;
+        if (!tokenizer.ReadString(&key) || !tokenizer.Expect(':')) {
+            return false;
+        }
+        // Keys match like cJSON_GetObjectItem(): ignoring case, and the first of duplicates wins
+        std::string_view* field = nullptr;
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            if (!(seen & (1u << i)) && EqualsIgnoreCase(key, fields[i].name)) {
+                field = fields[i].value;
+                seen |= 1u << i;
+                break;
+            }
+        }
+
+        tokenizer.SkipSpace();
+        if (field != nullptr && !tokenizer.AtEnd() && tokenizer.Peek() == '"') {
+            if (!tokenizer.ReadString(field)) {
+                return false;
+            }
+        } else {
+            if (field != nullptr) {
+                *field = std::string_view();
+            }
+            if (!tokenizer.SkipValue()) {
+                return false;
+            }
+        }
+
+        if (tokenizer.Expect(',')) {
+            continue;
+        }
+        if (!tokenizer.Expect('}')) {
+            return false;
+        }
+        tokenizer.SkipSpace();
+        return tokenizer.AtEnd();
+    }
+}
+
+void ControlMessage::Parse(const cJSON* root) {
+    auto string = [root](const char* name) {
+        auto item = cJSON_GetObjectItem(root, name);
+        return cJSON_IsString(item) ? std::string_view(item->valuestring) : std::string_view();
+    };
+    type = string("type");
+    state = string("state");
+    text = string("text");
+    emotion = string("emotion");
+    session_id = string("session_id");
+}
+
+bool ControlMessage::IsFrequent() const {
+    return type == "tts" || type == "stt" || type == "llm";
+}
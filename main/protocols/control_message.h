@@ -0,0 +1,39 @@
+#ifndef CONTROL_MESSAGE_H
+#define CONTROL_MESSAGE_H
+
+#include <cJSON.h>
+#include <cstddef>
+#include <string_view>
+
+// Escaped strings are decoded into a buffer of this size, longer messages go to cJSON
+#define CONTROL_MESSAGE_BUFFER_SIZE 1024
+
+
+/*
+ * The fields of a server message that the frequent tts, stt and llm messages use.
+ *
+ * Parse() tokenizes the top level object of a JSON text in one pass without allocating:
+ * strings without escapes are views into the text, escaped ones are decoded into the
+ * caller's buffer, and other keys and values are skipped. Fields that are missing or are
+ * not strings are empty. Keys match as cJSON_GetObjectItem() does, ignoring case with the
+ * first of duplicate keys winning, so both Parse() overloads give the same fields; see
+ * tests/host/control_message_test.cc. The views are only valid as long as the text and the buffer.
+ */
+struct ControlMessage {
+    std::string_view type;
+    std::string_view state;
+    std::string_view text;
+    std::string_view emotion;
+    std::string_view session_id;
+
+    // False if the text is not one JSON object, has bytes after it, or an escaped string does not
+    // fit the buffer or is one that cJSON decodes differently
+    bool Parse(std::string_view json, char* buffer, size_t buffer_size);
+    // Views into the strings of a tree parsed by cJSON
+    void Parse(const cJSON* root);
+
+    // tts, stt and llm, the types that are handled from these fields alone
+    bool IsFrequent() const;
+};
+
+#endif // CONTROL_MESSAGE_H
@@ -91,9 +91,12 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
+        if (HandleControlMessage(payload.data(), payload.size())) {
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            return;
+        }
+        cJSON* root = ParseJson(payload.data(), payload.size());
         if (root == nullptr) {
-            ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
         }
         cJSON* type = cJSON_GetObjectItem(root, "type");
@@ -152,30 +155,42 @@ bool MqttProtocol::SendText(const std::string& text) {
     return true;
 }
 
-bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+bool MqttProtocol::SendAudioMessage(AudioStreamPacket& packet) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    int64_t start_time = esp_timer_get_time();
+    size_t size = packet.payload.size();
+    // Stays within the buffer's capacity, so a packet costs no allocation
+    udp_buffer_.resize(MQTT_UDP_HEADER_SIZE + size);
+    auto header = (uint8_t*)&udp_buffer_[0];
+    audio_crypt_.WriteHeader(header, audio_batch_ ? AUDIO_BATCH_UDP_FLAG : 0, size, packet.timestamp, ++local_sequence_);
 
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    // Encrypts straight into the buffer behind the header
+    if (!audio_crypt_.Crypt(header, packet.payload.data(), size, header + MQTT_UDP_HEADER_SIZE)) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
+    encrypt_time_.Record(esp_timer_get_time() - start_time);
 
-    return udp_->Send(encrypted) > 0;
+    return udp_->Send(udp_buffer_) > 0;
+}
+
+void MqttProtocol::LogStatistics() {
+    LogParseStatistics();
+    // Decrypt runs on the UDP task, which may still be receiving
+    AudioTimingHistogram encrypt, decrypt;
+    encrypt_time_.MoveTo(encrypt);
+    decrypt_time_.MoveTo(decrypt);
+    if (encrypt.count() == 0 && decrypt.count() == 0) {
+        return;
+    }
+    // A frame takes microseconds, below the first bucket of the histograms
+    ESP_LOGI(TAG, "Audio encrypt: n=%lu avg=%lldus max=%lldus, decrypt: n=%lu avg=%lldus max=%lldus",
+        (unsigned long)encrypt.count(), encrypt.average_us(), encrypt.max_us(),
+        (unsigned long)decrypt.count(), decrypt.average_us(), decrypt.max_us());
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -183,6 +198,7 @@ void MqttProtocol::CloseAudioChannel() {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         udp_.reset();
     }
+    LogStatistics();
 
     std::string message = "{";
     message += "\"session_id\":\"" + session_id_ + "\",";
@@ -207,6 +223,8 @@ bool MqttProtocol::OpenAudioChannel() {
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
+    // hello的往返时间决定每个数据包合并多少音频
+    int64_t hello_time = esp_timer_get_time();
     auto message = GetHelloMessage();
     if (!SendText(message)) {
         return false;
@@ -219,17 +237,19 @@ bool MqttProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    SetAudioBatchRoundTripTime((esp_timer_get_time() - hello_time) / 1000);
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
     auto network = Board::GetInstance().GetNetwork();
     udp_ = network->CreateUdp(2);
+    udp_buffer_.reserve(MQTT_UDP_BUFFER_SIZE);
     udp_->OnMessage([this](const std::string& data) {
         /*
          * UDP Encrypted OPUS Packet Format:
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < MQTT_UDP_HEADER_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
@@ -239,33 +259,32 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
+        // Reordering and loss are handled by the jitter buffer in AudioService
         if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+            ESP_LOGD(TAG, "Received audio packet with sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        // Decrypts straight into a pooled packet
+        int64_t start_time = esp_timer_get_time();
+        size_t decrypted_size = data.size() - MQTT_UDP_HEADER_SIZE;
+        auto nonce = (const uint8_t*)data.data();
+        auto packet = AudioStreamPacketPool::GetInstance().Acquire();
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
+        packet->sequence = sequence;
         packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        if (!audio_crypt_.Crypt(nonce, nonce + MQTT_UDP_HEADER_SIZE, decrypted_size, packet->payload.data())) {
+            ESP_LOGE(TAG, "Failed to decrypt audio data");
             return;
         }
+        decrypt_time_.Record(esp_timer_get_time() - start_time);
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
+        if ((int32_t)(sequence - remote_sequence_) > 0) {
+            remote_sequence_ = sequence;
+        }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -288,12 +307,14 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    cJSON_AddBoolToObject(features, "audio_batch", true);
     cJSON_AddItemToObject(root, "features", features);
+    LoadClientFrameDuration();
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", client_frame_duration_);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -326,7 +347,9 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        ParseClientFrameDuration(audio_params);
     }
+    ParseAudioBatch(root, true);
 
     auto udp = cJSON_GetObjectItem(root, "udp");
     if (!cJSON_IsObject(udp)) {
@@ -340,9 +363,13 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    auto nonce_bytes = DecodeHexString(nonce);
+    auto key_bytes = DecodeHexString(key);
+    if (!audio_crypt_.SetKey((const uint8_t*)key_bytes.data(), key_bytes.size(),
+            (const uint8_t*)nonce_bytes.data(), nonce_bytes.size())) {
+        ESP_LOGE(TAG, "Invalid UDP key or nonce");
+        return;
+    }
     local_sequence_ = 0;
     remote_sequence_ = 0;
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
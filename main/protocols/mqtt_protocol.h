@@ -3,10 +3,11 @@
 
 
 #include "protocol.h"
+#include "audio_timing.h"
+#include "audio_crypt.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
@@ -21,13 +22,16 @@
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+#define MQTT_UDP_HEADER_SIZE AUDIO_CRYPT_HEADER_SIZE
+// Initial capacity of the send buffer, it grows once if a batch is larger
+#define MQTT_UDP_BUFFER_SIZE 1500
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
     ~MqttProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -40,18 +44,22 @@ private:
     std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
     std::unique_ptr<Udp> udp_;
-    mbedtls_aes_context aes_ctx_;
-    std::string aes_nonce_;
+    AudioCrypt audio_crypt_;
+    std::string udp_buffer_;            // Reused for every outgoing packet, under channel_mutex_
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
     esp_timer_handle_t reconnect_timer_;
+    AudioTimingHistogram encrypt_time_;
+    AudioTimingHistogram decrypt_time_;
 
     bool StartMqttClient(bool report_error=false);
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
+    void LogStatistics();
 
+    bool SendAudioMessage(AudioStreamPacket& packet) override;
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
 };
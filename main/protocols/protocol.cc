@@ -1,6 +1,9 @@
 #include "protocol.h"
+#include "settings.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
 
 #define TAG "Protocol"
 
@@ -8,7 +11,11 @@ void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback) {
+void Protocol::OnIncomingControl(std::function<void(const ControlMessage& message)> callback) {
+    on_incoming_control_ = callback;
+}
+
+void Protocol::OnIncomingAudio(std::function<void(AudioStreamPacketPtr packet)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -49,6 +56,7 @@ void Protocol::SendAbortSpeaking(AbortReason reason) {
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
+    FlushAudio();
     std::string json = "{\"session_id\":\"" + session_id_ + 
                       "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
     SendText(json);
@@ -69,6 +77,7 @@ void Protocol::SendStartListening(ListeningMode mode) {
 }
 
 void Protocol::SendStopListening() {
+    FlushAudio();
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
     SendText(message);
 }
@@ -88,3 +97,141 @@ bool Protocol::IsTimeout() const {
     }
     return timeout;
 }
+
+static bool IsSupportedFrameDuration(int frame_duration) {
+    return frame_duration == 20 || frame_duration == 40 || frame_duration == 60;
+}
+
+// The uplink frame duration proposed in the hello message
+void Protocol::LoadClientFrameDuration() {
+    Settings settings("audio", false);
+    int frame_duration = settings.GetInt("frame_duration", CONFIG_OPUS_UPLINK_FRAME_DURATION_MS);
+    if (!IsSupportedFrameDuration(frame_duration)) {
+        ESP_LOGW(TAG, "Unsupported frame duration %d in settings", frame_duration);
+        frame_duration = CONFIG_OPUS_UPLINK_FRAME_DURATION_MS;
+    }
+    client_frame_duration_ = frame_duration;
+}
+
+// The server may pick another uplink frame duration in its hello
+void Protocol::ParseClientFrameDuration(const cJSON* audio_params) {
+    auto frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+    if (cJSON_IsNumber(frame_duration)) {
+        if (IsSupportedFrameDuration(frame_duration->valueint)) {
+            client_frame_duration_ = frame_duration->valueint;
+        } else {
+            ESP_LOGW(TAG, "Unsupported uplink frame duration %d", frame_duration->valueint);
+        }
+    }
+}
+
+bool Protocol::SendAudio(AudioStreamPacketPtr packet) {
+    std::unique_lock<std::mutex> lock(batch_mutex_);
+    if (!audio_batch_) {
+        lock.unlock();
+        return SendAudioMessage(*packet);
+    }
+
+    // Every frame gets a length prefix, the first one also sets the timestamp of the batch
+    int frame_duration = packet->frame_duration;
+    size_t size = packet->payload.size();
+    if (batch_frames_ == 0) {
+        batch_.sample_rate = packet->sample_rate;
+        batch_.frame_duration = frame_duration;
+        batch_.timestamp = packet->timestamp;
+    }
+    auto& payload = batch_.payload;
+    payload.push_back(size >> 8);
+    payload.push_back(size & 0xFF);
+    payload.insert(payload.end(), packet->payload.begin(), packet->payload.end());
+    batch_frames_++;
+    batch_duration_ms_ += frame_duration;
+
+    // Hold the batch while another frame still fits
+    if (batch_duration_ms_ + frame_duration <= audio_batch_ms_ && batch_frames_ < AUDIO_BATCH_MAX_FRAMES) {
+        return true;
+    }
+    return SendBatchLocked();
+}
+
+bool Protocol::FlushAudio() {
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    if (batch_frames_ == 0) {
+        return true;
+    }
+    return SendBatchLocked();
+}
+
+// Sends under the lock, the next frame cannot be appended until the transport is done with the buffer
+bool Protocol::SendBatchLocked() {
+    bool sent = SendAudioMessage(batch_);
+    ClearBatchLocked();
+    return sent;
+}
+
+void Protocol::ClearBatchLocked() {
+    batch_frames_ = 0;
+    batch_duration_ms_ = 0;
+    // Keeps the capacity
+    batch_.Recycle();
+}
+
+// Batching is used only if the server hello confirms it, frames held from a previous channel are dropped
+void Protocol::ParseAudioBatch(const cJSON* root, bool supported) {
+    auto features = cJSON_GetObjectItem(root, "features");
+    auto audio_batch = cJSON_IsObject(features) ? cJSON_GetObjectItem(features, "audio_batch") : nullptr;
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    ClearBatchLocked();
+    audio_batch_ = supported && cJSON_IsTrue(audio_batch);
+    if (audio_batch_ && batch_.payload.capacity() == 0) {
+        batch_.Reserve(AUDIO_BATCH_MAX_FRAMES * (AUDIO_BATCH_FRAME_BYTES + 2));
+    }
+}
+
+void Protocol::SetAudioBatchRoundTripTime(int round_trip_ms) {
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    audio_batch_ms_ = std::min(round_trip_ms / 2, AUDIO_BATCH_MAX_MS);
+    if (audio_batch_) {
+        ESP_LOGI(TAG, "Audio batching: hello round trip %dms, up to %dms of audio per message", round_trip_ms, audio_batch_ms_);
+    }
+}
+
+bool Protocol::HandleControlMessage(const char* data, size_t size) {
+    if (on_incoming_control_ == nullptr) {
+        return false;
+    }
+    int64_t start_time = esp_timer_get_time();
+    // Anything the tokenizer cannot take, e.g. a text longer than the buffer, goes to cJSON
+    if (!control_message_.Parse(std::string_view(data, size), control_buffer_, sizeof(control_buffer_)) ||
+        !control_message_.IsFrequent()) {
+        return false;
+    }
+    control_parse_time_.Record(esp_timer_get_time() - start_time);
+    on_incoming_control_(control_message_);
+    return true;
+}
+
+cJSON* Protocol::ParseJson(const char* data, size_t size) {
+    int64_t start_time = esp_timer_get_time();
+    auto root = cJSON_ParseWithLength(data, size);
+    if (root == nullptr) {
+        ESP_LOGE(TAG, "Failed to parse json message %.*s", (int)size, data);
+        return nullptr;
+    }
+    json_parse_time_.Record(esp_timer_get_time() - start_time);
+    return root;
+}
+
+void Protocol::LogParseStatistics() {
+    // Recorded by the network task, logged from the task that closes the channel
+    AudioTimingHistogram control, json;
+    control_parse_time_.MoveTo(control);
+    json_parse_time_.MoveTo(json);
+    if (control.count() == 0 && json.count() == 0) {
+        return;
+    }
+    // Parsing takes microseconds, below the first bucket of the histograms
+    ESP_LOGI(TAG, "Message parse: tokenizer n=%lu avg=%lldus max=%lldus, cJSON n=%lu avg=%lldus max=%lldus",
+        (unsigned long)control.count(), control.average_us(), control.max_us(),
+        (unsigned long)json.count(), json.average_us(), json.max_us());
+}
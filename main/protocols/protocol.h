@@ -6,14 +6,61 @@
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <mutex>
+#include <algorithm>
+#include <arpa/inet.h>
+
+#include "audio_pool.h"
+#include "audio_timing.h"
+#include "control_message.h"
+
+// Capacity kept in front of every payload for the largest transport header (BinaryProtocol2)
+// and the length prefix of a batched frame
+#define AUDIO_PACKET_HEADROOM 20
+// Uplink batching, used once both hellos announce "audio_batch": frames are held for half the
+// round trip time of the hello, which adds little to the delay the link already has
+#define AUDIO_BATCH_MAX_MS 240
+#define AUDIO_BATCH_MAX_FRAMES 8
+// The batch buffer is reserved once for this many bytes per frame, a larger Opus frame grows it once
+#define AUDIO_BATCH_FRAME_BYTES 256
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;          // 0 if the transport has no sequence numbers
+    int64_t receive_time_us = 0;
     std::vector<uint8_t> payload;
+
+    void Reserve(size_t size) { payload.reserve(size + AUDIO_PACKET_HEADROOM); }
+    // Gives back a buffer that grew far beyond the reserved size, so one large packet does not pin memory
+    bool Shrink(size_t size) {
+        if (payload.capacity() <= (size + AUDIO_PACKET_HEADROOM) * AUDIO_POOL_SHRINK_FACTOR) {
+            return false;
+        }
+        std::vector<uint8_t>().swap(payload);
+        Reserve(size);
+        return true;
+    }
+    // Grows the payload at the front for a transport header, within the reserved capacity
+    uint8_t* PrependHeader(size_t size) {
+        payload.insert(payload.begin(), size, 0);
+        return payload.data();
+    }
+    void Recycle() {
+        sample_rate = 0;
+        frame_duration = 0;
+        timestamp = 0;
+        sequence = 0;
+        receive_time_us = 0;
+        payload.clear();
+    }
 };
 
+// Packets are recycled through AudioPool, use AudioStreamPacketPool::GetInstance().Acquire()
+using AudioStreamPacketPool = AudioPool<AudioStreamPacket>;
+using AudioStreamPacketPtr = AudioStreamPacketPool::Ptr;
+
 struct BinaryProtocol2 {
     uint16_t version;
     uint16_t type;          // Message type (0: OPUS, 1: JSON)
@@ -30,6 +77,56 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+static_assert(sizeof(BinaryProtocol2) + 2 <= AUDIO_PACKET_HEADROOM, "AUDIO_PACKET_HEADROOM too small");
+
+// Writes the BinaryProtocol2/3 header into the packet's headroom, other versions send the payload as is
+inline void PrependBinaryProtocolHeader(AudioStreamPacket& packet, int version, uint16_t type) {
+    size_t payload_size = packet.payload.size();
+    if (version == 2) {
+        auto bp2 = (BinaryProtocol2*)packet.PrependHeader(sizeof(BinaryProtocol2));
+        bp2->version = htons(version);
+        bp2->type = htons(type);
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(packet.timestamp);
+        bp2->payload_size = htonl(payload_size);
+    } else if (version == 3) {
+        auto bp3 = (BinaryProtocol3*)packet.PrependHeader(sizeof(BinaryProtocol3));
+        bp3->type = type;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(payload_size);
+    }
+}
+
+// Reads a received frame into the packet. The header is read in place, the data is left as it is,
+// and a payload_size past the end of the frame is cut to the frame. False if the header does not fit.
+inline bool ParseBinaryProtocolFrame(const uint8_t* data, size_t size, int version, AudioStreamPacket& packet) {
+    const uint8_t* payload = data;
+    size_t payload_size = size;
+    if (version == 2) {
+        if (size < sizeof(BinaryProtocol2)) {
+            return false;
+        }
+        auto bp2 = (const BinaryProtocol2*)data;
+        packet.timestamp = ntohl(bp2->timestamp);
+        payload = bp2->payload;
+        payload_size = std::min<size_t>(ntohl(bp2->payload_size), size - sizeof(BinaryProtocol2));
+    } else if (version == 3) {
+        if (size < sizeof(BinaryProtocol3)) {
+            return false;
+        }
+        auto bp3 = (const BinaryProtocol3*)data;
+        payload = bp3->payload;
+        payload_size = std::min<size_t>(ntohs(bp3->payload_size), size - sizeof(BinaryProtocol3));
+    }
+    packet.payload.assign(payload, payload + payload_size);
+    return true;
+}
+
+// Message type of a batch in BinaryProtocol2/3, the UDP header marks it with a flag instead.
+// The payload holds one or more frames, oldest first: |size 2u (network order)|opus size|
+#define AUDIO_BATCH_MESSAGE_TYPE 2
+#define AUDIO_BATCH_UDP_FLAG 0x01
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -51,12 +148,17 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    inline int client_frame_duration() const {
+        return client_frame_duration_;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
 
-    void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
+    void OnIncomingAudio(std::function<void(AudioStreamPacketPtr packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // The frequent tts, stt and llm messages, parsed without a cJSON tree; all others go to OnIncomingJson
+    void OnIncomingControl(std::function<void(const ControlMessage& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -67,7 +169,12 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    // Starts the connection ahead of OpenAudioChannel where it has a handshake to save, returns at once
+    virtual void Preconnect() {}
+    // Sends the packet, or holds it to go out with the next ones when batching was negotiated
+    bool SendAudio(AudioStreamPacketPtr packet);
+    // Sends the held frames now, e.g. when speech ends
+    bool FlushAudio();
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -76,7 +183,8 @@ public:
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
+    std::function<void(const ControlMessage& message)> on_incoming_control_;
+    std::function<void(AudioStreamPacketPtr packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
@@ -85,13 +193,44 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int client_frame_duration_ = 60;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    bool audio_batch_ = false;      // Set from the server hello, before the channel opens
+    int audio_batch_ms_ = 0;
 
+    // One audio message on the wire, a batch if audio_batch_ is set
+    // The transport may prepend its header in the packet's headroom
+    virtual bool SendAudioMessage(AudioStreamPacket& packet) = 0;
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    void LoadClientFrameDuration();
+    void ParseClientFrameDuration(const cJSON* audio_params);
+    void ParseAudioBatch(const cJSON* root, bool supported);
+    void SetAudioBatchRoundTripTime(int round_trip_ms);
+    // Hands a frequent message to on_incoming_control_, false for the others, which the caller
+    // parses with ParseJson(). Both run on the transport's receive task.
+    bool HandleControlMessage(const char* data, size_t size);
+    cJSON* ParseJson(const char* data, size_t size);
+    void LogParseStatistics();
+
+private:
+    // Frames are copied into a buffer of its own, reserved for a full batch when batching is
+    // negotiated, so neither the batch nor a pooled packet grows per message
+    std::mutex batch_mutex_;
+    AudioStreamPacket batch_;
+    int batch_frames_ = 0;
+    int batch_duration_ms_ = 0;
+
+    char control_buffer_[CONTROL_MESSAGE_BUFFER_SIZE];
+    ControlMessage control_message_;
+    AudioTimingHistogram control_parse_time_;
+    AudioTimingHistogram json_parse_time_;
+
+    bool SendBatchLocked();
+    void ClearBatchLocked();
 };
 
 #endif // PROTOCOL_H
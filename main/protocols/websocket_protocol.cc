@@ -4,9 +4,11 @@
 #include "application.h"
 #include "settings.h"
 
+#include <algorithm>
 #include <cstring>
 #include <cJSON.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -25,36 +27,18 @@ bool WebsocketProtocol::Start() {
     return true;
 }
 
-bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+bool WebsocketProtocol::SendAudioMessage(AudioStreamPacket& packet) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
-    if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
-        bp2->version = htons(version_);
-        bp2->type = 0;
-        bp2->reserved = 0;
-        bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
+    // The header goes into the headroom of the packet or the batch, so a frame needs no buffer of its own
+    int64_t start_time = esp_timer_get_time();
+    PrependBinaryProtocolHeader(packet, version_, audio_batch_ ? AUDIO_BATCH_MESSAGE_TYPE : 0);
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
-        bp3->type = 0;
-        bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
-    }
+    bool sent = websocket_->Send(packet.payload.data(), packet.payload.size(), true);
+    send_time_.Record(esp_timer_get_time() - start_time);
+    return sent;
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
@@ -76,25 +60,48 @@ bool WebsocketProtocol::IsAudioChannelOpened() const {
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+    SetWebsocket(nullptr);
+    LogStatistics();
+}
+
+// Only the main task changes websocket_, the disconnect handler compares against active_websocket_
+void WebsocketProtocol::SetWebsocket(std::unique_ptr<WebSocket> websocket) {
+    active_websocket_ = websocket.get();
+    // Close the old one first, on ml307 every websocket uses connect id 1 and closing it later
+    // would close the new connection too
     websocket_.reset();
+    websocket_ = std::move(websocket);
 }
 
-bool WebsocketProtocol::OpenAudioChannel() {
+void WebsocketProtocol::LogStatistics() {
+    LogParseStatistics();
+    // Called from CloseAudioChannel() and from the network task when the server disconnects,
+    // while the main task may still be sending
+    AudioTimingHistogram send_time;
+    send_time_.MoveTo(send_time);
+    if (send_time.count() == 0) {
+        return;
+    }
+    char buffer[128];
+    send_time.Format(buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "Audio send time: %s", buffer);
+}
+
+// A websocket with the headers and handlers of the audio channel, not connected yet
+std::unique_ptr<WebSocket> WebsocketProtocol::CreateWebsocket(std::string& url) {
     Settings settings("websocket", false);
-    std::string url = settings.GetString("url");
+    url = settings.GetString("url");
     std::string token = settings.GetString("token");
     int version = settings.GetInt("version");
     if (version != 0) {
         version_ = version;
     }
 
-    error_occurred_ = false;
-
     auto network = Board::GetInstance().GetNetwork();
-    websocket_ = network->CreateWebSocket(1);
-    if (websocket_ == nullptr) {
+    auto websocket = network->CreateWebSocket(1);
+    if (websocket == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
-        return false;
+        return nullptr;
     }
 
     if (!token.empty()) {
@@ -102,51 +109,35 @@ bool WebsocketProtocol::OpenAudioChannel() {
         if (token.find(" ") == std::string::npos) {
             token = "Bearer " + token;
         }
-        websocket_->SetHeader("Authorization", token.c_str());
+        websocket->SetHeader("Authorization", token.c_str());
     }
-    websocket_->SetHeader("Protocol-Version", std::to_string(version_).c_str());
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+    websocket->SetHeader("Protocol-Version", std::to_string(version_).c_str());
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
+    websocket->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
             if (on_incoming_audio_ != nullptr) {
-                if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
-                } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
-                } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
+                auto packet = AudioStreamPacketPool::GetInstance().Acquire();
+                packet->sample_rate = server_sample_rate_;
+                packet->frame_duration = server_frame_duration_;
+                // The header is read in place; the socket buffer is reused once this callback returns,
+                // so the payload is copied once, into the pooled packet that goes to the decoder
+                if (!ParseBinaryProtocolFrame((const uint8_t*)data, len, version_, *packet)) {
+                    ESP_LOGW(TAG, "Audio frame too short: %u bytes", len);
+                    return;
                 }
+                on_incoming_audio_(std::move(packet));
             }
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
+            if (HandleControlMessage(data, len)) {
+                last_incoming_time_ = std::chrono::steady_clock::now();
+                return;
+            }
+            auto root = ParseJson(data, len);
+            if (root == nullptr) {
+                return;
+            }
             auto type = cJSON_GetObjectItem(root, "type");
             if (cJSON_IsString(type)) {
                 if (strcmp(type->valuestring, "hello") == 0) {
@@ -157,28 +148,53 @@ bool WebsocketProtocol::OpenAudioChannel() {
                     }
                 }
             } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
             }
             cJSON_Delete(root);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    websocket_->OnDisconnected([this]() {
+    auto raw_websocket = websocket.get();
+    websocket->OnDisconnected([this, raw_websocket]() {
+        // A warm connection that drops before it is used is only discarded
+        if (raw_websocket != active_websocket_.load()) {
+            ESP_LOGI(TAG, "Unused websocket disconnected");
+            return;
+        }
         ESP_LOGI(TAG, "Websocket disconnected");
+        LogStatistics();
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
 
-    ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
-    if (!websocket_->Connect(url.c_str())) {
-        ESP_LOGE(TAG, "Failed to connect to websocket server, code=%d", websocket_->GetLastError());
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
-        return false;
+    return websocket;
+}
+
+bool WebsocketProtocol::OpenAudioChannel() {
+    error_occurred_ = false;
+    int64_t open_time = esp_timer_get_time();
+
+    // A connection made by Preconnect() has done the TCP, TLS and websocket handshakes already
+    SetWebsocket(TakeWarmWebsocket());
+    bool warm = websocket_ != nullptr;
+    if (!warm) {
+        std::string url;
+        SetWebsocket(CreateWebsocket(url));
+        if (websocket_ == nullptr) {
+            return false;
+        }
+        ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
+        if (!websocket_->Connect(url.c_str())) {
+            ESP_LOGE(TAG, "Failed to connect to websocket server, code=%d", websocket_->GetLastError());
+            SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+            return false;
+        }
     }
 
-    // Send hello message to describe the client
+    // Send hello message to describe the client, its round trip sets how much audio to batch
+    int64_t hello_time = esp_timer_get_time();
     auto message = GetHelloMessage();
     if (!SendText(message)) {
         return false;
@@ -191,6 +207,9 @@ bool WebsocketProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    int64_t now = esp_timer_get_time();
+    SetAudioBatchRoundTripTime((now - hello_time) / 1000);
+    ESP_LOGI(TAG, "Audio channel opened in %lldms, %s connection", (now - open_time) / 1000, warm ? "warm" : "new");
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -199,6 +218,105 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
+void WebsocketProtocol::Preconnect() {
+    if (websocket_ != nullptr) {
+        if (websocket_->IsConnected()) {
+            return;
+        }
+        // A stale socket closed later would take the warm connection down with it
+        SetWebsocket(nullptr);
+    }
+
+    std::lock_guard<std::mutex> lock(preconnect_mutex_);
+    if (preconnecting_ || warm_websocket_ != nullptr || esp_timer_get_time() < preconnect_resume_time_) {
+        return;
+    }
+    preconnecting_ = true;
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_PRECONNECT_DONE_EVENT | WEBSOCKET_PROTOCOL_WARM_TAKEN_EVENT);
+    xTaskCreate([](void* arg) {
+        ((WebsocketProtocol*)arg)->PreconnectTask();
+        vTaskDelete(NULL);
+    }, "ws_preconnect", 4096 * 2, this, 2, nullptr);
+}
+
+void WebsocketProtocol::PreconnectTask() {
+    int64_t start_time = esp_timer_get_time();
+    std::string url;
+    auto websocket = CreateWebsocket(url);
+    bool connected = websocket != nullptr && websocket->Connect(url.c_str());
+    {
+        std::lock_guard<std::mutex> lock(preconnect_mutex_);
+        preconnecting_ = false;
+        if (connected) {
+            warm_websocket_ = std::move(websocket);
+        } else {
+            BackOffPreconnectLocked();
+        }
+    }
+    xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_PRECONNECT_DONE_EVENT);
+    if (!connected) {
+        ESP_LOGW(TAG, "Failed to preconnect to %s", url.c_str());
+        return;
+    }
+    ESP_LOGI(TAG, "Warm connection ready in %lldms", (esp_timer_get_time() - start_time) / 1000);
+
+    // Keep it until OpenAudioChannel takes it, the server's pings keep it alive meanwhile
+    auto bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_WARM_TAKEN_EVENT, pdTRUE, pdFALSE,
+        pdMS_TO_TICKS(WEBSOCKET_PRECONNECT_IDLE_MS));
+    if (!(bits & WEBSOCKET_PROTOCOL_WARM_TAKEN_EVENT)) {
+        std::unique_ptr<WebSocket> unused;
+        {
+            std::lock_guard<std::mutex> lock(preconnect_mutex_);
+            unused = std::move(warm_websocket_);
+            if (unused != nullptr) {
+                BackOffPreconnectLocked();
+            }
+        }
+        if (unused != nullptr) {
+            ESP_LOGI(TAG, "Closing the unused warm connection");
+        }
+    }
+}
+
+// Noise that starts voice detection without a wake word would otherwise reconnect every idle period
+void WebsocketProtocol::BackOffPreconnectLocked() {
+    preconnect_backoff_ms_ = preconnect_backoff_ms_ == 0 ? WEBSOCKET_PRECONNECT_BACKOFF_MS :
+        std::min(preconnect_backoff_ms_ * 2, WEBSOCKET_PRECONNECT_MAX_BACKOFF_MS);
+    preconnect_resume_time_ = esp_timer_get_time() + preconnect_backoff_ms_ * 1000LL;
+    ESP_LOGI(TAG, "Next preconnect in %dms at the earliest", preconnect_backoff_ms_);
+}
+
+// Waits for a preconnect in progress, it is ahead of a new connection
+std::unique_ptr<WebSocket> WebsocketProtocol::TakeWarmWebsocket() {
+    bool preconnecting;
+    {
+        std::lock_guard<std::mutex> lock(preconnect_mutex_);
+        preconnecting = preconnecting_;
+    }
+    if (preconnecting) {
+        xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_PRECONNECT_DONE_EVENT, pdFALSE, pdFALSE, pdMS_TO_TICKS(10000));
+    }
+
+    std::unique_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(preconnect_mutex_);
+        websocket = std::move(warm_websocket_);
+        if (websocket != nullptr) {
+            preconnect_backoff_ms_ = 0;
+            preconnect_resume_time_ = 0;
+        }
+    }
+    if (websocket == nullptr) {
+        return nullptr;
+    }
+    xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_WARM_TAKEN_EVENT);
+    if (!websocket->IsConnected()) {
+        ESP_LOGW(TAG, "Warm connection was closed, connecting again");
+        return nullptr;
+    }
+    return websocket;
+}
+
 std::string WebsocketProtocol::GetHelloMessage() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
     cJSON* root = cJSON_CreateObject();
@@ -209,13 +327,18 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    // Protocol version 1 sends bare Opus frames, a batch needs the message type of version 2 or 3
+    if (version_ >= 2) {
+        cJSON_AddBoolToObject(features, "audio_batch", true);
+    }
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
+    LoadClientFrameDuration();
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", client_frame_duration_);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -247,7 +370,9 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        ParseClientFrameDuration(audio_params);
     }
+    ParseAudioBatch(root, version_ >= 2);
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
@@ -3,12 +3,25 @@
 
 
 #include "protocol.h"
+#include "audio_timing.h"
 
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define WEBSOCKET_PROTOCOL_PRECONNECT_DONE_EVENT (1 << 1)
+#define WEBSOCKET_PROTOCOL_WARM_TAKEN_EVENT (1 << 2)
+
+// A connection made by Preconnect() is closed if no audio channel uses it within this time
+#define WEBSOCKET_PRECONNECT_IDLE_MS 20000
+// After a preconnect fails or goes unused, the next one waits this long, doubling up to the maximum
+#define WEBSOCKET_PRECONNECT_BACKOFF_MS 20000
+#define WEBSOCKET_PRECONNECT_MAX_BACKOFF_MS 320000
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -16,17 +29,33 @@ public:
     ~WebsocketProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void Preconnect() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
+    std::atomic<WebSocket*> active_websocket_ = nullptr;  // websocket_, for the disconnect handler on the network task
     int version_ = 1;
+    AudioTimingHistogram send_time_;    // Framing and websocket send of one audio packet
+
+    std::mutex preconnect_mutex_;
+    bool preconnecting_ = false;
+    std::unique_ptr<WebSocket> warm_websocket_;     // Connected, waiting for OpenAudioChannel
+    int preconnect_backoff_ms_ = 0;
+    int64_t preconnect_resume_time_ = 0;            // esp_timer time before which Preconnect() does nothing
+
+    std::unique_ptr<WebSocket> CreateWebsocket(std::string& url);
+    void PreconnectTask();
+    std::unique_ptr<WebSocket> TakeWarmWebsocket();
+    void BackOffPreconnectLocked();
+    void SetWebsocket(std::unique_ptr<WebSocket> websocket);
 
+    void LogStatistics();
     void ParseServerHello(const cJSON* root);
+    bool SendAudioMessage(AudioStreamPacket& packet) override;
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
 };
@@ -0,0 +1,105 @@
+#include "audio_crypt.h"
+#include "test_check.h"
+
+#include <cstring>
+#include <vector>
+
+// NIST SP 800-38A F.5.1, CTR-AES128.Encrypt
+static const uint8_t kKey[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+};
+static const uint8_t kCounter[16] = {
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+};
+static const uint8_t kPlaintext[32] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+};
+static const uint8_t kCiphertext[32] = {
+    0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+};
+
+// A nonce as the server hello sends it: type 1, ssrc, the other fields zero
+static const uint8_t kNonce[16] = {
+    0x01, 0x00, 0x00, 0x00, 0xa1, 0xb2, 0xc3, 0xd4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static void TestSetKey() {
+    AudioCrypt crypt;
+    CHECK(crypt.SetKey(kKey, sizeof(kKey), kNonce, sizeof(kNonce)));
+    CHECK(!crypt.SetKey(kKey, 15, kNonce, sizeof(kNonce)));
+    CHECK(!crypt.SetKey(kKey, 32, kNonce, sizeof(kNonce)));
+    CHECK(!crypt.SetKey(kKey, sizeof(kKey), kNonce, 12));
+}
+
+// The header is the counter block, counting up across the payload
+static void TestKeyStream() {
+    AudioCrypt crypt;
+    CHECK(crypt.SetKey(kKey, sizeof(kKey), kNonce, sizeof(kNonce)));
+    uint8_t output[sizeof(kPlaintext)];
+    CHECK(crypt.Crypt(kCounter, kPlaintext, sizeof(kPlaintext), output));
+    CHECK(memcmp(output, kCiphertext, sizeof(kCiphertext)) == 0);
+
+    // A payload that is not a whole number of blocks uses the start of the same key stream
+    CHECK(crypt.Crypt(kCounter, kPlaintext, 21, output));
+    CHECK(memcmp(output, kCiphertext, 21) == 0);
+}
+
+static void TestHeaderLayout() {
+    AudioCrypt crypt;
+    CHECK(crypt.SetKey(kKey, sizeof(kKey), kNonce, sizeof(kNonce)));
+    uint8_t header[AUDIO_CRYPT_HEADER_SIZE];
+    crypt.WriteHeader(header, 0x01, 0x1234, 0x89abcdef, 0x00000102);
+    const uint8_t expected[AUDIO_CRYPT_HEADER_SIZE] = {
+        0x01, 0x01, 0x12, 0x34, 0xa1, 0xb2, 0xc3, 0xd4, 0x89, 0xab, 0xcd, 0xef, 0x00, 0x00, 0x01, 0x02,
+    };
+    CHECK(memcmp(header, expected, sizeof(expected)) == 0);
+
+    // Every packet starts again from the nonce, the flags of one do not carry over to the next
+    crypt.WriteHeader(header, 0, 0, 0, 0);
+    CHECK(memcmp(header, kNonce, sizeof(kNonce)) == 0);
+}
+
+static void TestRoundTrip() {
+    AudioCrypt sender, receiver;
+    CHECK(sender.SetKey(kKey, sizeof(kKey), kNonce, sizeof(kNonce)));
+    CHECK(receiver.SetKey(kKey, sizeof(kKey), kNonce, sizeof(kNonce)));
+
+    // A batch of frames, longer than one block and not a multiple of it
+    std::vector<uint8_t> payload(1000);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = (uint8_t)(i * 7 + 3);
+    }
+    std::vector<uint8_t> packet(AUDIO_CRYPT_HEADER_SIZE + payload.size());
+    sender.WriteHeader(packet.data(), 0, payload.size(), 60, 1);
+    CHECK(sender.Crypt(packet.data(), payload.data(), payload.size(), packet.data() + AUDIO_CRYPT_HEADER_SIZE));
+    CHECK(memcmp(packet.data() + AUDIO_CRYPT_HEADER_SIZE, payload.data(), payload.size()) != 0);
+
+    std::vector<uint8_t> decrypted(payload.size());
+    CHECK(receiver.Crypt(packet.data(), packet.data() + AUDIO_CRYPT_HEADER_SIZE, decrypted.size(), decrypted.data()));
+    CHECK(decrypted == payload);
+
+    // In place, as a receive buffer may be decrypted
+    CHECK(receiver.Crypt(packet.data(), packet.data() + AUDIO_CRYPT_HEADER_SIZE, payload.size(),
+        packet.data() + AUDIO_CRYPT_HEADER_SIZE));
+    CHECK(memcmp(packet.data() + AUDIO_CRYPT_HEADER_SIZE, payload.data(), payload.size()) == 0);
+
+    // Another sequence number gives another key stream
+    std::vector<uint8_t> first(payload.size()), second(payload.size());
+    uint8_t header[AUDIO_CRYPT_HEADER_SIZE];
+    sender.WriteHeader(header, 0, payload.size(), 60, 1);
+    CHECK(sender.Crypt(header, payload.data(), payload.size(), first.data()));
+    sender.WriteHeader(header, 0, payload.size(), 60, 2);
+    CHECK(sender.Crypt(header, payload.data(), payload.size(), second.data()));
+    CHECK(memcmp(first.data(), second.data(), 16) != 0);
+}
+
+int main() {
+    TestSetKey();
+    TestKeyStream();
+    TestHeaderLayout();
+    TestRoundTrip();
+
+    return TestResult();
+}
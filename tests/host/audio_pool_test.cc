@@ -0,0 +1,80 @@
+#include "audio_pool.h"
+#include "test_check.h"
+
+#include <cstdio>
+
+struct TestObject {
+    std::vector<int16_t> pcm;
+
+    void Reserve(size_t samples) { pcm.reserve(samples); }
+    bool Shrink(size_t samples) {
+        if (pcm.capacity() <= samples * AUDIO_POOL_SHRINK_FACTOR) {
+            return false;
+        }
+        std::vector<int16_t>().swap(pcm);
+        Reserve(samples);
+        return true;
+    }
+    void Recycle() { pcm.clear(); }
+};
+
+int main() {
+    auto& pool = AudioPool<TestObject>::GetInstance();
+    pool.Reserve(2, 16);
+
+    // Within the capacity, objects are reused
+    for (int i = 0; i < 10; i++) {
+        auto a = pool.Acquire();
+        auto b = pool.Acquire();
+        CHECK(a->pcm.capacity() >= 16);
+    }
+    CHECK(pool.stats().heap_allocations == 0);
+
+    // A burst allocates, and the extra object is deleted on release
+    {
+        auto a = pool.Acquire();
+        auto b = pool.Acquire();
+        auto c = pool.Acquire();
+        CHECK(pool.stats().peak_in_use == 3);
+    }
+    auto stats = pool.stats();
+    CHECK(stats.heap_allocations == 1);
+    CHECK(stats.heap_frees == 1);
+    CHECK(stats.in_use == 0);
+
+    // An oversized buffer goes back to the nominal size
+    {
+        auto a = pool.Acquire();
+        a->pcm.resize(1000);
+    }
+    CHECK(pool.stats().shrinks == 1);
+    {
+        auto a = pool.Acquire();
+        auto b = pool.Acquire();
+        CHECK(a->pcm.capacity() <= 16 * AUDIO_POOL_SHRINK_FACTOR);
+        CHECK(b->pcm.capacity() <= 16 * AUDIO_POOL_SHRINK_FACTOR);
+    }
+
+    // With a capacity above the preallocated count, a burst allocates once and is kept
+    pool.Reserve(2, 16, 4);
+    stats = pool.stats();
+    for (int i = 0; i < 10; i++) {
+        auto a = pool.Acquire();
+        auto b = pool.Acquire();
+        auto c = pool.Acquire();
+        auto d = pool.Acquire();
+    }
+    CHECK(pool.stats().heap_allocations == stats.heap_allocations + 2);
+    CHECK(pool.stats().heap_frees == stats.heap_frees);
+    {
+        auto a = pool.Acquire();
+        auto b = pool.Acquire();
+        auto c = pool.Acquire();
+        auto d = pool.Acquire();
+        auto e = pool.Acquire();
+    }
+    CHECK(pool.stats().heap_allocations == stats.heap_allocations + 3);
+    CHECK(pool.stats().heap_frees == stats.heap_frees + 1);
+
+    return TestResult();
+}
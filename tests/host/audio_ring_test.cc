@@ -0,0 +1,163 @@
+#include "audio_ring.h"
+#include "test_check.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+static void TestFifo() {
+    AudioRing<int> ring(4);
+    for (int i = 0; i < 4; i++) {
+        int item = i;
+        CHECK(ring.TryPush(std::move(item)));
+    }
+    int extra = 4;
+    CHECK(!ring.TryPush(std::move(extra)));
+    CHECK(ring.full());
+    CHECK(ring.size() == 4);
+
+    for (int i = 0; i < 4; i++) {
+        int item = -1;
+        CHECK(ring.TryPop(item));
+        CHECK(item == i);
+    }
+    int item;
+    CHECK(!ring.TryPop(item));
+    CHECK(ring.empty());
+}
+
+static void TestClear() {
+    AudioRing<std::unique_ptr<int>> ring(4);
+    ring.TryPush(std::make_unique<int>(1));
+    ring.TryPush(std::make_unique<int>(2));
+    ring.Clear();
+    CHECK(ring.empty());
+    ring.TryPush(std::make_unique<int>(3));
+
+    std::unique_ptr<int> item;
+    CHECK(ring.TryPop(item));
+    CHECK(item != nullptr && *item == 3);
+    CHECK(!ring.TryPop(item));
+}
+
+static void TestClose() {
+    AudioRing<int> ring(2);
+    bool result = true;
+    std::thread consumer([&ring, &result]() {
+        int item;
+        result = ring.Pop(item);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ring.Close();
+    consumer.join();
+    CHECK(!result);
+}
+
+// One producer and one consumer through a small ring, every item arrives once and in order
+static void TestConcurrentPushPop(bool blocking) {
+    const int count = 1000000;
+    AudioRing<std::unique_ptr<int>> ring(8);
+
+    std::thread producer([&ring, blocking]() {
+        for (int i = 0; i < count; i++) {
+            auto item = std::make_unique<int>(i);
+            if (blocking) {
+                ring.Push(std::move(item));
+            } else {
+                while (!ring.TryPush(std::move(item))) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    });
+
+    int expected = 0;
+    int errors = 0;
+    while (expected < count) {
+        std::unique_ptr<int> item;
+        if (blocking) {
+            ring.Pop(item);
+        } else if (!ring.TryPop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (item == nullptr || *item != expected) {
+            errors++;
+        }
+        expected++;
+    }
+    producer.join();
+    CHECK(errors == 0);
+    CHECK(ring.empty());
+}
+
+// Clear() from a third task only drops items, the rest still arrive in order
+static void TestConcurrentClear() {
+    const int count = 200000;
+    AudioRing<int> ring(8);
+    std::atomic<bool> clearing = true;
+
+    std::thread clearer([&ring, &clearing]() {
+        while (clearing) {
+            ring.Clear();
+            std::this_thread::yield();
+        }
+    });
+    std::thread producer([&ring, &clearing, &clearer]() {
+        for (int i = 0; i < count; i++) {
+            int item = i;
+            ring.Push(std::move(item));
+        }
+        clearing = false;
+        clearer.join();
+        int last = count;
+        ring.Push(std::move(last));
+    });
+
+    int previous = -1;
+    int errors = 0;
+    while (previous != count) {
+        int item;
+        ring.Pop(item);
+        if (item <= previous) {
+            errors++;
+        }
+        previous = item;
+    }
+    producer.join();
+    CHECK(errors == 0);
+}
+
+static void TestLatestQueueDropsOldest() {
+    LatestQueue<uint32_t, 3> queue;
+    CHECK(queue.Push(1));
+    CHECK(queue.Push(2));
+    CHECK(queue.Push(3));
+    CHECK(!queue.Push(4));
+    CHECK(!queue.Push(5));
+    CHECK(queue.size() == 3);
+
+    uint32_t item;
+    for (uint32_t expected = 3; expected <= 5; expected++) {
+        CHECK(queue.Pop(item));
+        CHECK(item == expected);
+    }
+    CHECK(!queue.Pop(item));
+
+    queue.Push(6);
+    queue.Clear();
+    CHECK(!queue.Pop(item));
+}
+
+int main() {
+    TestFifo();
+    TestClear();
+    TestClose();
+    TestConcurrentPushPop(false);
+    TestConcurrentPushPop(true);
+    TestConcurrentClear();
+    TestLatestQueueDropsOldest();
+
+    return TestResult();
+}
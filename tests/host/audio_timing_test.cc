@@ -0,0 +1,55 @@
+#include "audio_timing.h"
+#include "test_check.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+#include <thread>
+
+static void TestRecord() {
+    AudioTimingHistogram histogram;
+    histogram.Record(500);
+    histogram.Record(1500);
+    histogram.Record(200000);
+    CHECK(histogram.count() == 3);
+    CHECK(histogram.average_us() == (500 + 1500 + 200000) / 3);
+    CHECK(histogram.max_us() == 200000);
+
+    char buffer[128];
+    histogram.Format(buffer, sizeof(buffer));
+    CHECK(std::string_view(buffer).find("[1 1 0 0 0 0 0 0 1]") != std::string_view::npos);
+}
+
+// MoveTo() from another task while samples are recorded, every sample is counted exactly once
+static void TestConcurrentMoveTo() {
+    const int count = 1000000;
+    AudioTimingHistogram histogram;
+    std::atomic<bool> recording = true;
+
+    std::thread recorder([&histogram, &recording]() {
+        for (int i = 0; i < count; i++) {
+            histogram.Record(i % 3000);
+        }
+        recording = false;
+    });
+
+    uint64_t moved_count = 0;
+    bool done = false;
+    while (!done) {
+        done = !recording;
+        AudioTimingHistogram snapshot;
+        histogram.MoveTo(snapshot);
+        moved_count += snapshot.count();
+    }
+    recorder.join();
+
+    CHECK(moved_count == count);
+    CHECK(histogram.count() == 0);
+}
+
+int main() {
+    TestRecord();
+    TestConcurrentMoveTo();
+
+    return TestResult();
+}
@@ -0,0 +1,261 @@
+#include "control_message.h"
+#include "test_check.h"
+
+#include <cJSON.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+// Heap blocks taken by cJSON through its hooks and by C++ code through operator new
+static size_t cjson_allocations = 0;
+static size_t heap_allocations = 0;
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    if (void* p = malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static void* CountingMalloc(size_t size) {
+    cjson_allocations++;
+    return malloc(size);
+}
+
+#define TRACE_ROUNDS 2000
+
+struct Frame {
+    const char* json;
+    const char* type;
+    const char* state;
+    const char* text;
+    const char* emotion;
+    const char* session_id;
+};
+
+// Messages recorded from the server, with the fields the tokenizer is expected to give
+static const Frame kFrames[] = {
+    {R"({"type":"tts","state":"start","sample_rate":24000,"session_id":"5b1f0c2e"})",
+        "tts", "start", "", "", "5b1f0c2e"},
+    {R"({"type":"tts","state":"sentence_start","text":"你好，有什么可以帮你的吗？","session_id":"5b1f0c2e"})",
+        "tts", "sentence_start", "你好，有什么可以帮你的吗？", "", "5b1f0c2e"},
+    {R"({"type": "tts", "state": "sentence_start", "text": "今天天气怎么样？", "session_id": "5b1f0c2e"})",
+        "tts", "sentence_start", "今天天气怎么样？", "", "5b1f0c2e"},
+    {R"({"type":"tts","state":"sentence_end","text":"He said \"hi\"\n\tC:\\path\/x","session_id":"5b1f0c2e"})",
+        "tts", "sentence_end", "He said \"hi\"\n\tC:\\path/x", "", "5b1f0c2e"},
+    {R"({"type":"tts","state":"stop","session_id":"5b1f0c2e"})",
+        "tts", "stop", "", "", "5b1f0c2e"},
+    {R"({"type":"stt","text":"今天天气怎么样","session_id":"5b1f0c2e"})",
+        "stt", "", "今天天气怎么样", "", "5b1f0c2e"},
+    {R"({"type":"llm","text":"😊","emotion":"happy","session_id":"5b1f0c2e"})",
+        "llm", "", "😊", "happy", "5b1f0c2e"},
+    {R"({"type": "llm", "text": "\ud83d\ude0a", "emotion": "happy", "session_id": "5b1f0c2e"})",
+        "llm", "", "😊", "happy", "5b1f0c2e"},
+    {"{\r\n  \"session_id\" : \"5b1f0c2e\",\r\n  \"type\" : \"stt\",\r\n  \"text\" : \"\\u00e9t\\u00e9\"\r\n}\r\n",
+        "stt", "", "été", "", "5b1f0c2e"},
+    // Other keys and values are skipped, strings with braces inside included
+    {R"({"type":"tts","meta":{"list":[1,-2.5e3,true,null,"}]"],"x":{}},"state":"start","id":false})",
+        "tts", "start", "", "", ""},
+    // Values that are not strings leave the field empty
+    {R"({"type":"tts","state":1,"text":null,"emotion":["happy"],"session_id":{"id":"5b1f0c2e"}})",
+        "tts", "", "", "", ""},
+    // cJSON_GetObjectItem() ignores case and returns the first of duplicate keys
+    {R"({"Type":"tts","STATE":"start","Session_Id":"5b1f0c2e"})",
+        "tts", "start", "", "", "5b1f0c2e"},
+    {R"({"type":"tts","state":"start","type":"llm","state":"stop"})",
+        "tts", "start", "", "", ""},
+    {R"({"type":"stt","TYPE":"llm","text":"first","text":"second"})",
+        "stt", "", "first", "", ""},
+    {R"({"type":1,"type":"tts"})",
+        "", "", "", "", ""},
+    {R"({})",
+        "", "", "", "", ""},
+};
+
+// Texts that Parse() hands to cJSON instead
+static const char* kRejected[] = {
+    "",
+    "[]",
+    R"("tts")",
+    R"({"type":"tts")",
+    R"({"type":"tts",})",
+    R"({"type" "tts"})",
+    R"({"type":"tts"}})",
+    R"({"type":"tts"} {"type":"llm"})",
+    R"({"type":"tts"}x)",
+    R"({} x)",
+    R"({"type":tts})",
+    R"({"type":"tts","count":})",
+    R"({"type":"tts","flag":nul})",
+    R"({"type":"t\qs"})",
+    R"({"type":"tts","text":"\u12"})",
+    R"({"type":"tts","text":"a\u0000b"})",
+    R"({"type":"tts","text":"\ud83d"})",
+    R"({"type":"tts","text":"\ud83dx"})",
+    R"({"type":"tts","text":"\ude0a"})",
+    R"({"type":"tts","text":"\ud83d\u0041"})",
+    R"({"type":"tts","text":"unterminated})",
+};
+
+static bool Equals(std::string_view view, const char* expected) {
+    return view == std::string_view(expected);
+}
+
+// Both overloads of Parse() give the same fields for a text that cJSON parses
+static bool MatchesCJSON(const char* json, const ControlMessage& message) {
+    cJSON* root = cJSON_ParseWithLength(json, strlen(json));
+    if (root == nullptr) {
+        return false;
+    }
+    ControlMessage expected;
+    expected.Parse(root);
+    bool same = expected.type == message.type && expected.state == message.state &&
+        expected.text == message.text && expected.emotion == message.emotion &&
+        expected.session_id == message.session_id;
+    cJSON_Delete(root);
+    return same;
+}
+
+static void TestFrames() {
+    char buffer[CONTROL_MESSAGE_BUFFER_SIZE];
+    for (auto& frame : kFrames) {
+        ControlMessage message;
+        bool parsed = message.Parse(frame.json, buffer, sizeof(buffer));
+        CHECK(parsed);
+        if (!parsed) {
+            printf("  %s\n", frame.json);
+            continue;
+        }
+        CHECK(Equals(message.type, frame.type));
+        CHECK(Equals(message.state, frame.state));
+        CHECK(Equals(message.text, frame.text));
+        CHECK(Equals(message.emotion, frame.emotion));
+        CHECK(Equals(message.session_id, frame.session_id));
+        bool matches = MatchesCJSON(frame.json, message);
+        CHECK(matches);
+        if (!matches) {
+            printf("  %s\n", frame.json);
+        }
+    }
+}
+
+static void TestRejected() {
+    char buffer[CONTROL_MESSAGE_BUFFER_SIZE];
+    for (auto json : kRejected) {
+        ControlMessage message;
+        bool parsed = message.Parse(json, buffer, sizeof(buffer));
+        CHECK(!parsed);
+        if (parsed) {
+            printf("  %s\n", json);
+        }
+    }
+}
+
+// Escaped strings share the buffer, a text that does not fit goes to cJSON
+static void TestBufferSize() {
+    const char* json = R"({"type":"stt","text":"\u4eca\u5929","emotion":"\u4eca"})";
+    char buffer[9];
+    ControlMessage message;
+    CHECK(message.Parse(json, buffer, sizeof(buffer)));
+    CHECK(Equals(message.text, "今天"));
+    CHECK(Equals(message.emotion, "今"));
+    CHECK(!message.Parse(json, buffer, 8));
+
+    // Strings without escapes are views into the text and take no buffer
+    std::string text(4 * CONTROL_MESSAGE_BUFFER_SIZE, 'a');
+    std::string long_json = R"({"type":"stt","text":")" + text + R"("})";
+    CHECK(message.Parse(long_json, buffer, sizeof(buffer)));
+    CHECK(message.text == text);
+    CHECK(message.text.data() > long_json.data() && message.text.data() < long_json.data() + long_json.size());
+}
+
+static void TestIsFrequent() {
+    char buffer[CONTROL_MESSAGE_BUFFER_SIZE];
+    ControlMessage message;
+    for (auto type : {"tts", "stt", "llm"}) {
+        std::string json = std::string(R"({"type":")") + type + R"("})";
+        CHECK(message.Parse(json, buffer, sizeof(buffer)));
+        CHECK(message.IsFrequent());
+    }
+    for (auto type : {"mcp", "hello", "TTS", ""}) {
+        std::string json = std::string(R"({"type":")") + type + R"("})";
+        CHECK(message.Parse(json, buffer, sizeof(buffer)));
+        CHECK(!message.IsFrequent());
+    }
+}
+
+struct TraceResult {
+    double ns_per_message;
+    double allocations_per_message;
+};
+
+template <typename Function>
+static TraceResult RunTrace(size_t& allocations, Function function) {
+    size_t start_allocations = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < TRACE_ROUNDS; round++) {
+        for (auto& frame : kFrames) {
+            function(std::string_view(frame.json));
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    size_t messages = TRACE_ROUNDS * (sizeof(kFrames) / sizeof(kFrames[0]));
+    return {
+        (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / messages,
+        (double)(allocations - start_allocations) / messages,
+    };
+}
+
+// Parse time and heap churn over the recorded frames, the tokenizer against a cJSON tree
+static void BenchmarkTrace() {
+    cJSON_Hooks hooks = { CountingMalloc, free };
+    cJSON_InitHooks(&hooks);
+
+    char buffer[CONTROL_MESSAGE_BUFFER_SIZE];
+    ControlMessage message;
+    size_t fields = 0;
+    auto tokenizer = RunTrace(heap_allocations, [&](std::string_view json) {
+        if (message.Parse(json, buffer, sizeof(buffer))) {
+            fields += message.type.size();
+        }
+    });
+    auto cjson = RunTrace(cjson_allocations, [&](std::string_view json) {
+        cJSON* root = cJSON_ParseWithLength(json.data(), json.size());
+        if (root != nullptr) {
+            message.Parse(root);
+            fields += message.type.size();
+            cJSON_Delete(root);
+        }
+    });
+    cJSON_InitHooks(nullptr);
+
+    CHECK(fields > 0);
+    CHECK(tokenizer.allocations_per_message == 0);
+    CHECK(cjson.allocations_per_message > 0);
+    printf("%-10s %10.1f ns %8.2f allocations per message\n", "tokenizer",
+        tokenizer.ns_per_message, tokenizer.allocations_per_message);
+    printf("%-10s %10.1f ns %8.2f allocations per message\n", "cJSON",
+        cjson.ns_per_message, cjson.allocations_per_message);
+}
+
+int main() {
+    TestFrames();
+    TestRejected();
+    TestBufferSize();
+    TestIsFrequent();
+    BenchmarkTrace();
+
+    return TestResult();
+}
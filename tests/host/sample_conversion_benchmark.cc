@@ -0,0 +1,90 @@
+#include "sample_conversion_benchmark.h"
+#include "sample_conversion.h"
+#include "sample_conversion_reference.h"
+#include "test_check.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+// Host timing of the kernels against the original codec loops, in nanoseconds per call.
+// The target logs cycle counts with CONFIG_USE_SAMPLE_CONVERSION_BENCHMARK.
+
+static uint32_t Nanoseconds() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+struct ReferenceTiming {
+    const char* name;
+    uint32_t ticks;
+};
+
+static size_t RunReference(ReferenceTiming* timings) {
+    const size_t samples = SAMPLE_CONVERSION_BENCHMARK_SAMPLES;
+    std::vector<int16_t> pcm(samples), output(samples);
+    std::vector<int32_t> pcm32(samples);
+    uint32_t seed = 12345;
+    for (auto& sample : pcm) {
+        seed = seed * 1664525 + 1013904223;
+        sample = (int16_t)(seed >> 16);
+    }
+    for (size_t i = 0; i < samples; i++) {
+        pcm32[i] = (int32_t)pcm[i] << 15;
+    }
+
+    // Read at run time, as the kernels get them, so the loops are not specialised for constants
+    volatile int shift_value = 14;
+    volatile int gain_value = 4;
+    int shift = shift_value;
+    int gain = gain_value;
+
+    size_t count = 0;
+    for (int32_t factor : { SAMPLE_UNITY_FACTOR, SAMPLE_UNITY_FACTOR / 2, SAMPLE_UNITY_FACTOR * 2 }) {
+        uint32_t ticks = SampleConversionBenchmark::Measure(Nanoseconds, [&]() {
+            for (size_t i = 0; i < samples; i++) {
+                pcm32[i] = ReferenceInt16ToInt32(pcm[i], factor);
+            }
+        });
+        timings[count++] = { factor == SAMPLE_UNITY_FACTOR ? "Int16ToInt32 unity" :
+            factor < SAMPLE_UNITY_FACTOR ? "Int16ToInt32 half" : "Int16ToInt32 boost", ticks };
+    }
+    for (size_t i = 0; i < samples; i++) {
+        pcm32[i] = (int32_t)pcm[i] << 15;
+    }
+    timings[count++] = { "Int32ToInt16", SampleConversionBenchmark::Measure(Nanoseconds, [&]() {
+        for (size_t i = 0; i < samples; i++) {
+            output[i] = ReferenceInt32ToInt16(pcm32[i], shift);
+        }
+    }) };
+    timings[count++] = { "ApplyGain", SampleConversionBenchmark::Measure(Nanoseconds, [&]() {
+        output = pcm;
+        for (size_t i = 0; i < samples; i++) {
+            output[i] = ReferenceGain(output[i], gain);
+        }
+    }) };
+    return count;
+}
+
+int main() {
+    SampleConversionTiming timings[SAMPLE_CONVERSION_BENCHMARK_KERNELS];
+    size_t count = SampleConversionBenchmark::Run(Nanoseconds, timings, SAMPLE_CONVERSION_BENCHMARK_KERNELS);
+    CHECK(count == SAMPLE_CONVERSION_BENCHMARK_KERNELS);
+
+    ReferenceTiming references[5];
+    size_t reference_count = RunReference(references);
+
+    printf("%-20s %12s %12s  (ns per %d samples)\n", "kernel", "current", "reference", SAMPLE_CONVERSION_BENCHMARK_SAMPLES);
+    for (size_t i = 0; i < count; i++) {
+        printf("%-20s %12u", timings[i].name, (unsigned)timings[i].ticks);
+        for (size_t j = 0; j < reference_count; j++) {
+            if (std::string_view(references[j].name) == timings[i].name) {
+                printf(" %12u", (unsigned)references[j].ticks);
+            }
+        }
+        printf("\n");
+    }
+
+    return TestResult();
+}
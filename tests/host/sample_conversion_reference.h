@@ -0,0 +1,33 @@
+#ifndef SAMPLE_CONVERSION_REFERENCE_H
+#define SAMPLE_CONVERSION_REFERENCE_H
+
+#include <cmath>
+#include <cstdint>
+
+// The per-sample loops the codecs used before SampleConversion, kept as the scalar reference
+
+inline int32_t ReferenceVolumeFactor(int volume) {
+    return pow(double(volume) / 100.0, 2) * 65536;
+}
+
+inline int32_t ReferenceInt16ToInt32(int16_t sample, int32_t factor) {
+    int64_t temp = int64_t(sample) * factor;
+    if (temp > INT32_MAX) {
+        return INT32_MAX;
+    } else if (temp < INT32_MIN) {
+        return INT32_MIN;
+    }
+    return (int32_t)temp;
+}
+
+inline int16_t ReferenceInt32ToInt16(int32_t sample, int shift) {
+    int32_t value = sample >> shift;
+    return (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+}
+
+inline int16_t ReferenceGain(int16_t sample, int gain) {
+    int32_t amplified = sample * gain;
+    return (amplified > INT16_MAX) ? INT16_MAX : (amplified < -INT16_MAX) ? -INT16_MAX : (int16_t)amplified;
+}
+
+#endif // SAMPLE_CONVERSION_REFERENCE_H
@@ -0,0 +1,129 @@
+#include "sample_conversion.h"
+#include "sample_conversion_reference.h"
+#include "test_check.h"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static std::vector<int16_t> RandomSamples(std::mt19937& random, size_t count) {
+    std::uniform_int_distribution<int> distribution(INT16_MIN, INT16_MAX);
+    std::vector<int16_t> samples(count);
+    for (auto& sample : samples) {
+        sample = distribution(random);
+    }
+    // Edge values first
+    const int16_t edges[] = { INT16_MIN, INT16_MIN + 1, -1, 0, 1, INT16_MAX - 1, INT16_MAX };
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]) && i < count; i++) {
+        samples[i] = edges[i];
+    }
+    return samples;
+}
+
+static void TestVolumeFactor() {
+    for (int volume = 0; volume <= 100; volume++) {
+        CHECK(SampleConversion::VolumeFactor(volume) == ReferenceVolumeFactor(volume));
+    }
+    CHECK(SampleConversion::VolumeFactor(100) == SAMPLE_UNITY_FACTOR);
+}
+
+static void TestInt16ToInt32(std::mt19937& random) {
+    auto src = RandomSamples(random, 4096);
+    std::vector<int32_t> dest(src.size());
+    // The 32-bit path up to unity and the saturating path above it
+    const int32_t factors[] = { 0, 1, 655, 16384, 65535, SAMPLE_UNITY_FACTOR, SAMPLE_UNITY_FACTOR + 1, 4 * SAMPLE_UNITY_FACTOR, -SAMPLE_UNITY_FACTOR };
+    for (int32_t factor : factors) {
+        SampleConversion::Int16ToInt32(src.data(), dest.data(), src.size(), factor);
+        int errors = 0;
+        for (size_t i = 0; i < src.size(); i++) {
+            errors += dest[i] != ReferenceInt16ToInt32(src[i], factor);
+        }
+        CHECK(errors == 0);
+    }
+}
+
+static void TestInt32ToInt16(std::mt19937& random) {
+    std::uniform_int_distribution<int32_t> distribution(INT32_MIN, INT32_MAX);
+    std::vector<int32_t> src(4096);
+    for (auto& sample : src) {
+        sample = distribution(random);
+    }
+    src[0] = INT32_MIN;
+    src[1] = INT32_MAX;
+    std::vector<int16_t> dest(src.size());
+    for (int shift : { 0, 12, 16 }) {
+        SampleConversion::Int32ToInt16(src.data(), dest.data(), src.size(), shift);
+        int errors = 0;
+        for (size_t i = 0; i < src.size(); i++) {
+            errors += dest[i] != ReferenceInt32ToInt16(src[i], shift);
+        }
+        CHECK(errors == 0);
+    }
+}
+
+static void TestApplyGain(std::mt19937& random) {
+    auto src = RandomSamples(random, 4096);
+    for (int gain : { 2, 4, 31 }) {
+        auto data = src;
+        SampleConversion::ApplyGain(data.data(), data.size(), gain);
+        int errors = 0;
+        for (size_t i = 0; i < src.size(); i++) {
+            errors += data[i] != ReferenceGain(src[i], gain);
+        }
+        CHECK(errors == 0);
+    }
+
+    // Unity gain leaves the samples untouched, INT16_MIN included
+    auto data = src;
+    SampleConversion::ApplyGain(data.data(), data.size(), 1);
+    CHECK(data == src);
+}
+
+static void TestChannels(std::mt19937& random) {
+    const size_t frames = 1001;
+    auto stereo = RandomSamples(random, frames * 2);
+    std::vector<int16_t> left(frames), right(frames), interleaved(frames * 2);
+
+    SampleConversion::Deinterleave(stereo.data(), left.data(), right.data(), frames);
+    int errors = 0;
+    for (size_t i = 0; i < frames; i++) {
+        errors += left[i] != stereo[2 * i] || right[i] != stereo[2 * i + 1];
+    }
+    CHECK(errors == 0);
+
+    SampleConversion::Interleave(left.data(), right.data(), interleaved.data(), frames);
+    CHECK(interleaved == stereo);
+
+    // In place, as NoAudioProcessor does
+    auto in_place = stereo;
+    SampleConversion::ExtractChannel(in_place.data(), in_place.data(), frames, 2, 0);
+    in_place.resize(frames);
+    CHECK(in_place == left);
+
+    std::vector<int16_t> mono(frames);
+    SampleConversion::StereoToMono(stereo.data(), mono.data(), frames);
+    errors = 0;
+    for (size_t i = 0; i < frames; i++) {
+        errors += mono[i] != (((int32_t)stereo[2 * i] + stereo[2 * i + 1]) >> 1);
+    }
+    CHECK(errors == 0);
+
+    std::vector<int16_t> doubled(frames * 2);
+    SampleConversion::MonoToStereo(mono.data(), doubled.data(), frames);
+    errors = 0;
+    for (size_t i = 0; i < frames; i++) {
+        errors += doubled[2 * i] != mono[i] || doubled[2 * i + 1] != mono[i];
+    }
+    CHECK(errors == 0);
+}
+
+int main() {
+    std::mt19937 random(12345);
+    TestVolumeFactor();
+    TestInt16ToInt32(random);
+    TestInt32ToInt16(random);
+    TestApplyGain(random);
+    TestChannels(random);
+
+    return TestResult();
+}
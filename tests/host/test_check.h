@@ -0,0 +1,25 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <cstdio>
+
+// Checks of the host tests count failures and keep going, main() returns TestResult()
+inline int test_failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+        test_failures++; \
+    } \
+} while (0)
+
+inline int TestResult() {
+    if (test_failures > 0) {
+        printf("%d checks failed\n", test_failures);
+        return 1;
+    }
+    printf("All tests passed\n");
+    return 0;
+}
+
+#endif // TEST_CHECK_H
@@ -0,0 +1,193 @@
+#include "protocol.h"
+#include "test_check.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+// Loopback of websocket audio frames: framed for sending, then parsed as OnData does on receive.
+// The original path built a std::string per frame and byte swapped the received header in place;
+// the current one writes the header into the packet's headroom and reads it through a const view.
+
+static size_t heap_allocations = 0;
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    if (void* p = malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+#define LOOPBACK_FRAMES 20000
+#define OPUS_FRAME_BYTES 240
+
+// Sending as SendAudio did before the headroom
+static std::string ReferenceFrame(const AudioStreamPacket& packet, int version) {
+    std::string serialized;
+    if (version == 2) {
+        serialized.resize(sizeof(BinaryProtocol2) + packet.payload.size());
+        auto bp2 = (BinaryProtocol2*)serialized.data();
+        bp2->version = htons(version);
+        bp2->type = 0;
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(packet.timestamp);
+        bp2->payload_size = htonl(packet.payload.size());
+        memcpy(bp2->payload, packet.payload.data(), packet.payload.size());
+    } else {
+        serialized.resize(sizeof(BinaryProtocol3) + packet.payload.size());
+        auto bp3 = (BinaryProtocol3*)serialized.data();
+        bp3->type = 0;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(packet.payload.size());
+        memcpy(bp3->payload, packet.payload.data(), packet.payload.size());
+    }
+    return serialized;
+}
+
+// Receiving as OnData did, swapping the header of the socket buffer in place
+static void ReferenceParse(char* data, int version, AudioStreamPacket& packet) {
+    if (version == 2) {
+        auto bp2 = (BinaryProtocol2*)data;
+        bp2->version = ntohs(bp2->version);
+        bp2->type = ntohs(bp2->type);
+        bp2->timestamp = ntohl(bp2->timestamp);
+        bp2->payload_size = ntohl(bp2->payload_size);
+        packet.timestamp = bp2->timestamp;
+        packet.payload.assign(bp2->payload, bp2->payload + bp2->payload_size);
+    } else {
+        auto bp3 = (BinaryProtocol3*)data;
+        bp3->payload_size = ntohs(bp3->payload_size);
+        packet.payload.assign(bp3->payload, bp3->payload + bp3->payload_size);
+    }
+}
+
+struct LoopbackResult {
+    double ns_per_frame;
+    double allocations_per_frame;
+};
+
+template <typename Function>
+static LoopbackResult Loopback(Function function) {
+    function(0);    // The pool and the buffers are warm before counting
+    size_t allocations = heap_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 1; i <= LOOPBACK_FRAMES; i++) {
+        function(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return {
+        (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / LOOPBACK_FRAMES,
+        (double)(heap_allocations - allocations) / LOOPBACK_FRAMES,
+    };
+}
+
+static void FillOpus(std::vector<uint8_t>& payload, uint32_t seed) {
+    payload.resize(OPUS_FRAME_BYTES);
+    for (auto& byte : payload) {
+        seed = seed * 1664525 + 1013904223;
+        byte = (uint8_t)(seed >> 24);
+    }
+}
+
+static void TestRoundTrip(int version) {
+    std::vector<uint8_t> opus;
+    FillOpus(opus, version);
+
+    AudioStreamPacket packet;
+    packet.Reserve(OPUS_FRAME_BYTES);
+    packet.payload = opus;
+    packet.timestamp = 0x12345678;
+    PrependBinaryProtocolHeader(packet, version, AUDIO_BATCH_MESSAGE_TYPE);
+    CHECK(packet.payload.size() == opus.size() + (version == 2 ? sizeof(BinaryProtocol2) : sizeof(BinaryProtocol3)));
+
+    // The same bytes on the wire as the original framing, apart from the type
+    AudioStreamPacket plain;
+    plain.payload = opus;
+    plain.timestamp = packet.timestamp;
+    std::string reference = ReferenceFrame(plain, version);
+    CHECK(reference.size() == packet.payload.size());
+    if (version == 2) {
+        CHECK(ntohs(((const BinaryProtocol2*)packet.payload.data())->type) == AUDIO_BATCH_MESSAGE_TYPE);
+        ((BinaryProtocol2*)packet.payload.data())->type = 0;
+    } else {
+        CHECK(((const BinaryProtocol3*)packet.payload.data())->type == AUDIO_BATCH_MESSAGE_TYPE);
+        ((BinaryProtocol3*)packet.payload.data())->type = 0;
+    }
+    CHECK(memcmp(reference.data(), packet.payload.data(), reference.size()) == 0);
+
+    std::vector<uint8_t> wire = packet.payload;
+    AudioStreamPacket received;
+    CHECK(ParseBinaryProtocolFrame(wire.data(), wire.size(), version, received));
+    CHECK(received.payload == opus);
+    CHECK(received.timestamp == (version == 2 ? 0x12345678u : 0u));
+    CHECK(wire == packet.payload);
+
+    // A payload_size past the end of the frame is cut to the frame, a short header is refused
+    CHECK(ParseBinaryProtocolFrame(wire.data(), wire.size() - 10, version, received));
+    CHECK(received.payload.size() == opus.size() - 10);
+    size_t header = version == 2 ? sizeof(BinaryProtocol2) : sizeof(BinaryProtocol3);
+    CHECK(!ParseBinaryProtocolFrame(wire.data(), header - 1, version, received));
+}
+
+static void BenchmarkLoopback(int version) {
+    auto& pool = AudioStreamPacketPool::GetInstance();
+    std::vector<uint8_t> opus;
+    FillOpus(opus, 1);
+    std::vector<char> socket_buffer(OPUS_FRAME_BYTES + AUDIO_PACKET_HEADROOM);
+    size_t received_bytes = 0;
+
+    auto reference = Loopback([&](uint32_t i) {
+        auto packet = pool.Acquire();
+        packet->payload.assign(opus.begin(), opus.end());
+        packet->timestamp = i;
+        std::string frame = ReferenceFrame(*packet, version);
+        memcpy(socket_buffer.data(), frame.data(), frame.size());
+        auto received = pool.Acquire();
+        ReferenceParse(socket_buffer.data(), version, *received);
+        received_bytes += received->payload.size();
+    });
+    auto current = Loopback([&](uint32_t i) {
+        auto packet = pool.Acquire();
+        packet->payload.assign(opus.begin(), opus.end());
+        packet->timestamp = i;
+        PrependBinaryProtocolHeader(*packet, version, 0);
+        memcpy(socket_buffer.data(), packet->payload.data(), packet->payload.size());
+        auto received = pool.Acquire();
+        ParseBinaryProtocolFrame((const uint8_t*)socket_buffer.data(), packet->payload.size(), version, *received);
+        received_bytes += received->payload.size();
+    });
+    CHECK(received_bytes == 2 * (LOOPBACK_FRAMES + 1) * (size_t)OPUS_FRAME_BYTES);
+    // Framing in the headroom of a pooled packet takes nothing from the heap
+    CHECK(current.allocations_per_frame == 0);
+
+    printf("v%d %-10s %10.1f ns %8.2f allocations per frame\n", version, "string",
+        reference.ns_per_frame, reference.allocations_per_frame);
+    printf("v%d %-10s %10.1f ns %8.2f allocations per frame\n", version, "headroom",
+        current.ns_per_frame, current.allocations_per_frame);
+}
+
+int main() {
+    AudioStreamPacketPool::GetInstance().Reserve(4, OPUS_FRAME_BYTES);
+
+    TestRoundTrip(2);
+    TestRoundTrip(3);
+
+    printf("Loopback of %d frames of %d bytes\n", LOOPBACK_FRAMES, OPUS_FRAME_BYTES);
+    BenchmarkLoopback(2);
+    BenchmarkLoopback(3);
+
+    return TestResult();
+}